@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include <stdint.h>
+
+// Kernel maps this page read-only into every user process, so that the clock
+// can be read without a system call. It's the last page of user address space.
+#define CLOCKPAGE_ADDR 0x7ffffff000ULL
+
+#define CLOCKPAGE_MAX_PROCESSORS 256
+
+struct ClockPage {
+        // Odd while the kernel is updating the page. Readers must try again
+        // if it's odd, or it has changed while reading.
+        uint32_t seq;
+        // If zero, the clock can only be read with the clock_gettime system
+        // call.
+        uint32_t is_usable;
+        // Nanoseconds = ((TSC - tsc_offsets[N]) * ns_mult) >> 32, where TSC
+        // and N are values returned by RDTSCP.
+        uint64_t ns_mult;
+        uint64_t tsc_offsets[CLOCKPAGE_MAX_PROCESSORS];
+};
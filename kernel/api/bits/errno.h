@@ -3,11 +3,14 @@
 // SPDX-License-Identifier: BSD-2-Clause
 #pragma once
 
+#define EPERM   1  // Operation not permitted
 #define ENOENT  2  // No such file or directory
+#define ESRCH   3  // No such process
 #define EIO     5  // Input/Output Error
 #define ENOEXEC 8  // Exec format error
 #define EBADF   9  // Bad file descriptor
 #define ENOMEM  12 // Cannot allocate memory
 #define EFAULT  14 // Bad address
+#define ENODEV  19 // No such device
 #define EINVAL  22 // Invalid argument
 #define ENOSYS  38 // Function not implemented
@@ -6,3 +6,4 @@
 // https://pubs.opengroup.org/onlinepubs/9699919799/basedefs/limits.h.html
 
 #define SSIZE_MAX 0x7FFFFFFFFFFFFFFF
+#define NZERO     20
@@ -0,0 +1,16 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+#define PROT_NONE  0
+#define PROT_READ  (1 << 0)
+#define PROT_WRITE (1 << 1)
+#define PROT_EXEC  (1 << 2)
+
+#define MAP_SHARED    (1 << 0)
+#define MAP_PRIVATE   (1 << 1)
+#define MAP_FIXED     (1 << 4)
+#define MAP_ANONYMOUS (1 << 5)
+#define MAP_ANON      MAP_ANONYMOUS
+#define MAP_POPULATE  (1 << 15)
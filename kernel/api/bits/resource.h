@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "time.h"
+
+#define RUSAGE_SELF   0
+// Only the calling thread. (Not in POSIX)
+#define RUSAGE_THREAD 1
+
+struct rusage {
+        struct timeval ru_utime;
+        struct timeval ru_stime;
+        // Context switches because of going to sleep, and because of other
+        // threads taking the processor.
+        long ru_nvcsw;
+        long ru_nivcsw;
+        // Time spent waiting for a processor while runnable. (Not in POSIX)
+        struct timeval ru_wtime;
+};
@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include <stdint.h>
+
+// Largest number of processors a CPU set can hold.
+#define CPU_SETSIZE 256
+
+// Bit N stands for Nth processor.
+typedef struct {
+        uint64_t bits[CPU_SETSIZE / 64];
+} cpu_set_t;
+
+// Scheduling policies
+#define SCHED_OTHER 0 // Fair time-sharing
+#define SCHED_FIFO  1 // Real-time, runs until it sleeps or yields
+#define SCHED_RR    2 // Real-time, with time slices among equal priorities
+
+struct sched_param {
+        // 1~99 for real-time policies, where higher runs first. 0 for
+        // SCHED_OTHER.
+        int sched_priority;
+};
@@ -3,8 +3,21 @@
 // SPDX-License-Identifier: BSD-2-Clause
 #pragma once
 
-#define SYSCALL_INDEX_WRITE       0
-#define SYSCALL_INDEX_READ        1
-#define SYSCALL_INDEX_SCHED_YIELD 2
-#define SYSCALL_INDEX_DPRINT      3
-#define SYSCALL_COUNT             4
+#define SYSCALL_INDEX_WRITE              0
+#define SYSCALL_INDEX_READ               1
+#define SYSCALL_INDEX_SCHED_YIELD        2
+#define SYSCALL_INDEX_DPRINT             3
+#define SYSCALL_INDEX_FORK               4
+#define SYSCALL_INDEX_MMAP               5
+#define SYSCALL_INDEX_MUNMAP             6
+#define SYSCALL_INDEX_NICE               7
+#define SYSCALL_INDEX_CLOCK_NANOSLEEP    8
+#define SYSCALL_INDEX_CLOCK_GETTIME      9
+#define SYSCALL_INDEX_SCHED_SETAFFINITY  10
+#define SYSCALL_INDEX_SCHED_GETAFFINITY  11
+#define SYSCALL_INDEX_GETRUSAGE          12
+#define SYSCALL_INDEX_SCHED_SETSCHEDULER 13
+#define SYSCALL_INDEX_SCHED_GETSCHEDULER 14
+#define SYSCALL_INDEX_SCHED_GETPARAM     15
+#define SYSCALL_INDEX_THREAD_EXIT        16
+#define SYSCALL_COUNT                    17
@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include <sys/types.h>
+
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
+#define TIMER_ABSTIME (1 << 0)
+
+struct timespec {
+        time_t tv_sec;
+        long tv_nsec;
+};
+
+struct timeval {
+        time_t tv_sec;
+        suseconds_t tv_usec;
+};
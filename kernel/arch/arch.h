@@ -43,6 +43,12 @@ typedef uint8_t mmu_prot_t;
 #define MMU_PROT_USER  (1 << 0)
 #define MMU_PROT_WRITE (1 << 1)
 #define MMU_PROT_EXEC  (1 << 2)
+// Page stays shared with the child(instead of becoming copy-on-write) when the
+// address space is forked.
+#define MMU_PROT_SHARED (1 << 3)
+// Page belongs to the kernel rather than the address space(e.g. the clock
+// page). Forking maps it into the child as it is, without taking a reference.
+#define MMU_PROT_KERNEL_OWNED (1 << 4)
 
 WARN_UNUSED_RESULT bool
 mmu_map(mmu_addrspace_t handle,
@@ -57,6 +63,9 @@ bool mmu_lowmem_identity_map(uintptr_t physaddr, mmu_prot_t prot);
 void mmu_lowmem_identity_unmap(uintptr_t physaddr);
 // Returns MMU_ADDRSPACE_INVALID on OOM.
 mmu_addrspace_t mmu_addrspace_create(void);
+// Unmaps every page, dropping the reference to each physical page(and freeing
+// pages nobody else uses), and frees the address space. Pages mapped with
+// MMU_PROT_KERNEL_OWNED are left alone. The address space must not be active.
 void mmu_addrspace_delete(mmu_addrspace_t addrspace);
 void mmu_activate_user_vm_addrspace(mmu_addrspace_t addrspace);
 void mmu_deactivate_user_vm_addrspace(void);
@@ -65,7 +74,49 @@ void mmu_activate_addrspace(
 );
 mmu_addrspace_t mmu_active_user_vm_addrspace(void);
 uintptr_t mmu_virt_to_phys(void *virtaddr);
+// Returns false if `virtaddr` is not mapped in the address space.
+WARN_UNUSED_RESULT bool mmu_lookup(
+        mmu_addrspace_t handle, void *virtaddr, uintptr_t *physaddr_out
+);
 bool mmu_is_accessible(void *virtaddr, mmu_prot_t requires);
+// Fills the physical page with zeros.
+void mmu_zero_page(uintptr_t physaddr);
+void mmu_copy_page(uintptr_t dest_physaddr, uintptr_t src_physaddr);
+// Maps every page of `src` into `dest` as well, adding a reference to each
+// physical page. Writable pages become read-only copy-on-write pages on both
+// sides, unless they were mapped with MMU_PROT_SHARED. Pages mapped with
+// MMU_PROT_KERNEL_OWNED are mapped as they are, without a reference.
+//
+// Returns false on OOM.
+WARN_UNUSED_RESULT bool
+mmu_addrspace_share_cow(mmu_addrspace_t dest, mmu_addrspace_t src);
+bool mmu_is_cow(mmu_addrspace_t handle, void *virtaddr);
+
+// Makes copy-on-write page writable again, pointing to `new_physaddr`(which
+// may be the same page if there are no other users).
+void mmu_resolve_cow(
+        mmu_addrspace_t handle, void *virtaddr, uintptr_t new_physaddr
+);
+
+#define MMU_PAGE_AGE_MAX 127
+
+// Updates age of present pages, and clears their accessed and dirty flags. Age
+// is number of passes over the whole address space since the page was last
+// accessed(saturating at MMU_PAGE_AGE_MAX), so it's 0 if the page was accessed
+// since the last pass.
+//
+// Each call only goes through pages of one page table, so MMU isn't locked for
+// long. `*cursor` should be 0 at the start of a pass, and each call advances it.
+// Returns false when the pass is done.
+//
+// `callback` is called for each page with its new age. It's called while MMU is
+// locked, so it must not use MMU.
+bool mmu_age_pages(
+        mmu_addrspace_t handle,
+        size_t *cursor,
+        void (*callback)(unsigned age, bool is_dirty, void *data),
+        void *data
+);
 WARN_UNUSED_RESULT mmu_addrspace_t mmu_init_for_bsp(void *direct_mapped_base);
 
 void mmu_init_for_ap(unsigned ap_index);
@@ -76,6 +127,8 @@ WARN_UNUSED_RESULT bool mmu_prepare_aps(unsigned ap_count);
 ////////////////////////////////////////////////////////////////////////////////
 
 struct Process;
+struct Scheduler_RunQueue;
+struct Timer_Base;
 
 struct Processor_LocalState *processor_current();
 struct Thread *processor_running_thread(struct Processor_LocalState const *state
@@ -83,8 +136,71 @@ struct Thread *processor_running_thread(struct Processor_LocalState const *state
 void processor_set_running_thread(
         struct Processor_LocalState *state, struct Thread *thread
 );
+// Returns NULL if the processor's scheduler isn't initialized yet.
+struct Scheduler_RunQueue *
+processor_run_queue(struct Processor_LocalState const *state);
+void processor_set_run_queue(
+        struct Processor_LocalState *state, struct Scheduler_RunQueue *queue
+);
+// Returns NULL if the processor's timers aren't initialized yet.
+struct Timer_Base *processor_timer_base(struct Processor_LocalState const *state);
+void processor_set_timer_base(
+        struct Processor_LocalState *state, struct Timer_Base *base
+);
+// Arms the current processor's timer to interrupt once after `ns`
+// nanoseconds(clamped to the longest interval the timer can count), replacing
+// the previously armed one. Time that already passed still gets reported by
+// the next timer interrupt.
+//
+// Returns false if the processor's timer isn't running yet.
+WARN_UNUSED_RESULT bool processor_arm_timer(uint64_t ns);
+// Sets `ns_out` to nanoseconds passed since processors were reset, which is
+// the same on every processor.
+//
+// Returns false if the clock isn't calibrated yet.
+WARN_UNUSED_RESULT bool processor_clock_ns(uint64_t *ns_out);
+// Returns cycle counter of the current processor, adjusted so that values read
+// on different processors can be compared. It's cheaper than
+// processor_clock_ns(), and meant for measuring durations. Interrupts must be
+// disabled.
+uint64_t processor_cycles(void);
+// Converts difference of processor_cycles() values to nanoseconds.
+//
+// Returns 0 if the clock isn't calibrated yet.
+uint64_t processor_ns_from_cycles(uint64_t cycles);
+// Returns physical address of the page userland reads the clock from. (See
+// kernel/api/bits/clockpage.h)
+uintptr_t processor_clock_page_physaddr(void);
+// Returns number of processors, including ones that haven't started yet.
+size_t processor_count(void);
+// Processor 0 is always the BSP.
+struct Processor_LocalState *processor_at(size_t index);
+
+// Processors with the same ID share that part of the machine. IDs mean nothing
+// beyond that.
+struct Processor_Topology {
+        // Core ID is shared by SMT siblings.
+        uint32_t core_id;
+        uint32_t package_id;
+        // Last level cache.
+        uint32_t llc_id;
+};
+
+// Returns false if the processor hasn't discovered its topology yet.
+WARN_UNUSED_RESULT bool processor_get_topology(
+        struct Processor_LocalState const *state, struct Processor_Topology *out
+);
 
 bool processor_thread_init(struct Processor_Thread *out, void *stack_top);
+// Prepares thread that has exited to be used for a new thread, keeping its
+// stacks.
+void processor_thread_reset(struct Processor_Thread *thread, void *stack_top);
+// Initializes thread that returns to userland from the system call
+// `parent_thread` is currently in, with 0 as the return value. Must be called
+// from that system call.
+bool processor_thread_init_forked(
+        struct Processor_Thread *out, struct Processor_Thread const *parent_thread
+);
 void processor_thread_deinit(
         struct Processor_Thread *thread, struct Process *process
 );
@@ -107,6 +223,8 @@ void processor_init_for_bsp(void);
 void processor_init_for_ap(unsigned ap_index);
 WARN_UNUSED_RESULT bool processor_prepare_aps(unsigned ap_count);
 void processor_halt_others(void);
+// Makes `target` call scheduler_on_reschedule_ipi().
+void processor_send_reschedule_ipi(struct Processor_LocalState *target);
 // This function should be used in places like spinlock's spin loop. It both
 // acts as hint to the processor, and also handle pending inter-processor
 // messages.
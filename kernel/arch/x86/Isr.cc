@@ -11,6 +11,7 @@ extern "C" {
 #include "kernel/arch/arch.h"
 #include "kernel/interrupt/interrupts.h"
 #include "kernel/kernel.h"
+#include "kernel/tasks/tasks.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include "kernel/utility/utility.h"
@@ -118,6 +119,10 @@ namespace {
                 stacktrace_show_using_rbp((void *)frm->rbp);
         }
 
+        bool is_from_user(struct TrapFrame const *frm) {
+                return (frm->cs & 3) == X86_RPL_USER;
+        }
+
         [[noreturn]] void generic_exc_no_code(struct TrapFrame const *frm, uint8_t exc_num) {
                 console_alert("EXCEPTION %u", exc_num);
                 print_regs(frm);
@@ -142,7 +147,16 @@ extern "C" {
 [[gnu::used]] void isr_exc4_handler(struct TrapFrame *frm) { generic_exc_no_code(frm, 4); }
 [[gnu::used]] void isr_exc5_handler(struct TrapFrame *frm) { generic_exc_no_code(frm, 5); }
 [[gnu::used]] void isr_exc6_handler(struct TrapFrame *frm) { generic_exc_no_code(frm, 6); }
-[[gnu::used]] void isr_exc7_handler(struct TrapFrame *frm) { generic_exc_no_code(frm, 7); }
+[[gnu::used]] void isr_exc7_handler(struct TrapFrame *frm) {
+        // Kernel is built without SIMD, so only userland may use extended
+        // registers.
+        if (!is_from_user(frm)) {
+                generic_exc_no_code(frm, 7);
+        }
+        thread_account_kernel_entry();
+        fpu_handle_device_not_available();
+        thread_account_kernel_exit();
+}
 [[gnu::used]] void isr_exc8_handler(struct TrapFrame *frm) { generic_exc(frm, 8); }
 [[gnu::used]] void isr_exc9_handler(struct TrapFrame *frm) { generic_exc_no_code(frm, 9); }
 [[gnu::used]] void isr_exc10_handler(struct TrapFrame *frm) { generic_exc(frm, 10); }
@@ -210,6 +224,11 @@ extern "C" {
                 FLAG_SS = 1 << 6,
         };
 
+        // Time spent handling page faults of userland is kernel time.
+        bool from_user = is_from_user(frm);
+        if (from_user) {
+                thread_account_kernel_entry();
+        }
         uint64_t err = frm->err_code;
         void *virtaddr;
         __asm__ volatile("mov %0, cr2" : "=r"(virtaddr));
@@ -235,8 +254,31 @@ extern "C" {
         if (do_prot_test && mmu_is_accessible(virtaddr, prot_to_test)) {
                 // This was likely just TLB cache issue.
                 mmu_invalidate_local_tlb_for(virtaddr);
+                if (from_user) {
+                        thread_account_kernel_exit();
+                }
                 return;
         }
+        // Not-present faults may be lazily backed pages, and write faults may
+        // be copy-on-write pages.
+        if (!is_present || is_write) {
+                mmu_prot_t access = 0;
+                if (is_write) {
+                        access |= MMU_PROT_WRITE;
+                }
+                if (is_exec) {
+                        access |= MMU_PROT_EXEC;
+                }
+                if (err & FLAG_U) {
+                        access |= MMU_PROT_USER;
+                }
+                if (process_handle_page_fault(virtaddr, access)) {
+                        if (from_user) {
+                                thread_account_kernel_exit();
+                        }
+                        return;
+                }
+        }
         if (is_present) {
                 is_user_page = mmu_is_accessible(virtaddr, MMU_PROT_USER);
         } else {
@@ -279,9 +321,12 @@ extern "C" {
 }
 
 extern "C" [[gnu::used]] void isr_handle_interrupt(struct TrapFrame *frm, uint64_t int_num) {
-        (void)frm;
         ASSERT(!interrupts_are_enabled());
         ASSERT(32 <= int_num); // 0~31 are for exceptions
+        bool from_user = is_from_user(frm);
+        if (from_user) {
+                thread_account_kernel_entry();
+        }
 
         switch (int_num) {
         case LAPIC_SPURIOUS_VECTOR:
@@ -309,12 +354,17 @@ extern "C" [[gnu::used]] void isr_handle_interrupt(struct TrapFrame *frm, uint64
                 processor_process_ipimessages();
                 lapic_send_eoi();
                 break;
+        case LAPIC_RESCHEDULE_IPI_VECTOR:
+                // Same as the timer, we might switch to different task.
+                lapic_send_eoi();
+                scheduler_on_reschedule_ipi();
+                break;
         case LAPIC_TIMER_VECTOR:
                 // EOI must be sent first, because we might end up switching to
                 // different task without sending EOI if we sent EOI after timer
                 // handler.
                 lapic_send_eoi();
-                ticktime_increment_tick();
+                ticktime_on_timer_interrupt(lapic_timer_take_elapsed_ticks());
                 break;
         default:
                 // Interrupt request
@@ -342,6 +392,9 @@ extern "C" [[gnu::used]] void isr_handle_interrupt(struct TrapFrame *frm, uint64
                 }
                 break;
         }
+        if (from_user) {
+                thread_account_kernel_exit();
+        }
         ASSERT(!interrupts_are_enabled());
 }
 
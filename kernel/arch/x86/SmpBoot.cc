@@ -268,7 +268,12 @@ namespace {
                         process_kernel(),
                         page.value,
                         AP_BOOT_STACK_PAGE_COUNT,
-                        (struct Proc_MapOptions){.writable = true, .executable = false}
+                        (struct Proc_MapOptions){
+                                .writable = true,
+                                .executable = false,
+                                .shared = false,
+                                .kernel_owned = false,
+                        }
                 );
                 if (addr == nullptr) {
                         TODO_HANDLE_ERROR();
@@ -383,6 +388,8 @@ void start(void) {
         bool all_booted = false;
         while (!all_booted) {
                 processor_process_ipimessages();
+                // APs measure their TSC against ours before they report in.
+                tsc_serve_sync_request();
                 // bool prev_interrupt_state;
                 // spinlock_lock(&s_booted_ap_count_lock, &prev_interrupt_state);
                 if (s_booted_ap_count.load() == ap_count) {
@@ -61,11 +61,30 @@ namespace {
                         // following registers: RAX, RDI, RSI, RDX, RCX, and R8~R11
                         // But since RAX, RDI, RSI, RDX, RCX are used by either SYSCALL
                         // or arguments, we only need to save R8~R11 and RCX.
+                        // RBX is used as scratch register below, and R12~R15 are
+                        // saved so that fork() can see complete userland state.
+                        // (Layout must match X86_SyscallFrame)
                         "push rcx\n"
                         "push r11\n"
+                        "push rbx\n"
+                        "push r12\n"
+                        "push r13\n"
+                        "push r14\n"
+                        "push r15\n"
                         "push r10\n"
                         "push r9\n"
                         "push r8\n"
+                        // Time until now was spent in userland. (Argument
+                        // registers are saved, and RSP stays 16-byte aligned)
+                        "push rax\n"
+                        "push rdi\n"
+                        "push rsi\n"
+                        "push rdx\n"
+                        "call thread_account_kernel_entry\n"
+                        "pop rdx\n"
+                        "pop rsi\n"
+                        "pop rdi\n"
+                        "pop rax\n"
                         // Now we call the handler function
                         "mov rcx, rbx\n" // Set argument 3
                         // -> Store effective address of syscall table to RBX
@@ -77,9 +96,24 @@ namespace {
                         "call rax\n"
                         // Now RAX contains the return value.
                         // Restore registers we saved above
+                        // (Forked threads enter from here, with RSP pointing to
+                        //  copy of parent's X86_SyscallFrame)
+                        ".global syscall_x86_return_to_user\n"
+                        "syscall_x86_return_to_user:\n"
+                        // Time from here is spent in userland.
+                        "push rax\n"
+                        "sub rsp, 8\n"
+                        "call thread_account_kernel_exit\n"
+                        "add rsp, 8\n"
+                        "pop rax\n"
                         "pop r8\n"
                         "pop r9\n"
                         "pop r10\n"
+                        "pop r15\n"
+                        "pop r14\n"
+                        "pop r13\n"
+                        "pop r12\n"
+                        "pop rbx\n"
                         "pop r11\n"
                         "pop rcx\n"
                         // Return to userland code
@@ -115,6 +149,19 @@ void init_tables(void) {
         ST[SYSCALL_INDEX_READ] = (uintptr_t)syscall_impl_read;
         ST[SYSCALL_INDEX_DPRINT] = (uintptr_t)syscall_impl_dprint;
         ST[SYSCALL_INDEX_SCHED_YIELD] = (uintptr_t)syscall_impl_sched_yield;
+        ST[SYSCALL_INDEX_FORK] = (uintptr_t)syscall_impl_fork;
+        ST[SYSCALL_INDEX_MMAP] = (uintptr_t)syscall_impl_mmap;
+        ST[SYSCALL_INDEX_MUNMAP] = (uintptr_t)syscall_impl_munmap;
+        ST[SYSCALL_INDEX_NICE] = (uintptr_t)syscall_impl_nice;
+        ST[SYSCALL_INDEX_CLOCK_NANOSLEEP] = (uintptr_t)syscall_impl_clock_nanosleep;
+        ST[SYSCALL_INDEX_CLOCK_GETTIME] = (uintptr_t)syscall_impl_clock_gettime;
+        ST[SYSCALL_INDEX_SCHED_SETAFFINITY] = (uintptr_t)syscall_impl_sched_setaffinity;
+        ST[SYSCALL_INDEX_SCHED_GETAFFINITY] = (uintptr_t)syscall_impl_sched_getaffinity;
+        ST[SYSCALL_INDEX_GETRUSAGE] = (uintptr_t)syscall_impl_getrusage;
+        ST[SYSCALL_INDEX_SCHED_SETSCHEDULER] = (uintptr_t)syscall_impl_sched_setscheduler;
+        ST[SYSCALL_INDEX_SCHED_GETSCHEDULER] = (uintptr_t)syscall_impl_sched_getscheduler;
+        ST[SYSCALL_INDEX_SCHED_GETPARAM] = (uintptr_t)syscall_impl_sched_getparam;
+        ST[SYSCALL_INDEX_THREAD_EXIT] = (uintptr_t)syscall_impl_thread_exit;
 }
 
 void init_msrs(void) {
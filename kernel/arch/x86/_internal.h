@@ -47,6 +47,12 @@
 
 #define RFLAGS_IF (1 << 9)
 
+// Userland registers saved by the SYSCALL entry. This sits at the top of the
+// thread's syscall kernel stack, in memory order.
+struct X86_SyscallFrame {
+        uint64_t r8, r9, r10, r15, r14, r13, r12, rbx, r11, rcx;
+};
+
 void processor_process_ipimessages(void);
 // Valid reason must be set in Processor_LocalState's flags field of other
 // processors before IPI is sent.
@@ -61,14 +67,16 @@ void processor_flush_other_processors_tlb_for(void *vaddr);
 
 typedef uint32_t x86_msr_t;
 
-#define MSR_IA32_APIC_BASE 0x0000001B
-#define MSR_IA32_EFER      0xC0000080
-#define MSR_STAR           0xC0000081
-#define MSR_LSTAR          0xC0000082
-#define MSR_SFMASK         0xC0000084
-#define MSR_FS_BASE        0xC0000100
-#define MSR_GS_BASE        0xC0000101
-#define MSR_KERNEL_GS_BASE 0xC0000102
+#define MSR_IA32_APIC_BASE    0x0000001B
+#define MSR_IA32_EFER         0xC0000080
+#define MSR_STAR              0xC0000081
+#define MSR_LSTAR             0xC0000082
+#define MSR_SFMASK            0xC0000084
+#define MSR_FS_BASE           0xC0000100
+#define MSR_GS_BASE           0xC0000101
+#define MSR_KERNEL_GS_BASE    0xC0000102
+#define MSR_TSC_AUX           0xC0000103
+#define MSR_IA32_TSC_DEADLINE 0x000006E0
 
 #define MSR_IA32_EFER_SCE (1 << 0)
 #define MSR_IA32_EFER_NXE (1 << 11)
@@ -115,6 +123,108 @@ void i8254timer_reset_to_1ms(void);
 void i8254timer_stop(void);
 // This counts given milliseconds without using interrupts. Reconfigures PIT.
 void i8254timer_oneshot_count(unsigned millis);
+// Same as i8254timer_oneshot_count, but measures it with TSC as well.
+// `cycles_out` receives how many TSC cycles it took, and `uncertainty_out` how
+// many cycles that may be off by.
+//
+// Returns how long it actually counted in nanoseconds, which may be a bit more
+// than `millis`.
+uint64_t i8254timer_oneshot_count_tsc(
+        unsigned millis, uint64_t *cycles_out, uint64_t *uncertainty_out
+);
+
+////////////////////////////////////////////////////////////////////////////////
+// HPET
+////////////////////////////////////////////////////////////////////////////////
+
+#define ACPI_GAS_SYSTEM_MEMORY 0
+
+struct ACPI_GenericAddress {
+        uint8_t AddressSpaceId;
+        uint8_t RegisterBitWidth;
+        uint8_t RegisterBitOffset;
+        uint8_t AccessSize;
+        uint64_t Address;
+} PACKED;
+
+struct HPET {
+        struct ACPI_SDTHeader Header;
+        uint32_t EventTimerBlockId;
+        struct ACPI_GenericAddress BaseAddress;
+        uint8_t HpetNumber;
+        uint16_t MinimumTick;
+        uint8_t PageProtection;
+} PACKED;
+
+// Returns false if there's no usable HPET.
+bool hpet_init(void);
+uint64_t hpet_read_counter(void);
+// Takes care of 32-bit counter wrapping around.
+uint64_t hpet_elapsed_counts(uint64_t from, uint64_t to);
+// Length of single count, in femtoseconds.
+uint64_t hpet_period_fs(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// TSC
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint64_t rdtsc(void) {
+        uint32_t lsb;
+        uint32_t msb;
+        __asm__ volatile("rdtsc" : "=a"(lsb), "=d"(msb));
+        return ((uint64_t)msb << 32) | (uint64_t)lsb;
+}
+
+// Calibrates TSC frequency. May reconfigure PIT.
+void tsc_init_for_bsp(void);
+// Returns 0 if tsc_init_for_bsp() hasn't been called yet.
+uint64_t tsc_frequency_hz(void);
+// Returns core crystal clock frequency reported by CPUID, or 0 if it's not
+// known. Local APIC timer runs at this frequency if it's known.
+uint64_t tsc_crystal_hz(void);
+uint64_t tsc_cycles_from_ns(uint64_t ns);
+// Measures how far current processor's TSC is from BSP's. BSP must be calling
+// tsc_serve_sync_request() meanwhile.
+void tsc_init_for_ap(void);
+void tsc_serve_sync_request(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// FPU
+////////////////////////////////////////////////////////////////////////////////
+
+struct Processor_LocalState;
+struct Processor_Thread;
+
+// Enables x87/SSE/AVX for userland, and makes their first use trap.
+void fpu_init_for_current_processor(void);
+// Returns false on OOM.
+WARN_UNUSED_RESULT bool fpu_thread_init(struct Processor_Thread *thread);
+// Copies extended state of `parent_thread`, which must be the running thread.
+void fpu_thread_init_forked(
+        struct Processor_Thread *out, struct Processor_Thread const *parent_thread
+);
+void fpu_thread_deinit(struct Processor_Thread *thread);
+// Puts extended state back to the initial state.
+void fpu_thread_reset(struct Processor_Thread *thread);
+// Must be called before switching from `old_thread` to `new_thread`.
+void fpu_switch(
+        struct Processor_LocalState *processor,
+        struct Processor_Thread *old_thread,
+        struct Processor_Thread *new_thread
+);
+void fpu_set_initial_thread(
+        struct Processor_LocalState *processor, struct Processor_Thread *thread
+);
+// #NM handler. Loads the running thread's extended state.
+void fpu_handle_device_not_available(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// CPU topology
+////////////////////////////////////////////////////////////////////////////////
+
+// Finds out which core, package and last level cache the current processor
+// belongs to, using CPUID.
+void cputopology_init_for_current_processor(struct Processor_LocalState *state);
 
 ////////////////////////////////////////////////////////////////////////////////
 // ACPI MADT
@@ -225,8 +335,9 @@ struct LAPIC_Descriptor {
 #define LAPIC_LINT0_VECTOR               0xf9
 #define LAPIC_CMCI_VECTOR                0xf8
 #define LAPIC_TIMER_VECTOR               0xf7
-// This one is not used by LAPIC itself, but by the broadcast IPI.
-#define LAPIC_BROADCAST_IPI_VECTOR 0xf6
+// These are not used by LAPIC itself, but by IPIs.
+#define LAPIC_BROADCAST_IPI_VECTOR  0xf6
+#define LAPIC_RESCHEDULE_IPI_VECTOR 0xf5
 
 #define LAPIC_LVT_FLAG_DELIVERY_MODE_FIXED (0 << 8)
 #define LAPIC_LVT_FLAG_DELIVERY_MODE_SMI   (2 << 8)
@@ -307,7 +418,14 @@ void lapic_send_ipi(uint8_t target_apic_id, uint32_t flags);
 void lapic_send_eoi(void);
 void lapic_set_base(void *base);
 void lapic_enable(void);
+// Starts timer of current processor in TSC-deadline mode if supported, or
+// one-shot mode otherwise, firing after 1ms.
 void lapic_timer_reset_to_1ms(void);
+// Returns false if the timer of current processor isn't running yet.
+WARN_UNUSED_RESULT bool lapic_timer_arm(uint64_t ns);
+// Returns ticks passed since the last call on current processor. Partial tick
+// is carried over to the next call.
+tick_t lapic_timer_take_elapsed_ticks(void);
 struct LAPIC_Descriptor const *lapic_for_current_processor(void);
 struct LAPIC_Descriptor const *lapic_for_processor(unsigned idx);
 size_t lapic_count(void);
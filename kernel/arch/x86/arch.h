@@ -70,18 +70,47 @@ struct Processor_LocalState {
         // This must be the first item!
         uintptr_t x86_misc_state[X86_MISC_STATE_VALUES_COUNT];
         struct Thread *running_thread;
+        struct Scheduler_RunQueue *run_queue;
+        struct Timer_Base *timer_base;
         struct List x86_ipimessages;
         struct SpinLock x86_ipimessages_lock;
         union X86_SegmentDescriptor x86_gdt[7];
         struct X86_TSS x86_tss;
+        // LAPIC timer count the current countdown started from, and counts
+        // that passed but haven't been reported as ticks yet.
+        uint32_t x86_timer_start_count;
+        uint64_t x86_timer_pending_count;
+        // In TSC-deadline mode, TSC value up to which ticks were reported.
+        uint64_t x86_timer_last_tsc;
+        // Subtracted from TSC to get BSP's TSC value.
+        uint64_t x86_tsc_offset;
+        // Thread whose extended state was last loaded into the registers, and
+        // the running thread. (See fpu.c)
+        struct Processor_Thread *x86_fpu_owner, *x86_fpu_current;
+        // Cached value of CR0.TS.
+        bool x86_fpu_is_ts_set;
+        // Processors sharing a core(SMT siblings), a package, or the last
+        // level cache have the same IDs for each. (See cputopology.c)
+        uint32_t x86_core_id, x86_package_id, x86_llc_id;
+        bool x86_is_topology_known;
         uint8_t flags;
         uint8_t cpu_num;
+        uint8_t x86_apic_id;
         struct Processor_LocalState *x86_self; // Pointer to self
 };
 
 struct Processor_Thread {
         void *x86_ist1_stack_base, *x86_ist1_rsp, *x86_syscall_kernel_stack_base, *x86_syscall_kernel_rsp,
              *x86_saved_rsp, *x86_saved_user_rsp, *x86_saved_user_rbp;
+        // Thread was created by fork(), and enters by returning from the
+        // system call.
+        bool x86_is_forked;
+        // Saved extended state(x87, SSE, AVX...), aligned from the allocated
+        // `x86_fpu_area_base`.
+        void *x86_fpu_area_base, *x86_fpu_area;
+        // Processor the state was last loaded into. It's still there if the
+        // processor's owner is this thread.
+        struct Processor_LocalState *x86_fpu_loaded_on;
 };
 
 #define PAGE_SIZE 4096UL
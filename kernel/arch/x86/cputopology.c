@@ -0,0 +1,173 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "_internal.h"
+#include "arch.h"
+#include "kernel/arch/arch.h"
+#include "kernel/kernel.h"
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+static char const *LOG_TAG = "cputopology";
+
+// x2APIC ID is made of fields for each level(SMT thread, core, package), and
+// CPUID tells how many bits each takes. Processors with the same bits above a
+// level share that level.
+
+#define CPUID_LEAF_CACHE_PARAMS     0x04
+#define CPUID_LEAF_TOPOLOGY         0x0b
+#define CPUID_LEAF_TOPOLOGY_V2      0x1f
+#define CPUID_LEAF_AMD_CACHE_PARAMS 0x8000001d
+
+#define CPUID_01_EDX_HTT (1 << 28)
+
+// Level types in ECX[15:8] of leaf 0x0B and 0x1F.
+#define TOPOLOGY_LEVEL_INVALID 0
+#define TOPOLOGY_LEVEL_SMT     1
+
+#define CACHE_TYPE_NULL 0
+
+static unsigned max_basic_leaf(void) {
+        unsigned eax, ebx, ecx, edx;
+        __cpuid(0, eax, ebx, ecx, edx);
+        return eax;
+}
+
+static unsigned max_extended_leaf(void) {
+        unsigned eax, ebx, ecx, edx;
+        __cpuid(0x80000000, eax, ebx, ecx, edx);
+        return eax;
+}
+
+// Returns number of bits needed for IDs of `count` things.
+static unsigned id_width(unsigned count) {
+        if (count <= 1) {
+                return 0;
+        }
+        return 32 - __builtin_clz(count - 1);
+}
+
+struct Shifts {
+        uint32_t x2apic_id;
+        // Shifting the x2APIC ID by these gives the core ID and package ID.
+        unsigned core_shift, package_shift;
+};
+
+// Returns false if the leaf isn't there.
+static bool read_topology_leaf(unsigned leaf, struct Shifts *out) {
+        if (max_basic_leaf() < leaf) {
+                return false;
+        }
+        unsigned eax, ebx, ecx, edx;
+        __cpuid_count(leaf, 0, eax, ebx, ecx, edx);
+        if ((ebx & 0xffff) == 0) {
+                return false;
+        }
+        out->x2apic_id = edx;
+        out->core_shift = 0;
+        out->package_shift = 0;
+        for (unsigned subleaf = 0;; ++subleaf) {
+                __cpuid_count(leaf, subleaf, eax, ebx, ecx, edx);
+                unsigned type = (ecx >> 8) & 0xff;
+                if (type == TOPOLOGY_LEVEL_INVALID) {
+                        break;
+                }
+                unsigned shift = eax & 0x1f;
+                if (type == TOPOLOGY_LEVEL_SMT) {
+                        out->core_shift = shift;
+                }
+                // The last level's shift goes past everything below the
+                // package, whatever levels(module, die...) there are.
+                out->package_shift = shift;
+        }
+        return true;
+}
+
+// For processors without leaf 0x0B. Only the initial APIC ID is there, along
+// with logical processor counts of the package and the core.
+static void read_legacy_topology(struct Shifts *out) {
+        unsigned eax, ebx, ecx, edx;
+        __cpuid(1, eax, ebx, ecx, edx);
+        out->x2apic_id = ebx >> 24;
+        out->core_shift = 0;
+        out->package_shift = 0;
+        if (!(edx & CPUID_01_EDX_HTT)) {
+                return;
+        }
+        unsigned logical_count = (ebx >> 16) & 0xff;
+        unsigned core_count = 1;
+        if (CPUID_LEAF_CACHE_PARAMS <= max_basic_leaf()) {
+                __cpuid_count(CPUID_LEAF_CACHE_PARAMS, 0, eax, ebx, ecx, edx);
+                core_count = (eax >> 26) + 1;
+        }
+        unsigned threads_per_core = logical_count / core_count;
+        out->core_shift = id_width(threads_per_core);
+        out->package_shift = id_width(logical_count);
+}
+
+// Leaf 0x04(0x8000001D on AMD) lists caches, along with how many logical
+// processors share each.
+//
+// Returns false if the leaf isn't there.
+static bool read_llc_shift(unsigned leaf, unsigned *shift_out) {
+        bool is_extended = leaf & 0x80000000;
+        unsigned max_leaf =
+                is_extended ? max_extended_leaf() : max_basic_leaf();
+        if (max_leaf < leaf) {
+                return false;
+        }
+        unsigned highest_level = 0;
+        for (unsigned subleaf = 0;; ++subleaf) {
+                unsigned eax, ebx, ecx, edx;
+                __cpuid_count(leaf, subleaf, eax, ebx, ecx, edx);
+                if ((eax & 0x1f) == CACHE_TYPE_NULL) {
+                        break;
+                }
+                unsigned level = (eax >> 5) & 0x7;
+                if (level < highest_level) {
+                        continue;
+                }
+                highest_level = level;
+                *shift_out = id_width(((eax >> 14) & 0xfff) + 1);
+        }
+        return highest_level != 0;
+}
+
+void cputopology_init_for_current_processor(
+        struct Processor_LocalState *state
+) {
+        struct Shifts shifts;
+        if (!read_topology_leaf(CPUID_LEAF_TOPOLOGY_V2, &shifts) &&
+            !read_topology_leaf(CPUID_LEAF_TOPOLOGY, &shifts)) {
+                read_legacy_topology(&shifts);
+        }
+        unsigned llc_shift;
+        if (!read_llc_shift(CPUID_LEAF_CACHE_PARAMS, &llc_shift) &&
+            !read_llc_shift(CPUID_LEAF_AMD_CACHE_PARAMS, &llc_shift)) {
+                // Assume the whole package shares it.
+                llc_shift = shifts.package_shift;
+        }
+        state->x86_core_id = shifts.x2apic_id >> shifts.core_shift;
+        state->x86_package_id = shifts.x2apic_id >> shifts.package_shift;
+        state->x86_llc_id = shifts.x2apic_id >> llc_shift;
+        __atomic_store_n(&state->x86_is_topology_known, true, __ATOMIC_RELEASE);
+        LOGI(LOG_TAG,
+             "[x2APIC %u] Package %u, core %u, LLC %u",
+             shifts.x2apic_id,
+             state->x86_package_id,
+             state->x86_core_id,
+             state->x86_llc_id);
+}
+
+bool processor_get_topology(
+        struct Processor_LocalState const *state, struct Processor_Topology *out
+) {
+        if (!__atomic_load_n(&state->x86_is_topology_known, __ATOMIC_ACQUIRE)) {
+                return false;
+        }
+        out->core_id = state->x86_core_id;
+        out->package_id = state->x86_package_id;
+        out->llc_id = state->x86_llc_id;
+        return true;
+}
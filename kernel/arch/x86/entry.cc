@@ -31,6 +31,11 @@ extern "C" {
 #include <support/thirdparty/limine/limine.h>
 }
 
+// RUN_SCHEDBENCH_AT_BOOT runs the scheduler benchmarks after boot, so that
+// their results can be collected from the serial port. Build with
+// YJK_RUN_SCHEDBENCH=1 to define it.
+// (e.g. YJK_RUN_SCHEDBENCH=1 make && YJK_HEADLESS=1 support/tools/run.py)
+
 namespace Kernel {
 
 USED LIMINE_BASE_REVISION(1)
@@ -52,9 +57,15 @@ namespace {
                 .cmdline = "",
                 .flags = LIMINE_INTERNAL_MODULE_REQUIRED,
         };
+        struct limine_internal_module internal_module_schedbench = {
+                .path = "/yjk/schedbench",
+                .cmdline = "",
+                .flags = 0,
+        };
         struct limine_internal_module *internal_modules[] = {
                 &internal_module_font,
                 &internal_module_hellosvc,
+                &internal_module_schedbench,
         };
 
         struct limine_file *search_for_module(char const *wanted_path) {
@@ -219,6 +230,8 @@ namespace {
                 lapic_enable();
                 // APIC timer must be calibrated before we start other processors
                 i8254timer_stop();
+                // APIC timer is calibrated against TSC
+                tsc_init_for_bsp();
                 lapic_timer_reset_to_1ms();
                 SmpBoot::start();
                 interrupts_enable();
@@ -228,9 +241,17 @@ namespace {
                 if (err < 0) {
                         LOGE(LOG_TAG, "Failed to launch executable (%u)", -err);
                 }
+#ifdef RUN_SCHEDBENCH_AT_BOOT
+                err = exec_module("/yjk/schedbench");
+                if (err < 0) {
+                        LOGE(LOG_TAG, "Failed to launch schedbench (%u)", -err);
+                }
+#endif
 
                 LOGI(LOG_TAG, "The system is ready for use");
 
+                workingset_scanner_start();
+                reaper_start();
                 thread_spawn(process_running(), "kernel cli", cli_run);
                 scheduler_run_idle_loop();
         }
@@ -285,7 +306,8 @@ USED struct limine_module_request module_request = {
         .revision = 1,
         .response = nullptr,
 
-        .internal_module_count = 2,
+        .internal_module_count =
+                sizeof(internal_modules) / sizeof(*internal_modules),
         .internal_modules = internal_modules,
         
 };
@@ -324,6 +346,7 @@ extern "C" [[noreturn]] void kernel_entry_ap(unsigned ap_index) {
         while (SmpBoot::next_ap_to_init() != ap_index) {
                 processor_wait_during_spinloop();
         }
+        tsc_init_for_ap();
         scheduler_init_for_ap(boot_stage2_ap);
 }
 
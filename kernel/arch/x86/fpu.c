@@ -0,0 +1,263 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "_internal.h"
+#include "arch.h"
+#include "kernel/arch/arch.h"
+#include "kernel/heap/heap.h"
+#include "kernel/kernel.h"
+#include "kernel/utility/utility.h"
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static char const *LOG_TAG = "fpu";
+
+// Extended register state (x87, SSE, AVX and so on) is switched lazily. The
+// kernel itself is built without them, so only userland ever touches them.
+//
+// CR0.TS is set whenever the running thread's state isn't in the registers,
+// and the first instruction touching them raises #NM. Only then the state is
+// loaded, so threads that never use them pay nothing. Threads that used them
+// save their state when switching out, because they may run on another
+// processor next. Registers are left as they are, and if the thread comes
+// back before anyone else uses them, it doesn't need to load anything.
+
+#define CR0_FLAG_MP (1 << 1)
+#define CR0_FLAG_EM (1 << 2)
+#define CR0_FLAG_TS (1 << 3)
+#define CR0_FLAG_NE (1 << 5)
+
+#define CR4_FLAG_OSFXSR     (1 << 9)
+#define CR4_FLAG_OSXMMEXCPT (1 << 10)
+#define CR4_FLAG_OSXSAVE    (1 << 18)
+
+#define CPUID_01_ECX_XSAVE       (1 << 26)
+#define CPUID_0D_01_EAX_XSAVEOPT (1 << 0)
+
+// State components we enable in XCR0.
+#define XCR0_X87       (1ULL << 0)
+#define XCR0_SSE       (1ULL << 1)
+#define XCR0_AVX       (1ULL << 2)
+#define XCR0_AVX512    (7ULL << 5) // Opmask, ZMM_Hi256, Hi16_ZMM
+#define XCR0_SUPPORTED (XCR0_X87 | XCR0_SSE | XCR0_AVX | XCR0_AVX512)
+
+// XSAVE area must be 64-byte aligned, and FXSAVE area 16-byte.
+#define AREA_ALIGN 64
+// Size of FXSAVE area, which is also the legacy region of XSAVE area.
+#define FXSAVE_AREA_SIZE 512
+
+// Initial values of the legacy region. Other components are in their initial
+// state as long as XSTATE_BV in the XSAVE header is 0.
+#define INITIAL_FCW   0x037f
+#define INITIAL_MXCSR 0x1f80
+#define FCW_OFFSET    0
+#define MXCSR_OFFSET  24
+
+// These are decided by the BSP, and APs must match.
+static size_t s_area_size;
+static uint64_t s_xcr0;
+static bool s_use_xsave, s_use_xsaveopt;
+
+static uint64_t read_cr0(void) {
+        uint64_t cr0;
+        __asm__ volatile("mov %0, cr0" : "=r"(cr0));
+        return cr0;
+}
+
+static void write_cr0(uint64_t cr0) {
+        __asm__ volatile("mov cr0, %0" ::"r"(cr0) : "memory");
+}
+
+static void set_ts(struct Processor_LocalState *processor, bool set) {
+        // Writing CR0 is slow, so we skip it when nothing changes.
+        if (processor->x86_fpu_is_ts_set == set) {
+                return;
+        }
+        if (set) {
+                write_cr0(read_cr0() | CR0_FLAG_TS);
+        } else {
+                __asm__ volatile("clts" ::: "memory");
+        }
+        processor->x86_fpu_is_ts_set = set;
+}
+
+static void save_state(void *area) {
+        if (s_use_xsaveopt) {
+                __asm__ volatile("xsaveopt64 [%0]" ::"r"(area),
+                                 "a"((uint32_t)s_xcr0),
+                                 "d"((uint32_t)(s_xcr0 >> 32))
+                                 : "memory");
+        } else if (s_use_xsave) {
+                __asm__ volatile("xsave64 [%0]" ::"r"(area),
+                                 "a"((uint32_t)s_xcr0),
+                                 "d"((uint32_t)(s_xcr0 >> 32))
+                                 : "memory");
+        } else {
+                __asm__ volatile("fxsave64 [%0]" ::"r"(area) : "memory");
+        }
+}
+
+static void restore_state(void const *area) {
+        if (s_use_xsave) {
+                __asm__ volatile("xrstor64 [%0]" ::"r"(area),
+                                 "a"((uint32_t)s_xcr0),
+                                 "d"((uint32_t)(s_xcr0 >> 32))
+                                 : "memory");
+        } else {
+                __asm__ volatile("fxrstor64 [%0]" ::"r"(area) : "memory");
+        }
+}
+
+static void init_xsave(bool is_bsp) {
+        unsigned eax, ebx, ecx, edx;
+        __asm__ volatile("mov rax, cr4\n"
+                         "or rax, %0\n"
+                         "mov cr4, rax" ::"r"((uint64_t)CR4_FLAG_OSXSAVE)
+                         : "rax");
+        __cpuid_count(0xd, 0, eax, ebx, ecx, edx);
+        uint64_t xcr0 = (((uint64_t)edx << 32) | eax) & XCR0_SUPPORTED;
+        if ((xcr0 & XCR0_AVX512) != XCR0_AVX512) {
+                // These can only be enabled together.
+                xcr0 &= ~XCR0_AVX512;
+        }
+        if (is_bsp) {
+                s_xcr0 = xcr0;
+        } else if (xcr0 != s_xcr0) {
+                panic("Processor supports different XSAVE components(%lx) from "
+                      "BSP(%lx)",
+                      xcr0,
+                      s_xcr0);
+        }
+        __asm__ volatile("xsetbv" ::"c"(0),
+                         "a"((uint32_t)s_xcr0),
+                         "d"((uint32_t)(s_xcr0 >> 32)));
+        if (!is_bsp) {
+                return;
+        }
+        // EBX is the size for components currently enabled in XCR0.
+        __cpuid_count(0xd, 0, eax, ebx, ecx, edx);
+        s_area_size = ebx;
+        __cpuid_count(0xd, 1, eax, ebx, ecx, edx);
+        s_use_xsaveopt = eax & CPUID_0D_01_EAX_XSAVEOPT;
+        LOGI(LOG_TAG,
+             "Using %s, components %lx, %u bytes per thread",
+             s_use_xsaveopt ? "XSAVEOPT" : "XSAVE",
+             s_xcr0,
+             (unsigned)s_area_size);
+}
+
+void fpu_init_for_current_processor(void) {
+        struct Processor_LocalState *processor = processor_current();
+        bool is_bsp = processor->flags & PROCESSOR_LOCALSTATE_FLAG_BSP;
+        unsigned eax, ebx, ecx, edx;
+        __cpuid(1, eax, ebx, ecx, edx);
+        uint64_t cr0 = read_cr0();
+        cr0 &= ~CR0_FLAG_EM;
+        cr0 |= CR0_FLAG_MP | CR0_FLAG_NE | CR0_FLAG_TS;
+        write_cr0(cr0);
+        processor->x86_fpu_is_ts_set = true;
+        __asm__ volatile("mov rax, cr4\n"
+                         "or rax, %0\n"
+                         "mov cr4, rax" ::"r"((uint64_t)(CR4_FLAG_OSFXSR |
+                                                         CR4_FLAG_OSXMMEXCPT))
+                         : "rax");
+        if (is_bsp) {
+                s_use_xsave = ecx & CPUID_01_ECX_XSAVE;
+        } else if (s_use_xsave && !(ecx & CPUID_01_ECX_XSAVE)) {
+                panic("Processor doesn't support XSAVE, but BSP does");
+        }
+        if (s_use_xsave) {
+                init_xsave(is_bsp);
+        } else if (is_bsp) {
+                s_area_size = FXSAVE_AREA_SIZE;
+                LOGI(LOG_TAG, "XSAVE is not supported. Using FXSAVE.");
+        }
+}
+
+bool fpu_thread_init(struct Processor_Thread *thread) {
+        ASSERT(s_area_size != 0);
+        thread->x86_fpu_area_base = kmalloc(s_area_size + AREA_ALIGN - 1);
+        if (!thread->x86_fpu_area_base) {
+                return false;
+        }
+        thread->x86_fpu_area = (void *)align_up(
+                AREA_ALIGN, (uintptr_t)thread->x86_fpu_area_base
+        );
+        fpu_thread_reset(thread);
+        return true;
+}
+
+void fpu_thread_reset(struct Processor_Thread *thread) {
+        thread->x86_fpu_loaded_on = NULL;
+        // All zero XSAVE header means every component is in initial state.
+        uint8_t *area = thread->x86_fpu_area;
+        kmemset(area, 0, s_area_size);
+        *(uint16_t *)&area[FCW_OFFSET] = INITIAL_FCW;
+        *(uint32_t *)&area[MXCSR_OFFSET] = INITIAL_MXCSR;
+}
+
+void fpu_thread_init_forked(
+        struct Processor_Thread *out, struct Processor_Thread const *parent_thread
+) {
+        ENTER_NO_INTERRUPT_SECTION();
+        struct Processor_LocalState *processor = processor_current();
+        ASSERT(processor->x86_fpu_current == parent_thread);
+        if (!processor->x86_fpu_is_ts_set) {
+                // Parent's latest state is only in the registers.
+                save_state(parent_thread->x86_fpu_area);
+        }
+        kmemcpy(out->x86_fpu_area, parent_thread->x86_fpu_area, s_area_size);
+        LEAVE_NO_INTERRUPT_SECTION();
+}
+
+void fpu_thread_deinit(struct Processor_Thread *thread) {
+        // Processors may still think it's their owner, but owners are only
+        // compared against, never accessed.
+        kfree(thread->x86_fpu_area_base);
+        thread->x86_fpu_area_base = NULL;
+        thread->x86_fpu_area = NULL;
+}
+
+void fpu_switch(
+        struct Processor_LocalState *processor,
+        struct Processor_Thread *old_thread,
+        struct Processor_Thread *new_thread
+) {
+        ASSERT(!interrupts_are_enabled());
+        if (!processor->x86_fpu_is_ts_set) {
+                // TS is only cleared for the owner, so it's old thread's
+                // state, and it may have been modified.
+                ASSERT(processor->x86_fpu_owner == old_thread);
+                save_state(old_thread->x86_fpu_area);
+        }
+        processor->x86_fpu_current = new_thread;
+        set_ts(processor,
+               (processor->x86_fpu_owner != new_thread) ||
+                       (new_thread->x86_fpu_loaded_on != processor));
+}
+
+void fpu_set_initial_thread(
+        struct Processor_LocalState *processor, struct Processor_Thread *thread
+) {
+        ASSERT(!interrupts_are_enabled());
+        processor->x86_fpu_current = thread;
+}
+
+void fpu_handle_device_not_available(void) {
+        ASSERT(!interrupts_are_enabled());
+        struct Processor_LocalState *processor = processor_current();
+        struct Processor_Thread *thread = processor->x86_fpu_current;
+        ASSERT(thread);
+        set_ts(processor, false);
+        if ((processor->x86_fpu_owner == thread) &&
+            (thread->x86_fpu_loaded_on == processor)) {
+                return;
+        }
+        // Previous owner saved its state when it switched out, so we can just
+        // overwrite the registers.
+        restore_state(thread->x86_fpu_area);
+        processor->x86_fpu_owner = thread;
+        thread->x86_fpu_loaded_on = processor;
+}
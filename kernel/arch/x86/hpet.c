@@ -0,0 +1,87 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "_internal.h"
+#include "kernel/kernel.h"
+#include "kernel/tasks/tasks.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+static char const *LOG_TAG = "hpet";
+
+#define REG_CAPABILITIES 0x000
+#define REG_CONFIG       0x010
+#define REG_MAIN_COUNTER 0x0f0
+
+#define CAPABILITIES_FLAG_COUNT_SIZE_64 (1 << 13)
+#define CONFIG_FLAG_ENABLE              (1 << 0)
+
+// Registers take up 1KiB, which isn't necessarily page-aligned.
+#define REGS_SIZE 1024
+
+// Spec says the period can't be longer than 100ns.
+#define MAX_PERIOD_FS 100000000
+
+static void *s_base;
+static uint64_t s_period_fs;
+static bool s_is_64bit;
+
+static uint64_t read_reg(uint32_t reg) {
+        return *(uint64_t volatile *)(s_base + reg);
+}
+
+static void write_reg(uint32_t reg, uint64_t val) {
+        *(uint64_t volatile *)(s_base + reg) = val;
+}
+
+bool hpet_init(void) {
+        struct HPET *table = acpi_locate_table("HPET");
+        if (!table) {
+                LOGI(LOG_TAG, "HPET not found");
+                return false;
+        }
+        if (table->BaseAddress.AddressSpaceId != ACPI_GAS_SYSTEM_MEMORY) {
+                LOGW(LOG_TAG,
+                     "Ignoring HPET outside memory space (%u)",
+                     table->BaseAddress.AddressSpaceId);
+                return false;
+        }
+        s_base = process_map_unaligned(
+                process_kernel(),
+                table->BaseAddress.Address,
+                REGS_SIZE,
+                (struct Proc_MapOptions){.writable = true, .executable = false}
+        );
+        if (!s_base) {
+                LOGE(LOG_TAG, "HPET couldn't be mapped");
+                return false;
+        }
+        uint64_t caps = read_reg(REG_CAPABILITIES);
+        s_period_fs = caps >> 32;
+        if ((s_period_fs == 0) || (MAX_PERIOD_FS < s_period_fs)) {
+                LOGW(LOG_TAG, "Ignoring HPET with bad period %u fs", s_period_fs);
+                process_unmap_unaligned(process_kernel(), s_base, REGS_SIZE);
+                s_base = NULL;
+                return false;
+        }
+        s_is_64bit = caps & CAPABILITIES_FLAG_COUNT_SIZE_64;
+        write_reg(REG_CONFIG, read_reg(REG_CONFIG) | CONFIG_FLAG_ENABLE);
+        return true;
+}
+
+uint64_t hpet_read_counter(void) {
+        ASSERT(s_base);
+        if (s_is_64bit) {
+                return read_reg(REG_MAIN_COUNTER);
+        }
+        return *(uint32_t volatile *)(s_base + REG_MAIN_COUNTER);
+}
+
+uint64_t hpet_elapsed_counts(uint64_t from, uint64_t to) {
+        if (s_is_64bit) {
+                return to - from;
+        }
+        return (uint32_t)(to - from);
+}
+
+uint64_t hpet_period_fs(void) { return s_period_fs; }
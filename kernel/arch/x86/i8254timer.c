@@ -70,3 +70,40 @@ void i8254timer_oneshot_count(unsigned millis) {
         ioport_out8(IO_CH0_DATA, 0xff);
         while (expected < read_counter()) {}
 }
+
+uint64_t i8254timer_oneshot_count_tsc(
+        unsigned millis, uint64_t *cycles_out, uint64_t *uncertainty_out
+) {
+        ioport_out8(
+                IO_MODE,
+                MODE_FLAG_SEL_CH0 | MODE_FLAG_ACCESS_LSB_MSB |
+                        MODE_FLAG_OP_RATEGEN | MODE_FLAG_BIN
+        );
+        uint32_t expected = 0xffff - (DESIRED_CNT_VALUE * millis);
+        ioport_out8(IO_CH0_DATA, 0xff);
+        short_delay();
+        uint64_t before_start = rdtsc();
+        ioport_out8(IO_CH0_DATA, 0xff);
+        uint64_t begin = rdtsc();
+        // We only notice the end when we read the counter, so the longest gap
+        // between two reads is how late we could be.
+        uint64_t max_gap = begin - before_start;
+        uint64_t last = begin;
+        uint16_t counter;
+        while (expected < (counter = read_counter())) {
+                uint64_t now = rdtsc();
+                if (max_gap < now - last) {
+                        max_gap = now - last;
+                }
+                last = now;
+        }
+        uint64_t end = rdtsc();
+        if (max_gap < end - last) {
+                max_gap = end - last;
+        }
+        *cycles_out = end - begin;
+        *uncertainty_out = max_gap;
+        // Counter may have gone past `expected` by the time we read it.
+        uint64_t elapsed_counts = 0xffff - counter;
+        return elapsed_counts * 1000000000 / PIT_FREQ;
+}
@@ -6,13 +6,28 @@
 #include "kernel/heap/heap.h"
 #include "kernel/kernel.h"
 #include "kernel/tasks/tasks.h"
+#include <cpuid.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 static char const *LOG_TAG = "lapic";
 
+// Timer counts once every 16 bus clocks.
+#define TIMER_DIVIDE_CONFIG 0x3
+#define TIMER_DIVISOR       16
+// If we don't know crystal frequency, timer is counted against TSC for this
+// long.
+#define TIMER_CALIBRATION_US 2000
+// Longest delay we program in TSC-deadline mode, which keeps the deadline from
+// overflowing. Timer code re-arms it if it wakes up too early.
+#define TIMER_DEADLINE_MAX_NS (60 * 1000000000ULL)
+
+#define CPUID_01_ECX_TSC_DEADLINE (1 << 24)
+
 static uint32_t s_timer_calibration_value;
+static uint64_t s_tsc_cycles_per_tick;
+static bool s_use_tsc_deadline;
 static bool s_timer_calibrated = false;
 
 // As far as I know, Local APIC address is the same on every processor, and thus
@@ -91,46 +106,180 @@ void lapic_enable(void) {
         );
 }
 
+// Returns timer counts per millisecond. TSC must be calibrated first.
+static uint32_t calibrate_timer(void) {
+        uint64_t crystal_hz = tsc_crystal_hz();
+        if (crystal_hz != 0) {
+                // Timer runs at crystal clock frequency on these processors.
+                uint32_t result = crystal_hz / TIMER_DIVISOR / 1000;
+                LOGI(LOG_TAG,
+                     "Timer: %u counts per ms (from crystal frequency)",
+                     result);
+                return result;
+        }
+        uint64_t tsc_hz = tsc_frequency_hz();
+        ASSERT(tsc_hz != 0);
+        uint64_t window_cycles = tsc_hz * TIMER_CALIBRATION_US / 1000000;
+        lapic_write(
+                LAPIC_REG_TIMER_DIVIDE_CONFIG,
+                TIMER_DIVIDE_CONFIG,
+                LAPIC_DIVIDE_CONFIG_REG_MASK
+        );
+        lapic_write(
+                LAPIC_REG_LVT_TIMER,
+                LAPIC_LVT_TIMER_FLAG_MODE_PERIODIC | LAPIC_LVT_FLAG_MASKED |
+                        LAPIC_TIMER_VECTOR,
+                LAPIC_LVT_TIMER_REG_RESERVED_MASK
+        );
+        lapic_write_unchecked(LAPIC_REG_TIMER_INITIAL_COUNT, 0xffffffff);
+        // Each counter read is bracketed by two TSC reads, so we can tell how
+        // precise the result is.
+        uint64_t tsc_before_begin = rdtsc();
+        uint32_t count_begin =
+                lapic_read_unchecked(LAPIC_REG_TIMER_CURRENT_COUNT);
+        uint64_t tsc_after_begin = rdtsc();
+        while (rdtsc() - tsc_after_begin < window_cycles) {}
+        uint64_t tsc_before_end = rdtsc();
+        uint32_t count_end =
+                lapic_read_unchecked(LAPIC_REG_TIMER_CURRENT_COUNT);
+        uint64_t tsc_after_end = rdtsc();
+        uint64_t cycles = (tsc_before_end + tsc_after_end) / 2 -
+                          (tsc_before_begin + tsc_after_begin) / 2;
+        uint64_t uncertainty = ((tsc_after_begin - tsc_before_begin) +
+                                (tsc_after_end - tsc_before_end)) /
+                               2;
+        uint32_t result =
+                (uint64_t)(count_begin - count_end) * tsc_hz / cycles / 1000;
+        LOGI(LOG_TAG,
+             "Timer: %u counts per ms (from TSC, within %u ppm)",
+             result,
+             uncertainty * 1000000 / cycles);
+        return result;
+}
+
+static bool has_tsc_deadline(void) {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x1, &eax, &ebx, &ecx, &edx)) {
+                return false;
+        }
+        return ecx & CPUID_01_ECX_TSC_DEADLINE;
+}
+
+static void reset_tsc_deadline_timer(void) {
+        lapic_write(
+                LAPIC_REG_LVT_TIMER,
+                LAPIC_LVT_TIMER_FLAG_MODE_TSC_DEADLINE | LAPIC_TIMER_VECTOR,
+                LAPIC_LVT_TIMER_REG_RESERVED_MASK
+        );
+        // LVT write must be done before the deadline MSR write, and WRMSR
+        // isn't ordered against memory-mapped LAPIC writes.
+        __asm__ volatile("mfence" ::: "memory");
+        uint64_t now = rdtsc();
+        processor_current()->x86_timer_last_tsc = now;
+        wrmsr(MSR_IA32_TSC_DEADLINE, now + s_tsc_cycles_per_tick);
+}
+
 void lapic_timer_reset_to_1ms(void) {
         if (!s_timer_calibrated) {
-                lapic_write(
-                        LAPIC_REG_TIMER_DIVIDE_CONFIG,
-                        0x3,
-                        LAPIC_DIVIDE_CONFIG_REG_MASK
-                );
-                lapic_write(
-                        LAPIC_REG_LVT_TIMER,
-                        LAPIC_LVT_TIMER_FLAG_MODE_PERIODIC |
-                                LAPIC_LVT_FLAG_MASKED | LAPIC_TIMER_VECTOR,
-                        LAPIC_LVT_TIMER_REG_RESERVED_MASK
-                );
-                lapic_write_unchecked(
-                        LAPIC_REG_TIMER_INITIAL_COUNT, 0xffffffff
-                );
-                uint32_t time1 =
-                        lapic_read_unchecked(LAPIC_REG_TIMER_CURRENT_COUNT);
-                for (unsigned i = 0; i < 10; ++i) {
-                        i8254timer_oneshot_count(10);
+                s_use_tsc_deadline = has_tsc_deadline();
+                if (s_use_tsc_deadline) {
+                        s_tsc_cycles_per_tick =
+                                tsc_cycles_from_ns(TICKTIME_NS_PER_TICK);
+                        LOGI(LOG_TAG, "Timer: Using TSC-deadline mode");
+                } else {
+                        s_timer_calibration_value = calibrate_timer();
                 }
-                uint32_t time2 =
-                        lapic_read_unchecked(LAPIC_REG_TIMER_CURRENT_COUNT);
-                uint32_t diff = time1 - time2;
-                s_timer_calibration_value = diff / 100;
                 s_timer_calibrated = true;
         }
+        if (s_use_tsc_deadline) {
+                reset_tsc_deadline_timer();
+                return;
+        }
         lapic_write(
                 LAPIC_REG_LVT_TIMER,
-                LAPIC_LVT_TIMER_FLAG_MODE_PERIODIC | LAPIC_TIMER_VECTOR,
+                LAPIC_LVT_TIMER_FLAG_MODE_ONESHOT | LAPIC_TIMER_VECTOR,
                 LAPIC_LVT_TIMER_REG_RESERVED_MASK
         );
         lapic_write(
-                LAPIC_REG_TIMER_DIVIDE_CONFIG, 0x3, LAPIC_DIVIDE_CONFIG_REG_MASK
+                LAPIC_REG_TIMER_DIVIDE_CONFIG,
+                TIMER_DIVIDE_CONFIG,
+                LAPIC_DIVIDE_CONFIG_REG_MASK
         );
+        struct Processor_LocalState *state = processor_current();
+        state->x86_timer_start_count = s_timer_calibration_value;
+        state->x86_timer_pending_count = 0;
         lapic_write(
                 LAPIC_REG_TIMER_INITIAL_COUNT, s_timer_calibration_value, 0
         );
 }
 
+// Timer runs in TSC-deadline or one-shot mode, and the timer interrupt handler
+// arms it again. In TSC-deadline mode, TSC itself tells how much time passed.
+// In one-shot mode, each processor remembers the count its countdown started
+// from, so we can tell how much time passed even if it gets re-armed before
+// firing.
+
+static bool is_timer_running(void) {
+        if (!s_timer_calibrated) {
+                return false;
+        }
+        return !(lapic_read_unchecked(LAPIC_REG_LVT_TIMER) &
+                 LAPIC_LVT_FLAG_MASKED);
+}
+
+static void account_elapsed_counts(struct Processor_LocalState *state) {
+        uint32_t current = lapic_read_unchecked(LAPIC_REG_TIMER_CURRENT_COUNT);
+        state->x86_timer_pending_count +=
+                state->x86_timer_start_count - current;
+        state->x86_timer_start_count = current;
+}
+
+bool lapic_timer_arm(uint64_t ns) {
+        if (!is_timer_running()) {
+                return false;
+        }
+        if (s_use_tsc_deadline) {
+                if (TIMER_DEADLINE_MAX_NS < ns) {
+                        ns = TIMER_DEADLINE_MAX_NS;
+                }
+                wrmsr(MSR_IA32_TSC_DEADLINE, rdtsc() + tsc_cycles_from_ns(ns));
+                return true;
+        }
+        // Largest count we can program is 32-bit.
+        uint64_t max_ns =
+                (uint64_t)UINT32_MAX * 1000000 / s_timer_calibration_value;
+        if (max_ns < ns) {
+                ns = max_ns;
+        }
+        uint32_t count = ns * s_timer_calibration_value / 1000000;
+        if (count == 0) {
+                // Zero would stop the timer.
+                count = 1;
+        }
+        struct Processor_LocalState *state = processor_current();
+        // Few counts may pass between here and the write below, and those are
+        // lost.
+        account_elapsed_counts(state);
+        lapic_write_unchecked(LAPIC_REG_TIMER_INITIAL_COUNT, count);
+        state->x86_timer_start_count = count;
+        return true;
+}
+
+tick_t lapic_timer_take_elapsed_ticks(void) {
+        struct Processor_LocalState *state = processor_current();
+        if (s_use_tsc_deadline) {
+                uint64_t elapsed = rdtsc() - state->x86_timer_last_tsc;
+                tick_t ticks = elapsed / s_tsc_cycles_per_tick;
+                state->x86_timer_last_tsc += ticks * s_tsc_cycles_per_tick;
+                return ticks;
+        }
+        account_elapsed_counts(state);
+        tick_t ticks =
+                state->x86_timer_pending_count / s_timer_calibration_value;
+        state->x86_timer_pending_count %= s_timer_calibration_value;
+        return ticks;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static bool is_usable_processor(struct MADT_Entry_LAPIC const *apic) {
@@ -25,8 +25,16 @@ static char const *LOG_TAG = "mmu";
 #define PAGING_FLAG_PS  (1 << 7) // Only for PML3 and PD entries.
 #define PAGING_FLAG_PAT (1 << 7) // Only for PT entries
 #define PAGING_FLAG_G   (1 << 8) // Only for PT entries
+// Bits 9~11 are ignored by the processor, so we use them for our own purpose.
+#define PAGING_FLAG_COW          (1 << 9)  // Only for PT entries
+#define PAGING_FLAG_SHARED       (1 << 10) // Only for PT entries
+#define PAGING_FLAG_KERNEL_OWNED (1 << 11) // Only for PT entries
 #define PAGING_FLAG_XD  (1ULL << 63)
 
+// Bits 52~58 are also ignored by the processor. We keep page age there.
+#define PAGING_AGE_SHIFT 52
+#define PAGING_AGE_MASK  ((paging_entry_t)MMU_PAGE_AGE_MAX << PAGING_AGE_SHIFT)
+
 typedef uint64_t paging_entry_t;
 #define ENTRY_BASE_ADDR_OF(_x) ((_x) & 0xFFFFFFFFFF000)
 
@@ -177,6 +185,12 @@ static paging_entry_t paging_flags_from_prot(mmu_prot_t prot) {
         if (prot & MMU_PROT_WRITE) {
                 entry |= PAGING_FLAG_RW;
         }
+        if (prot & MMU_PROT_SHARED) {
+                entry |= PAGING_FLAG_SHARED;
+        }
+        if (prot & MMU_PROT_KERNEL_OWNED) {
+                entry |= PAGING_FLAG_KERNEL_OWNED;
+        }
         return entry;
 }
 
@@ -199,12 +213,14 @@ WARN_UNUSED_RESULT static bool get_pt_base_and_entry(
 
         paging_entry_t entry;
         entry = get_table_entry(pml3_physbase, PML3_ENTRY_INDEX_OF(virtaddr));
-        if (!satisfies_requirement(entry, middle_entries_require)) {
+        if (!(entry & PAGING_FLAG_P) ||
+            !satisfies_requirement(entry, middle_entries_require)) {
                 return false;
         }
         uintptr_t pml2_physbase = ENTRY_BASE_ADDR_OF(entry);
         entry = get_table_entry(pml2_physbase, PML2_ENTRY_INDEX_OF(virtaddr));
-        if (!satisfies_requirement(entry, middle_entries_require)) {
+        if (!(entry & PAGING_FLAG_P) ||
+            !satisfies_requirement(entry, middle_entries_require)) {
                 return false;
         }
         uintptr_t pm1_physbase = ENTRY_BASE_ADDR_OF(entry);
@@ -362,11 +378,49 @@ mmu_addrspace_t mmu_addrspace_create(void) {
         return table_base.value;
 }
 
+// Drops the reference to every page the table maps, and frees the table.
+static void delete_pml1(uintptr_t pml1_physbase) {
+        for (unsigned pml1e_index = 0; pml1e_index < PAGING_ENTRY_COUNT;
+             ++pml1e_index) {
+                paging_entry_t pte = get_table_entry(pml1_physbase, pml1e_index);
+                if (!(pte & PAGING_FLAG_P) ||
+                    (pte & PAGING_FLAG_KERNEL_OWNED)) {
+                        continue;
+                }
+                struct PhysPage_Addr page = {ENTRY_BASE_ADDR_OF(pte)};
+                if (!physpage_unref_if_shared(page)) {
+                        physpage_free(page, 1);
+                }
+        }
+        physpage_free((struct PhysPage_Addr){pml1_physbase}, 1);
+}
+
 void mmu_addrspace_delete(mmu_addrspace_t addrspace) {
         bool prev_interrupt_state;
         spinlock_lock(&s_lock, &prev_interrupt_state);
-        (void)addrspace;
-        TODO();
+        ASSERT(addrspace != active_user_vm_addrspace());
+        // NOTE: `addrspace` is address to PML3
+        for (unsigned pml3e_index = 0; pml3e_index < PAGING_ENTRY_COUNT;
+             ++pml3e_index) {
+                paging_entry_t pml3e = get_table_entry(addrspace, pml3e_index);
+                if (!(pml3e & PAGING_FLAG_P)) {
+                        continue;
+                }
+                ASSERT(!(pml3e & PAGING_FLAG_PS));
+                uintptr_t pml2_physbase = ENTRY_BASE_ADDR_OF(pml3e);
+                for (unsigned pml2e_index = 0; pml2e_index < PAGING_ENTRY_COUNT;
+                     ++pml2e_index) {
+                        paging_entry_t pml2e =
+                                get_table_entry(pml2_physbase, pml2e_index);
+                        if (!(pml2e & PAGING_FLAG_P)) {
+                                continue;
+                        }
+                        ASSERT(!(pml2e & PAGING_FLAG_PS));
+                        delete_pml1(ENTRY_BASE_ADDR_OF(pml2e));
+                }
+                physpage_free((struct PhysPage_Addr){pml2_physbase}, 1);
+        }
+        physpage_free((struct PhysPage_Addr){addrspace}, 1);
         spinlock_unlock(&s_lock, prev_interrupt_state);
 }
 
@@ -424,6 +478,263 @@ uintptr_t mmu_virt_to_phys(void *virtaddr) {
         return ENTRY_BASE_ADDR_OF(entry) + OFFSET_IN_PAGE_OF(virtaddr);
 }
 
+bool mmu_lookup(
+        mmu_addrspace_t handle, void *virtaddr, uintptr_t *physaddr_out
+) {
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        uintptr_t pm1_physbase;
+        paging_entry_t entry;
+        // NOTE: `handle` is address to PML3
+        bool is_present = get_pt_base_and_entry(
+                virtaddr, handle, 0, &pm1_physbase, &entry
+        );
+        if (is_present) {
+                *physaddr_out = ENTRY_BASE_ADDR_OF(entry);
+        }
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+        return is_present;
+}
+
+void mmu_zero_page(uintptr_t physaddr) {
+        ASSERT(is_aligned(PAGE_SIZE, physaddr));
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        void *base = map_to_scratch_page(physaddr, true);
+        kmemset(base, 0, PAGE_SIZE);
+        unmap_scratch_page();
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+}
+
+void mmu_copy_page(uintptr_t dest_physaddr, uintptr_t src_physaddr) {
+        ASSERT(is_aligned(PAGE_SIZE, dest_physaddr));
+        ASSERT(is_aligned(PAGE_SIZE, src_physaddr));
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        if (!s_scratch_page_ready) {
+                kmemcpy(s_direct_mapped_base + dest_physaddr,
+                        s_direct_mapped_base + src_physaddr,
+                        PAGE_SIZE);
+        } else {
+                // There's only one scratch page, so we bounce through a small
+                // buffer.
+                uint8_t buf[256];
+                for (size_t offset = 0; offset < PAGE_SIZE;
+                     offset += sizeof(buf)) {
+                        uint8_t *src = map_to_scratch_page(src_physaddr, false);
+                        kmemcpy(buf, &src[offset], sizeof(buf));
+                        unmap_scratch_page();
+                        uint8_t *dest = map_to_scratch_page(dest_physaddr, true);
+                        kmemcpy(&dest[offset], buf, sizeof(buf));
+                        unmap_scratch_page();
+                }
+        }
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+}
+
+bool mmu_addrspace_share_cow(mmu_addrspace_t dest, mmu_addrspace_t src) {
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        bool result = false;
+        // NOTE: `dest` and `src` are addresses to PML3
+        for (unsigned pml3e_index = 0; pml3e_index < PAGING_ENTRY_COUNT;
+             ++pml3e_index) {
+                paging_entry_t pml3e = get_table_entry(src, pml3e_index);
+                if (!(pml3e & PAGING_FLAG_P)) {
+                        continue;
+                }
+                ASSERT(!(pml3e & PAGING_FLAG_PS));
+                bool is_user = pml3e & PAGING_FLAG_US;
+                uintptr_t pml2_physbase = ENTRY_BASE_ADDR_OF(pml3e);
+                for (unsigned pml2e_index = 0; pml2e_index < PAGING_ENTRY_COUNT;
+                     ++pml2e_index) {
+                        paging_entry_t pml2e =
+                                get_table_entry(pml2_physbase, pml2e_index);
+                        if (!(pml2e & PAGING_FLAG_P)) {
+                                continue;
+                        }
+                        ASSERT(!(pml2e & PAGING_FLAG_PS));
+                        uintptr_t pml1_physbase = ENTRY_BASE_ADDR_OF(pml2e);
+                        // Tables in `dest` are only created once we find a
+                        // present page.
+                        uintptr_t dest_pml1_physbase = 0;
+                        for (unsigned pml1e_index = 0;
+                             pml1e_index < PAGING_ENTRY_COUNT;
+                             ++pml1e_index) {
+                                paging_entry_t pte = get_table_entry(
+                                        pml1_physbase, pml1e_index
+                                );
+                                if (!(pte & PAGING_FLAG_P)) {
+                                        continue;
+                                }
+                                if (!dest_pml1_physbase) {
+                                        paging_entry_t entry;
+                                        entry = get_or_create_table_entry(
+                                                dest, pml3e_index, is_user
+                                        );
+                                        if (!(entry & PAGING_FLAG_P)) {
+                                                goto out;
+                                        }
+                                        entry = get_or_create_table_entry(
+                                                ENTRY_BASE_ADDR_OF(entry),
+                                                pml2e_index,
+                                                is_user
+                                        );
+                                        if (!(entry & PAGING_FLAG_P)) {
+                                                goto out;
+                                        }
+                                        dest_pml1_physbase =
+                                                ENTRY_BASE_ADDR_OF(entry);
+                                }
+                                bool is_kernel_owned =
+                                        pte & PAGING_FLAG_KERNEL_OWNED;
+                                bool is_shared = (pte & PAGING_FLAG_SHARED) ||
+                                                 is_kernel_owned;
+                                // `dest` only maps pages it holds reference
+                                // to, so that mmu_addrspace_delete() can
+                                // undo this.
+                                if (!is_kernel_owned &&
+                                    !physpage_ref((struct PhysPage_Addr){
+                                            ENTRY_BASE_ADDR_OF(pte)})) {
+                                        goto out;
+                                }
+                                if (!is_shared &&
+                                    (pte & (PAGING_FLAG_RW | PAGING_FLAG_COW))) {
+                                        pte &= ~PAGING_FLAG_RW;
+                                        pte |= PAGING_FLAG_COW;
+                                        set_table_entry(
+                                                pml1_physbase, pml1e_index, pte
+                                        );
+                                }
+                                set_table_entry(
+                                        dest_pml1_physbase, pml1e_index, pte
+                                );
+                        }
+                }
+        }
+        result = true;
+out:
+        // On failure, pages shared so far are still referenced by `dest`, and
+        // mmu_addrspace_delete() drops them. Pages left copy-on-write in `src`
+        // are just made writable again on the next write, if nobody else
+        // uses them by then.
+        //
+        // Pages in `src` may have been writable until now.
+        invalidate_tlb();
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+        return result;
+}
+
+bool mmu_is_cow(mmu_addrspace_t handle, void *virtaddr) {
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        uintptr_t pm1_physbase;
+        paging_entry_t entry;
+        // NOTE: `handle` is address to PML3
+        bool is_present = get_pt_base_and_entry(
+                virtaddr, handle, 0, &pm1_physbase, &entry
+        );
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+        return is_present && (entry & PAGING_FLAG_COW);
+}
+
+void mmu_resolve_cow(
+        mmu_addrspace_t handle, void *virtaddr, uintptr_t new_physaddr
+) {
+        ASSERT(is_aligned(PAGE_SIZE, (uintptr_t)virtaddr));
+        ASSERT(is_aligned(PAGE_SIZE, new_physaddr));
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        uintptr_t pm1_physbase;
+        paging_entry_t entry;
+        // NOTE: `handle` is address to PML3
+        bool is_present = get_pt_base_and_entry(
+                virtaddr, handle, 0, &pm1_physbase, &entry
+        );
+        ASSERT(is_present);
+        ASSERT(entry & PAGING_FLAG_COW);
+        entry &= ~(ENTRY_BASE_ADDR_OF(~0ULL) | PAGING_FLAG_COW);
+        entry |= new_physaddr | PAGING_FLAG_RW;
+        set_table_entry(pm1_physbase, PML1_ENTRY_INDEX_OF(virtaddr), entry);
+        invalidate_tlb_for(virtaddr);
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+}
+
+// Returns true if the page table had pages with accessed or dirty flag.
+static bool age_page_table_pages(
+        uintptr_t pml1_physbase,
+        void (*callback)(unsigned age, bool is_dirty, void *data),
+        void *data
+) {
+        bool was_accessed = false;
+        for (unsigned pml1e_index = 0; pml1e_index < PAGING_ENTRY_COUNT;
+             ++pml1e_index) {
+                paging_entry_t pte = get_table_entry(pml1_physbase, pml1e_index);
+                if (!(pte & PAGING_FLAG_P)) {
+                        continue;
+                }
+                unsigned age = (pte & PAGING_AGE_MASK) >> PAGING_AGE_SHIFT;
+                bool is_dirty = pte & PAGING_FLAG_D;
+                if (pte & PAGING_FLAG_A) {
+                        age = 0;
+                } else if (age < MMU_PAGE_AGE_MAX) {
+                        ++age;
+                }
+                paging_entry_t new_pte =
+                        pte & ~(PAGING_AGE_MASK | PAGING_FLAG_A | PAGING_FLAG_D);
+                new_pte |= (paging_entry_t)age << PAGING_AGE_SHIFT;
+                if (new_pte != pte) {
+                        set_table_entry(pml1_physbase, pml1e_index, new_pte);
+                }
+                if (pte & (PAGING_FLAG_A | PAGING_FLAG_D)) {
+                        was_accessed = true;
+                }
+                callback(age, is_dirty, data);
+        }
+        return was_accessed;
+}
+
+bool mmu_age_pages(
+        mmu_addrspace_t handle,
+        size_t *cursor,
+        void (*callback)(unsigned age, bool is_dirty, void *data),
+        void *data
+) {
+        // Cursor is index of the next PML2 entry to look at, counting from the
+        // first entry of the first PML2.
+        size_t const cursor_end = PAGING_ENTRY_COUNT * PAGING_ENTRY_COUNT;
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        size_t index = *cursor;
+        while (index < cursor_end) {
+                // NOTE: `handle` is address to PML3
+                unsigned pml3e_index = index / PAGING_ENTRY_COUNT;
+                paging_entry_t pml3e = get_table_entry(handle, pml3e_index);
+                if (!(pml3e & PAGING_FLAG_P) || (pml3e & PAGING_FLAG_PS)) {
+                        index = (size_t)(pml3e_index + 1) * PAGING_ENTRY_COUNT;
+                        continue;
+                }
+                paging_entry_t pml2e = get_table_entry(
+                        ENTRY_BASE_ADDR_OF(pml3e), index % PAGING_ENTRY_COUNT
+                );
+                ++index;
+                if (!(pml2e & PAGING_FLAG_P) || (pml2e & PAGING_FLAG_PS)) {
+                        continue;
+                }
+                // Processor won't set A/D bits again while the old entry is
+                // cached, so we flush after clearing them.
+                if (age_page_table_pages(
+                            ENTRY_BASE_ADDR_OF(pml2e), callback, data
+                    )) {
+                        invalidate_tlb();
+                }
+                break;
+        }
+        *cursor = index;
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+        return index < cursor_end;
+}
+
 bool mmu_is_accessible(void *virtaddr, mmu_prot_t requires) {
         bool prev_interrupt_state;
         spinlock_lock(&s_lock, &prev_interrupt_state);
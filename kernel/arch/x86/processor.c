@@ -177,7 +177,7 @@ static void init_system_segment_descriptor(
 WARN_UNUSED_RESULT static void *alloc_stack(struct Process *process) {
         struct PhysPage_Addr page = physpage_alloc(STACK_PAGE_COUNT);
         if (!page.value) {
-                TODO_HANDLE_ERROR();
+                return NULL;
         }
         void *addr = process_map_pages(
                 process,
@@ -186,7 +186,8 @@ WARN_UNUSED_RESULT static void *alloc_stack(struct Process *process) {
                 (struct Proc_MapOptions){.executable = false, .writable = true}
         );
         if (!addr) {
-                TODO_HANDLE_ERROR();
+                physpage_free(page, STACK_PAGE_COUNT);
+                return NULL;
         }
         return addr;
 }
@@ -293,12 +294,35 @@ static void use_thread_ist_and_syscall_stack(
 
 #define COMMON_ASM_TAIL "99:\n"
 
+// Remember user stack pointers saved by SYSCALL
+// This not only allows syscalls to switch to different task safely, but this is
+// also *very* important on multi-processor systems, where context switch may
+// get saved on one processor and then later restored on the another one.
+static void switch_syscall_user_stack_pointers(
+        struct Processor_LocalState *processor,
+        struct Processor_Thread *old_thread,
+        struct Processor_Thread const *new_thread
+) {
+        old_thread->x86_saved_user_rsp =
+                (void *)processor->x86_misc_state
+                        [X86_MISC_STATE_SYSCALL_SAVED_USER_RSP_INDEX];
+        old_thread->x86_saved_user_rbp =
+                (void *)processor->x86_misc_state
+                        [X86_MISC_STATE_SYSCALL_SAVED_USER_RBP_INDEX];
+        // Load old user stack pointers that may be used by SYSRET
+        processor->x86_misc_state[X86_MISC_STATE_SYSCALL_SAVED_USER_RSP_INDEX] =
+                (uintptr_t)new_thread->x86_saved_user_rsp;
+        processor->x86_misc_state[X86_MISC_STATE_SYSCALL_SAVED_USER_RBP_INDEX] =
+                (uintptr_t)new_thread->x86_saved_user_rbp;
+}
+
 void processor_thread_enter_initial_kernel_thread(
         struct Processor_Thread *new_thread, void (*entry_point)()
 ) {
         ASSERT(!interrupts_are_enabled());
         struct Processor_LocalState *state = processor_current();
         use_thread_ist_and_syscall_stack(state, new_thread);
+        fpu_set_initial_thread(state, new_thread);
         // We are setting RBP to 0 to indicate the end of stack trace.
         // clang-format off
         __asm__ volatile(
@@ -329,9 +353,27 @@ void processor_thread_enter(
         ASSERT(to_thread != from_thread);
         struct Processor_LocalState *state = processor_current();
         use_thread_ist_and_syscall_stack(state, to_thread);
+        switch_syscall_user_stack_pointers(state, from_thread, to_thread);
+        fpu_switch(state, from_thread, to_thread);
         // We are setting RBP to 0 to indicate the end of stack trace.
 
-        if (is_user_thread) {
+        if (is_user_thread && to_thread->x86_is_forked) {
+                // RSP points to the X86_SyscallFrame copied from the parent,
+                // so we just take the syscall's return path.
+                // clang-format off
+                __asm__ volatile(
+                        ASM_SAVE_STATE
+                        ASM_ABOUT_TO_ENTER_NEW_THREAD
+                        ASM_LOAD_STATE_COMMON
+                        "xor eax, eax\n" // fork() returns 0 in the child
+                        "jmp syscall_x86_return_to_user\n"
+                        COMMON_ASM_TAIL
+                        : [save_rsp_to] "=m"(from_thread->x86_saved_rsp)
+                        : [new_rsp_value] "a"(to_thread->x86_saved_rsp),
+                        [ds] "i"(GDT_USER_DS)
+                );
+                // clang-format on
+        } else if (is_user_thread) {
                 // clang-format off
                 __asm__ volatile(
                         ASM_SAVE_STATE
@@ -358,12 +400,15 @@ void processor_thread_enter(
                         "mov rbp, 0\n"
                         "push %[rflags]\n"
                         "popfq\n"
+                        // Returning from the entry point exits the thread.
+                        "push %[return_to]\n"
                         "jmp %[entry_point]\n"
                         COMMON_ASM_TAIL
                         : [save_rsp_to] "=m"(from_thread->x86_saved_rsp)
                         : [new_rsp_value] "a"(to_thread->x86_saved_rsp),
                         [ds] "i"(GDT_KERNEL_DS),
                         [entry_point]"c"(entry_point),
+                        [return_to] "d"(thread_exit),
                         [rflags] "i"(0)
                 );
                 // clang-format on
@@ -381,23 +426,8 @@ void processor_thread_context_switch(
         processor->x86_misc_state[X86_MISC_STATE_SAVED_GS_BASE_UPPER32_INDEX] =
                 is_user_thread ? 0 : (uintptr_t)processor;
         use_thread_ist_and_syscall_stack(processor, new_thread);
-
-        // Remember user stack pointers saved by SYSCALL
-        // This not only allows syscalls to switch to different task safely, but
-        // this is also *very* important on multi-processor systems, where
-        // context switch may get saved on one processor and then later restored
-        // on the another one.
-        old_thread->x86_saved_user_rsp =
-                (void *)processor->x86_misc_state
-                        [X86_MISC_STATE_SYSCALL_SAVED_USER_RSP_INDEX];
-        old_thread->x86_saved_user_rbp =
-                (void *)processor->x86_misc_state
-                        [X86_MISC_STATE_SYSCALL_SAVED_USER_RBP_INDEX];
-        // Load old user stack pointers that may be used by SYSRET
-        processor->x86_misc_state[X86_MISC_STATE_SYSCALL_SAVED_USER_RSP_INDEX] =
-                (uintptr_t)new_thread->x86_saved_user_rsp;
-        processor->x86_misc_state[X86_MISC_STATE_SYSCALL_SAVED_USER_RBP_INDEX] =
-                (uintptr_t)new_thread->x86_saved_user_rbp;
+        switch_syscall_user_stack_pointers(processor, old_thread, new_thread);
+        fpu_switch(processor, old_thread, new_thread);
 
         // NOTE: Even if next thread is userland thread, it was last switched
         //       from the ISR, which is kernel-mode code. So we are always
@@ -447,22 +477,107 @@ void processor_set_running_thread(struct Processor_LocalState *state, struct Thr
         state->running_thread = thread;
 }
 
+struct Scheduler_RunQueue *
+processor_run_queue(struct Processor_LocalState const *state) {
+        return __atomic_load_n(&state->run_queue, __ATOMIC_ACQUIRE);
+}
+
+void processor_set_run_queue(
+        struct Processor_LocalState *state, struct Scheduler_RunQueue *queue
+) {
+        // Other processors may start looking at the queue right after this.
+        __atomic_store_n(&state->run_queue, queue, __ATOMIC_RELEASE);
+}
+
+struct Timer_Base *
+processor_timer_base(struct Processor_LocalState const *state) {
+        return __atomic_load_n(&state->timer_base, __ATOMIC_ACQUIRE);
+}
+
+void processor_set_timer_base(
+        struct Processor_LocalState *state, struct Timer_Base *base
+) {
+        __atomic_store_n(&state->timer_base, base, __ATOMIC_RELEASE);
+}
+
+bool processor_arm_timer(uint64_t ns) {
+        ASSERT(!interrupts_are_enabled());
+        return lapic_timer_arm(ns);
+}
+
+size_t processor_count(void) { return 1 + s_ap_count; }
+
+struct Processor_LocalState *processor_at(size_t index) {
+        ASSERT(index < processor_count());
+        if (index == 0) {
+                return &s_bsp_localstate;
+        }
+        return &s_ap_localstates[index - 1];
+}
+
 bool processor_thread_init(struct Processor_Thread *out, void *stack_top) {
         struct Process *kernel_process = process_kernel();
         out->x86_ist1_stack_base = alloc_stack(kernel_process);
         if (!out->x86_ist1_stack_base) {
-                TODO_HANDLE_ERROR();
+                goto fail;
         }
         out->x86_syscall_kernel_stack_base = alloc_stack(kernel_process);
         if (!out->x86_syscall_kernel_stack_base) {
-                TODO_HANDLE_ERROR();
+                goto fail_syscall_stack;
         }
         out->x86_ist1_rsp =
                 (void *)((uintptr_t)out->x86_ist1_stack_base + STACK_SIZE);
         out->x86_syscall_kernel_rsp =
                 (void *)((uintptr_t)out->x86_syscall_kernel_stack_base +
                          STACK_SIZE);
-        out->x86_saved_rsp = stack_top;
+        if (!fpu_thread_init(out)) {
+                goto fail_fpu;
+        }
+        processor_thread_reset(out, stack_top);
+        return true;
+fail_fpu:
+        free_stack(kernel_process, out->x86_syscall_kernel_stack_base);
+        out->x86_syscall_kernel_stack_base = NULL;
+fail_syscall_stack:
+        free_stack(kernel_process, out->x86_ist1_stack_base);
+        out->x86_ist1_stack_base = NULL;
+fail:
+        return false;
+}
+
+void processor_thread_reset(struct Processor_Thread *thread, void *stack_top) {
+        thread->x86_saved_rsp = stack_top;
+        thread->x86_saved_user_rsp = NULL;
+        thread->x86_saved_user_rbp = NULL;
+        thread->x86_is_forked = false;
+        fpu_thread_reset(thread);
+}
+
+bool processor_thread_init_forked(
+        struct Processor_Thread *out, struct Processor_Thread const *parent_thread
+) {
+        if (!processor_thread_init(out, NULL)) {
+                return false;
+        }
+        fpu_thread_init_forked(out, parent_thread);
+        struct X86_SyscallFrame const *parent_frame =
+                (struct X86_SyscallFrame const *)
+                        parent_thread->x86_syscall_kernel_rsp -
+                1;
+        struct X86_SyscallFrame *frame =
+                (struct X86_SyscallFrame *)out->x86_syscall_kernel_rsp - 1;
+        *frame = *parent_frame;
+        out->x86_saved_rsp = frame;
+        ENTER_NO_INTERRUPT_SECTION();
+        struct Processor_LocalState *processor = processor_current();
+        out->x86_saved_user_rsp =
+                (void *)processor->x86_misc_state
+                        [X86_MISC_STATE_SYSCALL_SAVED_USER_RSP_INDEX];
+        out->x86_saved_user_rbp =
+                (void *)processor->x86_misc_state
+                        [X86_MISC_STATE_SYSCALL_SAVED_USER_RBP_INDEX];
+        LEAVE_NO_INTERRUPT_SECTION();
+        out->x86_is_forked = true;
         return true;
 }
 
@@ -471,6 +586,7 @@ void processor_thread_deinit(
 ) {
         free_stack(process, thread->x86_syscall_kernel_stack_base);
         free_stack(process, thread->x86_ist1_stack_base);
+        fpu_thread_deinit(thread);
 }
 
 #define CR4_FLAG_SMEP (1 << 20)
@@ -642,10 +758,20 @@ static void enable_wp(void) {
 static void enable_features(void) {
         enable_smep_smap();
         enable_wp();
+        fpu_init_for_current_processor();
         x86_msr_set_flag(MSR_IA32_EFER, MSR_IA32_EFER_NXE | MSR_IA32_EFER_SCE);
 }
 
+// Local APIC may not be mapped yet, but CPUID knows the ID too.
+static uint8_t initial_apic_id(void) {
+        unsigned eax, ebx, ecx, edx;
+        __cpuid(1, eax, ebx, ecx, edx);
+        return ebx >> 24;
+}
+
 static void init_common(struct Processor_LocalState *state) {
+        state->x86_apic_id = initial_apic_id();
+        cputopology_init_for_current_processor(state);
         init_tss(state);
         load_gdt(state);
         load_selectors();
@@ -754,6 +880,18 @@ void processor_broadcast_ipi_to_others(void) {
         );
 }
 
+void processor_send_reschedule_ipi(struct Processor_LocalState *target) {
+        lapic_send_ipi(
+                target->x86_apic_id,
+                LAPIC_IPI_FLAG_VECTOR(LAPIC_RESCHEDULE_IPI_VECTOR) |
+                        LAPIC_IPI_FLAG_DELIVERY_FIXED |
+                        LAPIC_IPI_FLAG_DEST_PHYSICAL |
+                        LAPIC_IPI_FLAG_LEVEL_ASSERT |
+                        LAPIC_IPI_FLAG_TRIGGER_EDGE |
+                        LAPIC_IPI_FLAG_DEST_SHORTHAND_NONE
+        );
+}
+
 static void queue_message(struct Processor_LocalState *state, struct IPIMessage *msg) {
         bool prev_interrupt_state;
         spinlock_lock(&state->x86_ipimessages_lock, &prev_interrupt_state);
@@ -0,0 +1,343 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "_internal.h"
+#include "kernel/api/bits/clockpage.h"
+#include "kernel/arch/arch.h"
+#include "kernel/kernel.h"
+#include "kernel/lock/spinlock.h"
+#include "kernel/tasks/tasks.h"
+#include "kernel/utility/utility.h"
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+static char const *LOG_TAG = "tsc";
+
+// If CPUID doesn't tell the frequency, TSC is counted against HPET or PIT for
+// this long.
+#define CALIBRATION_WINDOW_MS 10
+// PIT window is measured again if we might have noticed its end too late, for
+// example because the hypervisor didn't run us for a while.
+#define PIT_MAX_ERROR_PPM 1000
+#define PIT_MAX_TRIES     3
+// Result is reported if it's this far off from nominal frequency.
+#define NOMINAL_MAX_DIFF_PPM 10000
+// AP asks BSP for its TSC this many times, and trusts the fastest round trip.
+#define SYNC_ROUND_COUNT 16
+
+#define CPUID_01_ECX_HYPERVISOR          (1U << 31)
+#define CPUID_80000001_EDX_RDTSCP        (1 << 27)
+#define CPUID_80000007_EDX_INVARIANT_TSC (1 << 8)
+
+struct Calibration {
+        uint64_t freq_hz;
+        // How far off `freq_hz` may be, in parts per million.
+        uint64_t error_ppm;
+        char const *source;
+};
+
+// nanoseconds = (TSC * s_ns_mult) >> 32
+static uint64_t s_ns_mult;
+// cycles = (nanoseconds * s_cycles_mult) >> 24
+static uint64_t s_cycles_mult;
+static uint64_t s_freq_hz;
+static uint64_t s_crystal_hz;
+static bool s_calibrated = false;
+
+// AP bumps `request_seq`, and BSP answers with its TSC and the same sequence
+// number in `response_seq`. Only one AP can use it at a time.
+static struct {
+        uint64_t request_seq;
+        uint64_t response_seq;
+        uint64_t bsp_tsc;
+} s_sync;
+static struct SpinLock s_sync_lock;
+
+// Userland's view of the clock. Only BSP and APs holding `s_sync_lock` update
+// it.
+static struct ClockPage *s_clock_page;
+static uintptr_t s_clock_page_physaddr;
+static bool s_has_rdtscp;
+
+static bool is_invariant(void) {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+                return false;
+        }
+        return edx & CPUID_80000007_EDX_INVARIANT_TSC;
+}
+
+static bool is_hypervisor(void) {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x1, &eax, &ebx, &ecx, &edx)) {
+                return false;
+        }
+        return ecx & CPUID_01_ECX_HYPERVISOR;
+}
+
+// Returns 0 if it's not reported.
+static uint64_t nominal_freq_hz(void) {
+        unsigned eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0, NULL) < 0x16) {
+                return 0;
+        }
+        __cpuid(0x16, eax, ebx, ecx, edx);
+        return (uint64_t)(eax & 0xffff) * 1000000;
+}
+
+// Leaf 0x15 tells TSC/crystal clock ratio. Some processors don't report the
+// crystal frequency itself, but it can be worked out from the nominal
+// frequency.
+static bool calibrate_with_cpuid(struct Calibration *out) {
+        unsigned eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0, NULL) < 0x15) {
+                return false;
+        }
+        __cpuid(0x15, eax, ebx, ecx, edx);
+        if ((eax == 0) || (ebx == 0)) {
+                return false;
+        }
+        uint64_t crystal_hz = ecx;
+        out->error_ppm = 0;
+        if (crystal_hz == 0) {
+                uint64_t nominal_hz = nominal_freq_hz();
+                if (nominal_hz == 0) {
+                        return false;
+                }
+                crystal_hz = nominal_hz * eax / ebx;
+                // Nominal frequency is only reported in MHz.
+                out->error_ppm = 1000000000000ULL / nominal_hz;
+        }
+        out->freq_hz = crystal_hz * ebx / eax;
+        out->source = "CPUID";
+        // Hypervisors may report host's crystal, while emulating LAPIC timer
+        // at some other frequency.
+        if (!is_hypervisor()) {
+                s_crystal_hz = crystal_hz;
+        }
+        return true;
+}
+
+static bool calibrate_with_hpet(struct Calibration *out) {
+        if (!hpet_init()) {
+                return false;
+        }
+        uint64_t window_counts =
+                CALIBRATION_WINDOW_MS * 1000000000000ULL / hpet_period_fs();
+        // Each HPET read is bracketed by two TSC reads, and we assume it
+        // happened halfway through.
+        uint64_t tsc_before_begin = rdtsc();
+        uint64_t hpet_begin = hpet_read_counter();
+        uint64_t tsc_after_begin = rdtsc();
+        uint64_t tsc_before_end, hpet_end, tsc_after_end;
+        do {
+                tsc_before_end = rdtsc();
+                hpet_end = hpet_read_counter();
+                tsc_after_end = rdtsc();
+        } while (hpet_elapsed_counts(hpet_begin, hpet_end) < window_counts);
+        uint64_t elapsed_fs =
+                hpet_elapsed_counts(hpet_begin, hpet_end) * hpet_period_fs();
+        uint64_t cycles = (tsc_before_end + tsc_after_end) / 2 -
+                          (tsc_before_begin + tsc_after_begin) / 2;
+        uint64_t uncertainty = ((tsc_after_begin - tsc_before_begin) +
+                                (tsc_after_end - tsc_before_end)) /
+                               2;
+        out->freq_hz = cycles * 1000000000 / (elapsed_fs / 1000000);
+        out->error_ppm = uncertainty * 1000000 / cycles;
+        out->source = "HPET";
+        return true;
+}
+
+static void calibrate_with_pit(struct Calibration *out) {
+        for (unsigned i = 0; i < PIT_MAX_TRIES; ++i) {
+                uint64_t cycles, uncertainty;
+                uint64_t window_ns = i8254timer_oneshot_count_tsc(
+                        CALIBRATION_WINDOW_MS, &cycles, &uncertainty
+                );
+                uint64_t error_ppm = uncertainty * 1000000 / cycles;
+                if ((i == 0) || (error_ppm < out->error_ppm)) {
+                        out->freq_hz = cycles * 1000000000 / window_ns;
+                        out->error_ppm = error_ppm;
+                }
+                if (out->error_ppm <= PIT_MAX_ERROR_PPM) {
+                        break;
+                }
+        }
+        out->source = "PIT";
+}
+
+static struct Calibration calibrate(void) {
+        struct Calibration result;
+        if (calibrate_with_cpuid(&result)) {
+                return result;
+        }
+        if (!calibrate_with_hpet(&result)) {
+                calibrate_with_pit(&result);
+        }
+        // PIT and HPET are accurate enough on their own, so this is only to
+        // catch broken measurement.
+        uint64_t nominal_hz = nominal_freq_hz();
+        if (nominal_hz != 0) {
+                uint64_t diff = (nominal_hz < result.freq_hz)
+                                        ? (result.freq_hz - nominal_hz)
+                                        : (nominal_hz - result.freq_hz);
+                if (NOMINAL_MAX_DIFF_PPM < diff * 1000000 / nominal_hz) {
+                        LOGW(LOG_TAG,
+                             "Measured TSC frequency is far from nominal "
+                             "frequency %uMHz",
+                             nominal_hz / 1000000);
+                }
+        }
+        return result;
+}
+
+static bool has_rdtscp(void) {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) {
+                return false;
+        }
+        return edx & CPUID_80000001_EDX_RDTSCP;
+}
+
+static void begin_clock_page_update(void) {
+        __atomic_store_n(
+                &s_clock_page->seq, s_clock_page->seq + 1, __ATOMIC_RELAXED
+        );
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end_clock_page_update(void) {
+        __atomic_store_n(
+                &s_clock_page->seq, s_clock_page->seq + 1, __ATOMIC_RELEASE
+        );
+}
+
+// Lets RDTSCP tell userland which processor's offset to use.
+static void publish_offset(struct Processor_LocalState *state) {
+        if (s_has_rdtscp) {
+                wrmsr(MSR_TSC_AUX, state->cpu_num);
+        }
+        begin_clock_page_update();
+        s_clock_page->tsc_offsets[state->cpu_num] = state->x86_tsc_offset;
+        end_clock_page_update();
+}
+
+static void init_clock_page(void) {
+        s_clock_page = process_alloc_pages(
+                process_kernel(),
+                &s_clock_page_physaddr,
+                1,
+                (struct Proc_MapOptions){.writable = true, .executable = false}
+        );
+        if (!s_clock_page) {
+                panic("Not enough memory to create clock page");
+        }
+        kmemset(s_clock_page, 0, PAGE_SIZE);
+        s_has_rdtscp = has_rdtscp();
+        if (!s_has_rdtscp) {
+                LOGW(LOG_TAG,
+                     "RDTSCP is not supported. Userland has to use system call "
+                     "to read the clock");
+        }
+        begin_clock_page_update();
+        s_clock_page->ns_mult = s_ns_mult;
+        s_clock_page->is_usable = s_has_rdtscp;
+        end_clock_page_update();
+}
+
+void tsc_init_for_bsp(void) {
+        if (!is_invariant()) {
+                LOGW(LOG_TAG,
+                     "TSC is not invariant. Time may drift if processor "
+                     "frequency changes");
+        }
+        struct Calibration calibration = calibrate();
+        s_freq_hz = calibration.freq_hz;
+        s_ns_mult = (1000000000ULL << 32) / s_freq_hz;
+        s_cycles_mult = (s_freq_hz << 24) / 1000000000;
+        struct Processor_LocalState *state = processor_current();
+        state->x86_tsc_offset = 0;
+        init_clock_page();
+        publish_offset(state);
+        __atomic_store_n(&s_calibrated, true, __ATOMIC_RELEASE);
+        LOGI(LOG_TAG,
+             "TSC frequency is %uKHz (from %s, within %u ppm)",
+             s_freq_hz / 1000,
+             calibration.source,
+             calibration.error_ppm);
+}
+
+uint64_t tsc_frequency_hz(void) { return s_freq_hz; }
+
+uint64_t tsc_crystal_hz(void) { return s_crystal_hz; }
+
+uint64_t tsc_cycles_from_ns(uint64_t ns) {
+        return ((unsigned __int128)ns * s_cycles_mult) >> 24;
+}
+
+void tsc_serve_sync_request(void) {
+        uint64_t seq = __atomic_load_n(&s_sync.request_seq, __ATOMIC_ACQUIRE);
+        if (seq == s_sync.response_seq) {
+                return;
+        }
+        s_sync.bsp_tsc = rdtsc();
+        __atomic_store_n(&s_sync.response_seq, seq, __ATOMIC_RELEASE);
+}
+
+void tsc_init_for_ap(void) {
+        uint64_t best_round_trip = UINT64_MAX;
+        uint64_t offset = 0;
+        bool prev_interrupt_state;
+        spinlock_lock(&s_sync_lock, &prev_interrupt_state);
+        for (unsigned i = 0; i < SYNC_ROUND_COUNT; ++i) {
+                uint64_t seq = s_sync.request_seq + 1;
+                uint64_t before = rdtsc();
+                __atomic_store_n(&s_sync.request_seq, seq, __ATOMIC_RELEASE);
+                while (__atomic_load_n(&s_sync.response_seq, __ATOMIC_ACQUIRE) !=
+                       seq) {
+                        processor_wait_during_spinloop();
+                }
+                uint64_t after = rdtsc();
+                uint64_t round_trip = after - before;
+                if (round_trip < best_round_trip) {
+                        // Assume BSP read its TSC halfway through.
+                        best_round_trip = round_trip;
+                        offset = (before + round_trip / 2) - s_sync.bsp_tsc;
+                }
+        }
+        struct Processor_LocalState *state = processor_current();
+        state->x86_tsc_offset = offset;
+        publish_offset(state);
+        spinlock_unlock(&s_sync_lock, prev_interrupt_state);
+}
+
+bool processor_clock_ns(uint64_t *ns_out) {
+        if (!__atomic_load_n(&s_calibrated, __ATOMIC_ACQUIRE)) {
+                return false;
+        }
+        // We must not move to other processor between reading TSC and the
+        // offset.
+        ENTER_NO_INTERRUPT_SECTION();
+        uint64_t tsc = rdtsc() - processor_current()->x86_tsc_offset;
+        LEAVE_NO_INTERRUPT_SECTION();
+        *ns_out = ((unsigned __int128)tsc * s_ns_mult) >> 32;
+        return true;
+}
+
+uint64_t processor_cycles(void) {
+        ASSERT(!interrupts_are_enabled());
+        return rdtsc() - processor_current()->x86_tsc_offset;
+}
+
+uint64_t processor_ns_from_cycles(uint64_t cycles) {
+        if (!__atomic_load_n(&s_calibrated, __ATOMIC_ACQUIRE)) {
+                return 0;
+        }
+        return ((unsigned __int128)cycles * s_ns_mult) >> 32;
+}
+
+uintptr_t processor_clock_page_physaddr(void) {
+        ASSERT(s_clock_page);
+        return s_clock_page_physaddr;
+}
@@ -45,8 +45,12 @@ static const struct CliCmd_Descriptor HELP_CMD = {
 
 static struct CliCmd_Descriptor const *CMDS[] = {
         &HELP_CMD,
+        &CLICMD_SCHEDBENCH,
+        &CLICMD_SCHEDLAT,
         &CLICMD_TESTMALLOC,
         &CLICMD_TESTPAGEALLOC,
+        &CLICMD_TOP,
+        &CLICMD_WSS,
 };
 
 enum {
@@ -16,5 +16,9 @@ struct CliCmd_Descriptor {
         struct CliCmd_ArgHelp const *args_help;
 };
 
+extern const struct CliCmd_Descriptor CLICMD_SCHEDBENCH;
+extern const struct CliCmd_Descriptor CLICMD_SCHEDLAT;
 extern const struct CliCmd_Descriptor CLICMD_TESTMALLOC;
 extern const struct CliCmd_Descriptor CLICMD_TESTPAGEALLOC;
+extern const struct CliCmd_Descriptor CLICMD_TOP;
+extern const struct CliCmd_Descriptor CLICMD_WSS;
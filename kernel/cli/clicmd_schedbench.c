@@ -0,0 +1,386 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "cliarg.h"
+#include "clicmd.h"
+#include "kernel/arch/arch.h"
+#include "kernel/heap/heap.h"
+#include "kernel/kernel.h"
+#include "kernel/lock/mutex.h"
+#include "kernel/tasks/tasks.h"
+#include "kernel/utility/utility.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEFAULT_ITERATIONS 1000
+#define MAX_ITERATIONS     100000
+// How often we check whether benchmark threads are done.
+#define POLL_INTERVAL_NS (10 * 1000000ULL)
+
+// Benchmark threads can't take arguments, so everything they share lives
+// here. Only one benchmark runs at a time, as the CLI runs one command at a
+// time.
+struct Bench {
+        uint64_t *samples;
+        size_t sample_count, iterations;
+        // processor_cycles() right before the event being measured.
+        uint64_t start_cycles;
+        // Thread that yielded last, for ping-pong.
+        struct Thread *last_yielder;
+        // Thread the other one wakes up or hands the mutex to.
+        struct Thread *sleeper;
+        struct Mutex *mutex;
+        // Round the mutex owner has started. The waiter follows it.
+        size_t round;
+        unsigned finished_count;
+};
+
+static struct Bench s_bench;
+
+// Caller must be the only one recording at the moment.
+static void record(uint64_t cycles) {
+        if (s_bench.sample_count < s_bench.iterations) {
+                s_bench.samples[s_bench.sample_count] = cycles;
+                ++s_bench.sample_count;
+        }
+}
+
+static bool is_done(void) {
+        return s_bench.iterations <= s_bench.sample_count;
+}
+
+static void finish(void) {
+        __atomic_fetch_add(&s_bench.finished_count, 1, __ATOMIC_RELEASE);
+}
+
+static bool is_sleeping(struct Thread *thread) {
+        return __atomic_load_n(
+                &thread_get_sched_state(thread)->is_sleeping, __ATOMIC_ACQUIRE
+        );
+}
+
+// Two threads on the same processor yield to each other. Each sample is one
+// trip through scheduler_yield() and a context switch.
+static void run_yield_pingpong(void) {
+        struct Thread *self = thread_running();
+        while (1) {
+                ENTER_NO_INTERRUPT_SECTION();
+                if (is_done()) {
+                        LEAVE_NO_INTERRUPT_SECTION();
+                        break;
+                }
+                uint64_t now = processor_cycles();
+                if (s_bench.last_yielder && (s_bench.last_yielder != self)) {
+                        record(now - s_bench.start_cycles);
+                }
+                s_bench.last_yielder = self;
+                s_bench.start_cycles = processor_cycles();
+                scheduler_yield();
+                LEAVE_NO_INTERRUPT_SECTION();
+        }
+        finish();
+}
+
+// Goes to sleep until another processor wakes us up, and measures how long
+// that took.
+static void run_wakeup_sleeper(void) {
+        struct Thread *self = thread_running();
+        for (size_t i = 0; i < s_bench.iterations; ++i) {
+                ENTER_NO_INTERRUPT_SECTION();
+                thread_set_sleep_scheduled(self, true);
+                scheduler_yield();
+                uint64_t now = processor_cycles();
+                if (thread_is_sleep_scheduled(self)) {
+                        // There was nothing else to run, so we couldn't
+                        // sleep.
+                        thread_set_sleep_scheduled(self, false);
+                } else {
+                        record(now - __atomic_load_n(
+                                             &s_bench.start_cycles,
+                                             __ATOMIC_ACQUIRE
+                                     ));
+                }
+                LEAVE_NO_INTERRUPT_SECTION();
+        }
+        finish();
+}
+
+static void run_wakeup_waker(void) {
+        for (size_t i = 0; i < s_bench.iterations; ++i) {
+                while (!is_sleeping(s_bench.sleeper)) {
+                        scheduler_yield();
+                }
+                ENTER_NO_INTERRUPT_SECTION();
+                __atomic_store_n(
+                        &s_bench.start_cycles,
+                        processor_cycles(),
+                        __ATOMIC_RELEASE
+                );
+                scheduler_wakeup_thread(s_bench.sleeper);
+                LEAVE_NO_INTERRUPT_SECTION();
+        }
+        finish();
+}
+
+// Holds the mutex until the waiter sleeps on it, and then unlocks it.
+static void run_mutex_owner(void) {
+        for (size_t i = 1; i <= s_bench.iterations; ++i) {
+                mutex_lock(s_bench.mutex);
+                __atomic_store_n(&s_bench.round, i, __ATOMIC_RELEASE);
+                while (!is_sleeping(s_bench.sleeper)) {
+                        scheduler_yield();
+                }
+                ENTER_NO_INTERRUPT_SECTION();
+                __atomic_store_n(
+                        &s_bench.start_cycles,
+                        processor_cycles(),
+                        __ATOMIC_RELEASE
+                );
+                LEAVE_NO_INTERRUPT_SECTION();
+                mutex_unlock(s_bench.mutex);
+        }
+        finish();
+}
+
+static void run_mutex_waiter(void) {
+        for (size_t i = 1; i <= s_bench.iterations; ++i) {
+                while (__atomic_load_n(&s_bench.round, __ATOMIC_ACQUIRE) < i) {
+                        scheduler_yield();
+                }
+                mutex_lock(s_bench.mutex);
+                ENTER_NO_INTERRUPT_SECTION();
+                record(processor_cycles() -
+                       __atomic_load_n(&s_bench.start_cycles, __ATOMIC_ACQUIRE)
+                );
+                LEAVE_NO_INTERRUPT_SECTION();
+                mutex_unlock(s_bench.mutex);
+        }
+        finish();
+}
+
+// Returns NULL on OOM.
+static struct Thread *
+create_thread(char const *name, void (*entry_point)(), size_t processor) {
+        struct Thread *thread =
+                thread_create(process_kernel(), name, entry_point);
+        if (!thread) {
+                return NULL;
+        }
+        cpumask_t mask = cpumask_of(processor);
+        thread_set_affinity(thread, &mask);
+        return thread;
+}
+
+// Starts both threads of a benchmark, or neither of them if either couldn't
+// be created.
+static bool start_threads(struct Thread *first, struct Thread *second) {
+        if (!first || !second) {
+                if (first) {
+                        thread_discard(first);
+                }
+                if (second) {
+                        thread_discard(second);
+                }
+                console_alert("Failed to create benchmark threads");
+                return false;
+        }
+        scheduler_add_thread_to_wait_queue(first);
+        scheduler_add_thread_to_wait_queue(second);
+        return true;
+}
+
+static void wait_for_threads(unsigned count) {
+        while (__atomic_load_n(&s_bench.finished_count, __ATOMIC_ACQUIRE) <
+               count) {
+                timer_sleep(POLL_INTERVAL_NS);
+        }
+}
+
+static void reset_bench(void) {
+        s_bench.sample_count = 0;
+        s_bench.start_cycles = 0;
+        s_bench.last_yielder = NULL;
+        s_bench.sleeper = NULL;
+        s_bench.round = 0;
+        s_bench.finished_count = 0;
+}
+
+// Heapsort, so that large sample counts don't take forever.
+static void sift_down(uint64_t *samples, size_t root, size_t count) {
+        while (1) {
+                size_t child = root * 2 + 1;
+                if (count <= child) {
+                        break;
+                }
+                if ((child + 1 < count) &&
+                    (samples[child] < samples[child + 1])) {
+                        ++child;
+                }
+                if (samples[child] <= samples[root]) {
+                        break;
+                }
+                uint64_t temp = samples[root];
+                samples[root] = samples[child];
+                samples[child] = temp;
+                root = child;
+        }
+}
+
+static void sort_samples(uint64_t *samples, size_t count) {
+        for (size_t i = count / 2; 0 < i; --i) {
+                sift_down(samples, i - 1, count);
+        }
+        for (size_t end = count; 1 < end; --end) {
+                uint64_t temp = samples[0];
+                samples[0] = samples[end - 1];
+                samples[end - 1] = temp;
+                sift_down(samples, 0, end - 1);
+        }
+}
+
+// `permille` of 1000 is the maximum.
+static uint64_t percentile(size_t permille) {
+        size_t index = s_bench.sample_count * permille / 1000;
+        if (s_bench.sample_count <= index) {
+                index = s_bench.sample_count - 1;
+        }
+        return s_bench.samples[index];
+}
+
+static void show_percentile(char const *label, size_t permille) {
+        uint64_t cycles = percentile(permille);
+        console_printf(
+                " %s %lu(%luns)",
+                label,
+                (unsigned long)cycles,
+                (unsigned long)processor_ns_from_cycles(cycles)
+        );
+}
+
+static void show_results(char const *name) {
+        console_printf("%s: ", name);
+        if (s_bench.sample_count == 0) {
+                console_put_string("no samples\n");
+                return;
+        }
+        sort_samples(s_bench.samples, s_bench.sample_count);
+        console_printf(
+                "%u samples, cycles(ns)\n", (unsigned)s_bench.sample_count
+        );
+        show_percentile("min", 0);
+        show_percentile("p50", 500);
+        show_percentile("p90", 900);
+        show_percentile("p99", 990);
+        show_percentile("p99.9", 999);
+        show_percentile("max", 1000);
+        console_put_string("\n");
+}
+
+// Returns false if the benchmark couldn't be run.
+static bool bench_yield_pingpong(size_t processor) {
+        reset_bench();
+        struct Thread *first =
+                create_thread("bench-yield", run_yield_pingpong, processor);
+        struct Thread *second =
+                create_thread("bench-yield", run_yield_pingpong, processor);
+        if (!start_threads(first, second)) {
+                return false;
+        }
+        wait_for_threads(2);
+        show_results("Same-CPU yield ping-pong");
+        return true;
+}
+
+// Returns false if the benchmark couldn't be run.
+static bool
+bench_cross_cpu_wakeup(size_t sleeper_processor, size_t waker_processor) {
+        reset_bench();
+        s_bench.sleeper = create_thread(
+                "bench-sleeper", run_wakeup_sleeper, sleeper_processor
+        );
+        struct Thread *waker =
+                create_thread("bench-waker", run_wakeup_waker, waker_processor);
+        if (!start_threads(s_bench.sleeper, waker)) {
+                return false;
+        }
+        wait_for_threads(2);
+        show_results("Cross-CPU wakeup");
+        return true;
+}
+
+// Returns false if the benchmark couldn't be run.
+static bool
+bench_mutex_handoff(size_t owner_processor, size_t waiter_processor) {
+        reset_bench();
+        s_bench.mutex = mutex_new();
+        if (!s_bench.mutex) {
+                console_alert("Not enough memory");
+                return false;
+        }
+        s_bench.sleeper = create_thread(
+                "bench-waiter", run_mutex_waiter, waiter_processor
+        );
+        struct Thread *owner =
+                create_thread("bench-owner", run_mutex_owner, owner_processor);
+        bool started = start_threads(s_bench.sleeper, owner);
+        if (started) {
+                wait_for_threads(2);
+                show_results("Mutex handoff");
+        }
+        kfree(s_bench.mutex);
+        s_bench.mutex = NULL;
+        return started;
+}
+
+static void cmd_main(char *arg_str) {
+        unsigned iterations = DEFAULT_ITERATIONS;
+        if (*arg_str != '\0') {
+                if (!cliarg_next_unsigned(&iterations, &arg_str) ||
+                    (iterations == 0) || (MAX_ITERATIONS < iterations)) {
+                        console_alert("Bad arguments");
+                        return;
+                }
+        }
+        s_bench.iterations = iterations;
+        s_bench.samples = kmalloc(sizeof(*s_bench.samples) * iterations);
+        if (!s_bench.samples) {
+                console_alert("Not enough memory");
+                return;
+        }
+        // Last processors are likely to be the least busy ones.
+        size_t count = processor_count();
+        size_t processor = count - 1;
+        size_t other_processor = (1 < count) ? (count - 2) : processor;
+        if (!bench_yield_pingpong(processor)) {
+                goto out;
+        }
+        if (1 < count) {
+                if (!bench_cross_cpu_wakeup(processor, other_processor)) {
+                        goto out;
+                }
+        } else {
+                console_put_string("Cross-CPU wakeup: needs 2 processors\n");
+        }
+        bench_mutex_handoff(other_processor, processor);
+out:
+        kfree(s_bench.samples);
+        s_bench.samples = NULL;
+}
+
+static const struct CliCmd_ArgHelp ARG_HELP[] = {
+        {
+                .name = "(<iterations>)",
+                .help = "(Optional) Samples taken for each benchmark. "
+                        "Defaults to 1000.",
+        },
+        {0, 0},
+};
+
+const struct CliCmd_Descriptor CLICMD_SCHEDBENCH = {
+        .name = "schedbench",
+        .fn = cmd_main,
+        .description = "Measures context switch, wakeup and mutex handoff "
+                       "latencies",
+        .args_help = ARG_HELP,
+};
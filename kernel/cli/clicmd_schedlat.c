@@ -0,0 +1,120 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "cliarg.h"
+#include "clicmd.h"
+#include "kernel/arch/arch.h"
+#include "kernel/heap/heap.h"
+#include "kernel/kernel.h"
+#include "kernel/tasks/tasks.h"
+#include "kernel/utility/utility.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OPTION_MAX_LEN 15
+
+static void show_duration(uint64_t ns) {
+        if (ns < 10000ULL) {
+                console_printf("%uns", (unsigned)ns);
+        } else if (ns < 10000000ULL) {
+                console_printf("%uus", (unsigned)(ns / 1000ULL));
+        } else if (ns < 10000000000ULL) {
+                console_printf("%ums", (unsigned)(ns / 1000000ULL));
+        } else {
+                console_printf("%us", (unsigned)(ns / 1000000000ULL));
+        }
+}
+
+static void show_histogram(struct SchedLatency_Stats const *stats) {
+        console_printf(" LATENCY WAKEUPS PREEMPTED\n");
+        for (unsigned i = 0; i < SCHEDLATENCY_BUCKET_COUNT; ++i) {
+                uint64_t wakeup_count = stats->wakeup_counts[i];
+                uint64_t preempted_count = stats->preempted_counts[i];
+                if ((wakeup_count == 0) && (preempted_count == 0)) {
+                        continue;
+                }
+                console_put_string(" ");
+                if (i == 0) {
+                        console_put_string("0");
+                } else {
+                        show_duration(1ULL << i);
+                }
+                console_put_string("~");
+                if (i != SCHEDLATENCY_BUCKET_COUNT - 1) {
+                        show_duration(1ULL << (i + 1));
+                }
+                console_printf(
+                        " %lu %lu\n",
+                        (unsigned long)wakeup_count,
+                        (unsigned long)preempted_count
+                );
+        }
+}
+
+static void show_worst(struct SchedLatency_Stats const *stats) {
+        console_printf(" WORST LATENCIES:\n");
+        for (unsigned i = 0; i < SCHEDLATENCY_WORST_COUNT; ++i) {
+                struct SchedLatency_Record const *record = &stats->worst[i];
+                if (record->latency_ns == 0) {
+                        break;
+                }
+                console_put_string("  ");
+                show_duration(record->latency_ns);
+                console_printf(
+                        " %s thread %u(%s) after thread %u(%s), at ",
+                        record->is_wakeup ? "woken up" : "preempted",
+                        (unsigned)record->tid,
+                        record->name,
+                        (unsigned)record->preempting_tid,
+                        record->preempting_name
+                );
+                show_duration(record->at_ns);
+                console_put_string("\n");
+        }
+}
+
+static void show_stats(void) {
+        struct SchedLatency_Stats *stats = kmalloc(sizeof(*stats));
+        if (!stats) {
+                console_alert("Not enough memory");
+                return;
+        }
+        size_t count = processor_count();
+        for (size_t i = 0; i < count; ++i) {
+                if (!schedlatency_get(i, stats)) {
+                        continue;
+                }
+                console_printf("CPU %u:\n", (unsigned)i);
+                show_histogram(stats);
+                show_worst(stats);
+        }
+        kfree(stats);
+}
+
+static void cmd_main(char *arg_str) {
+        char option[OPTION_MAX_LEN + 1];
+        if (cliarg_next_str(option, sizeof(option), &arg_str) <= 0) {
+                show_stats();
+        } else if (str_equals(option, "reset")) {
+                schedlatency_reset();
+        } else {
+                console_alert("Bad arguments");
+        }
+}
+
+static const struct CliCmd_ArgHelp ARG_HELP[] = {
+        {
+                .name = "(reset)",
+                .help = "(Optional) If specified, clears the statistics. "
+                        "Otherwise, they are displayed.",
+        },
+        {0, 0},
+};
+
+const struct CliCmd_Descriptor CLICMD_SCHEDLAT = {
+        .name = "schedlat",
+        .fn = cmd_main,
+        .description = "Shows how long runnable threads waited for processors",
+        .args_help = ARG_HELP,
+};
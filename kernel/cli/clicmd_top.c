@@ -0,0 +1,258 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "cliarg.h"
+#include "clicmd.h"
+#include "kernel/arch/arch.h"
+#include "kernel/heap/heap.h"
+#include "kernel/kernel.h"
+#include "kernel/tasks/tasks.h"
+#include "kernel/utility/utility.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEFAULT_INTERVAL_MS 1000
+// Threads beyond this are left out.
+#define MAX_SAMPLES 128
+// How often we look for a key press while waiting for next refresh.
+#define KEY_POLL_INTERVAL_NS (50 * 1000000ULL)
+
+struct Sample {
+        pid_t pid;
+        tid_t tid;
+        char const *state;
+        struct Thread_Accounting accounting;
+        // Per-mille of the interval the thread spent running.
+        unsigned cpu_permille;
+        char name[THREAD_NAME_MAX_LEN + 1];
+};
+
+struct Snapshot {
+        struct Sample *samples;
+        size_t count;
+        // processor_cycles() when the snapshot was taken.
+        uint64_t cycles;
+};
+
+struct CollectContext {
+        struct Snapshot *snapshot;
+        pid_t pid;
+};
+
+static bool is_running(struct Thread *thread) {
+        size_t count = processor_count();
+        for (size_t i = 0; i < count; ++i) {
+                if (processor_running_thread(processor_at(i)) == thread) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+// Scheduler state is read without locking, so this is only a hint.
+static char const *state_of(struct Thread *thread) {
+        struct Thread_SchedState const *state = thread_get_sched_state(thread);
+        if (is_running(thread)) {
+                return "run  ";
+        }
+        if (state->is_queued) {
+                return "ready";
+        }
+        if (state->is_sleeping) {
+                return "sleep";
+        }
+        return "new  ";
+}
+
+static void collect_thread(struct Thread *thread, void *data) {
+        struct CollectContext *context = data;
+        struct Snapshot *snapshot = context->snapshot;
+        if (MAX_SAMPLES <= snapshot->count) {
+                return;
+        }
+        struct Sample *sample = &snapshot->samples[snapshot->count];
+        ++snapshot->count;
+        sample->pid = context->pid;
+        sample->tid = thread_get_id(thread);
+        sample->state = state_of(thread);
+        sample->cpu_permille = 0;
+        str_copy(sample->name, sizeof(sample->name), thread_get_name(thread));
+        thread_get_accounting(thread, &sample->accounting);
+}
+
+static void collect_process(struct Process *process, void *data) {
+        struct CollectContext context = {
+                .snapshot = data,
+                .pid = process_get_id(process),
+        };
+        process_for_each_thread(process, collect_thread, &context);
+}
+
+static void take_snapshot(struct Snapshot *out) {
+        out->count = 0;
+        process_for_each(collect_process, out);
+        ENTER_NO_INTERRUPT_SECTION();
+        out->cycles = processor_cycles();
+        LEAVE_NO_INTERRUPT_SECTION();
+}
+
+static uint64_t busy_cycles_of(struct Sample const *sample) {
+        return sample->accounting.user_cycles +
+               sample->accounting.kernel_cycles;
+}
+
+// Returns NULL if the thread wasn't there in the previous snapshot.
+static struct Sample const *
+find_sample(struct Snapshot const *snapshot, pid_t pid, tid_t tid) {
+        for (size_t i = 0; i < snapshot->count; ++i) {
+                struct Sample const *sample = &snapshot->samples[i];
+                if ((sample->pid == pid) && (sample->tid == tid)) {
+                        return sample;
+                }
+        }
+        return NULL;
+}
+
+static void calculate_cpu_usage(
+        struct Snapshot *current, struct Snapshot const *previous
+) {
+        uint64_t elapsed = current->cycles - previous->cycles;
+        if (elapsed == 0) {
+                return;
+        }
+        for (size_t i = 0; i < current->count; ++i) {
+                struct Sample *sample = &current->samples[i];
+                struct Sample const *prev_sample =
+                        find_sample(previous, sample->pid, sample->tid);
+                uint64_t busy = busy_cycles_of(sample);
+                uint64_t prev_busy = 0;
+                if (prev_sample) {
+                        prev_busy = busy_cycles_of(prev_sample);
+                }
+                // Snapshots of running threads may be slightly off.
+                busy = (prev_busy < busy) ? (busy - prev_busy) : 0;
+                uint64_t permille = busy * 1000 / elapsed;
+                if (1000 < permille) {
+                        permille = 1000;
+                }
+                sample->cpu_permille = permille;
+        }
+}
+
+static unsigned ms_from_cycles(uint64_t cycles) {
+        return processor_ns_from_cycles(cycles) / 1000000;
+}
+
+static void show_sample(struct Sample const *sample) {
+        struct Thread_Accounting const *accounting = &sample->accounting;
+        console_printf(
+                "%u %u %u.%u %s cpu%u %ums/%ums wait %ums switches %u/%u ",
+                (unsigned)sample->pid,
+                (unsigned)sample->tid,
+                sample->cpu_permille / 10,
+                sample->cpu_permille % 10,
+                sample->state,
+                (unsigned)accounting->last_processor,
+                ms_from_cycles(accounting->user_cycles),
+                ms_from_cycles(accounting->kernel_cycles),
+                ms_from_cycles(accounting->wait_cycles),
+                (unsigned)accounting->voluntary_switches,
+                (unsigned)accounting->involuntary_switches
+        );
+        console_put_string(sample->name);
+        console_put_string("\n");
+}
+
+static void show_snapshot(struct Snapshot *snapshot) {
+        // Busiest threads first.
+        for (size_t i = 1; i < snapshot->count; ++i) {
+                struct Sample sample = snapshot->samples[i];
+                size_t j = i;
+                for (; (0 < j) && (snapshot->samples[j - 1].cpu_permille <
+                                   sample.cpu_permille);
+                     --j) {
+                        snapshot->samples[j] = snapshot->samples[j - 1];
+                }
+                snapshot->samples[j] = sample;
+        }
+        console_put_string(
+                "PID TID CPU% STATE LAST-CPU USER/KERNEL WAIT "
+                "SWITCHES(VOLUNTARY/INVOLUNTARY) NAME\n"
+        );
+        for (size_t i = 0; i < snapshot->count; ++i) {
+                show_sample(&snapshot->samples[i]);
+        }
+        console_put_string("(Press any key to stop)\n\n");
+}
+
+// Returns true if a key was pressed meanwhile.
+static bool wait_for_next_refresh(unsigned interval_ms) {
+        uint64_t deadline =
+                clock_monotonic_ns() + (uint64_t)interval_ms * 1000000;
+        while (1) {
+                if (console_get_char() != -1) {
+                        return true;
+                }
+                uint64_t now = clock_monotonic_ns();
+                if (deadline <= now) {
+                        return false;
+                }
+                uint64_t remaining = deadline - now;
+                if (KEY_POLL_INTERVAL_NS < remaining) {
+                        remaining = KEY_POLL_INTERVAL_NS;
+                }
+                timer_sleep(remaining);
+        }
+}
+
+static void cmd_main(char *arg_str) {
+        unsigned interval_ms = DEFAULT_INTERVAL_MS;
+        if (*arg_str != '\0') {
+                if (!cliarg_next_unsigned(&interval_ms, &arg_str) ||
+                    (interval_ms == 0)) {
+                        console_alert("Bad arguments");
+                        return;
+                }
+        }
+        struct Snapshot snapshots[2] = {0};
+        for (unsigned i = 0; i < 2; ++i) {
+                snapshots[i].samples =
+                        kmalloc(sizeof(struct Sample) * MAX_SAMPLES);
+                if (!snapshots[i].samples) {
+                        console_alert("Not enough memory");
+                        goto out;
+                }
+        }
+        struct Snapshot *previous = &snapshots[0];
+        struct Snapshot *current = &snapshots[1];
+        take_snapshot(previous);
+        while (!wait_for_next_refresh(interval_ms)) {
+                take_snapshot(current);
+                calculate_cpu_usage(current, previous);
+                show_snapshot(current);
+                struct Snapshot *temp = previous;
+                previous = current;
+                current = temp;
+        }
+out:
+        for (unsigned i = 0; i < 2; ++i) {
+                kfree(snapshots[i].samples);
+        }
+}
+
+static const struct CliCmd_ArgHelp ARG_HELP[] = {
+        {
+                .name = "(<interval>)",
+                .help = "(Optional) Refresh interval in milliseconds. "
+                        "Defaults to 1000.",
+        },
+        {0, 0},
+};
+
+const struct CliCmd_Descriptor CLICMD_TOP = {
+        .name = "top",
+        .fn = cmd_main,
+        .description = "Shows CPU usage of threads until a key is pressed",
+        .args_help = ARG_HELP,
+};
@@ -0,0 +1,55 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "clicmd.h"
+#include "kernel/kernel.h"
+#include "kernel/tasks/tasks.h"
+#include "kernel/utility/utility.h"
+#include <stddef.h>
+
+static void show_process(struct Process *process, void *data) {
+        (void)data;
+        if (process_is_kernel(process)) {
+                return;
+        }
+        struct Proc_WorkingSet working_set;
+        process_get_working_set(process, &working_set);
+        console_printf("%u ", (unsigned)process_get_id(process));
+        console_put_string_with_pad(
+                process_get_name(process), PROC_NAME_MAX_LEN
+        );
+        if (working_set.scan_count == 0) {
+                console_printf(" (Not scanned yet)\n");
+                return;
+        }
+        console_printf(
+                " resident %u pages, dirty %u pages, hot",
+                (unsigned)working_set.resident_page_count,
+                (unsigned)working_set.dirty_page_count
+        );
+        for (unsigned i = 0; i < PROC_WORKINGSET_WINDOW_COUNT; ++i) {
+                console_printf(
+                        " %u(%u scans)",
+                        (unsigned)working_set.hot_page_counts[i],
+                        working_set.window_scan_counts[i]
+                );
+        }
+        console_printf("\n");
+}
+
+static void cmd_main(char *arg_str) {
+        (void)arg_str;
+        console_printf("PID NAME / WORKING SET\n");
+        process_for_each(show_process, NULL);
+}
+
+static const struct CliCmd_ArgHelp ARG_HELP[] = {
+        {0, 0},
+};
+
+const struct CliCmd_Descriptor CLICMD_WSS = {
+        .name = "wss",
+        .fn = cmd_main,
+        .description = "Shows working set size of user processes",
+        .args_help = ARG_HELP,
+};
@@ -103,15 +103,16 @@ int console_get_char(void) {
         return -1;
 }
 
+// Console drivers can't tell us when input arrives, so we check for it this
+// often.
+#define WAIT_CHAR_POLL_INTERVAL_NS (10 * TICKTIME_NS_PER_TICK)
+
 int console_wait_char(void) {
-        bool prev_interrupt_state = interrupts_enable();
         int chr;
         while ((chr = console_get_char()) == -1) {
-                interrupts_wait();
-                scheduler_yield();
-        }
-        if (!prev_interrupt_state) {
-                interrupts_disable();
+                timer_sleep_until(
+                        clock_monotonic_ns() + WAIT_CHAR_POLL_INTERVAL_NS, false
+                );
         }
         return chr;
 }
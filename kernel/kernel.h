@@ -78,10 +78,24 @@ NORETURN void panic_assert_fail(char const *file, int line, char const *what);
 
 typedef uint64_t tick_t;
 
+#define TICKTIME_NS_PER_TICK 1000000ULL
+
 // NOTE: This temporaily locks scheduler, threads, and procs.
 void ticktime_increment_tick();
+// Same as above, but for timer interrupt that covers multiple ticks.
+void ticktime_on_timer_interrupt(tick_t elapsed_ticks);
+// Derived from clock_monotonic_ns().
 tick_t ticktime_get_count();
 
+////////////////////////////////////////////////////////////////////////////////
+// Clock
+////////////////////////////////////////////////////////////////////////////////
+
+// Nanoseconds that never go backwards, and are the same on every processor.
+// It only has tick resolution until the processor clock is calibrated during
+// boot.
+uint64_t clock_monotonic_ns();
+
 ////////////////////////////////////////////////////////////////////////////////
 // Video console
 ////////////////////////////////////////////////////////////////////////////////
@@ -13,6 +13,10 @@ struct Mutex {
         struct AVLTree_Node node_head;
         bool locked;
         struct Thread *lock_owner;
+        // Waiting threads in FIFO order. Unlocking and adding waiters is
+        // done while holding waiters_lock, so waiters are never missed.
+        struct List waiters;
+        struct SpinLock waiters_lock;
 };
 
 struct Mutex *mutex_new() {
@@ -20,6 +24,7 @@ struct Mutex *mutex_new() {
         if (!mutex) {
                 TODO_HANDLE_ERROR();
         }
+        kmemset(mutex, 0, sizeof(*mutex));
         mutex->locked = false;
         mutex->lock_owner = NULL;
         return mutex;
@@ -49,6 +54,18 @@ bool mutex_try_lock_with_owner(struct Mutex *mutex, struct Thread *lock_owner) {
         return result;
 }
 
+bool mutex_add_waiter(struct Mutex *mutex, struct Mutex_Waiter *waiter) {
+        bool prev_interrupt_state;
+        spinlock_lock(&mutex->waiters_lock, &prev_interrupt_state);
+        bool added = !mutex_try_lock_with_owner(mutex, waiter->thread);
+        if (added) {
+                waiter->node_head = (struct List_Node){0};
+                list_insert_tail(&mutex->waiters, &waiter->node_head);
+        }
+        spinlock_unlock(&mutex->waiters_lock, prev_interrupt_state);
+        return added;
+}
+
 void mutex_lock(struct Mutex *mutex) {
         if (mutex_try_lock(mutex)) {
                 return;
@@ -68,8 +85,20 @@ void mutex_unlock(struct Mutex *mutex) {
                       mutex->lock_owner,
                       thread_running());
         }
-        mutex->lock_owner = NULL;
-        __atomic_store_n(&mutex->locked, false, __ATOMIC_RELEASE);
+        bool prev_interrupt_state;
+        spinlock_lock(&mutex->waiters_lock, &prev_interrupt_state);
+        struct Mutex_Waiter *waiter = mutex->waiters.head;
+        if (!waiter) {
+                mutex->lock_owner = NULL;
+                __atomic_store_n(&mutex->locked, false, __ATOMIC_RELEASE);
+                spinlock_unlock(&mutex->waiters_lock, prev_interrupt_state);
+                return;
+        }
+        // Mutex stays locked, and goes straight to the first waiter.
+        list_remove(&mutex->waiters, &waiter->node_head);
+        mutex->lock_owner = waiter->thread;
+        spinlock_unlock(&mutex->waiters_lock, prev_interrupt_state);
+        scheduler_wakeup_mutex_waiter(waiter);
 }
 
 bool mutex_is_locked(struct Mutex const *mutex) { return mutex->locked; }
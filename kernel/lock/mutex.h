@@ -4,12 +4,28 @@
 #pragma once
 #include "kernel/lock/spinlock.h"
 
+
 struct Thread;
+struct Scheduler_RunQueue;
+
+// Thread waiting for a mutex. This lives on the waiting thread's stack.
+struct Mutex_Waiter {
+        struct List_Node node_head;
+        struct Thread *thread;
+        // Run queue the thread is sleeping on.
+        struct Scheduler_RunQueue *run_queue;
+};
 
 struct Mutex *mutex_new();
 bool mutex_try_lock(struct Mutex *mutex);
-// Below is only designed to be used with Scheduler.
+// Below are only designed to be used with Scheduler.
 bool mutex_try_lock_with_owner(struct Mutex *mutex, struct Thread *lock_owner);
+// Adds waiter at the end of the mutex's wait queue, and mutex_unlock() will
+// hand the mutex over to it. If the mutex is not locked, it is locked for the
+// waiter instead.
+//
+// Returns false if the mutex was locked for the waiter.
+WARN_UNUSED_RESULT bool mutex_add_waiter(struct Mutex *mutex, struct Mutex_Waiter *waiter);
 void mutex_lock(struct Mutex *mutex);
 void mutex_unlock(struct Mutex *mutex);
 bool mutex_is_locked(struct Mutex const *mutex);
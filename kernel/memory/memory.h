@@ -26,13 +26,33 @@ struct PhysPage_Descriptor {
 WARN_UNUSED_RESULT struct PhysPage_Addr physpage_alloc(size_t count);
 void physpage_free(struct PhysPage_Addr addr, size_t count);
 void physpage_register(struct PhysPage_Descriptor const *descriptor);
+// Adds a reference to a single page. Newly allocated pages have one reference.
+//
+// Returns false on OOM, in which case nothing is changed.
+WARN_UNUSED_RESULT bool physpage_ref(struct PhysPage_Addr addr);
+// Drops a reference if someone else is also referencing the page.
+//
+// Returns false if the caller holds the only reference, in which case nothing
+// is changed and the caller is free to reuse or free the page.
+WARN_UNUSED_RESULT bool physpage_unref_if_shared(struct PhysPage_Addr addr);
+bool physpage_is_shared(struct PhysPage_Addr addr);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Virtual address management
 ////////////////////////////////////////////////////////////////////////////////
 
+// Region whose virtual addresses are reserved, but physical pages are only
+// allocated when each page is accessed for the first time.
+struct VirtZone_LazyRegion {
+        struct AVLTree_Node node_head; // Key is the base address
+        size_t page_count;
+        mmu_prot_t prot;
+};
+
 struct VirtZone {
         struct AVLTree free_page_list_for_size_tree;
+        struct AVLTree free_region_addr_tree;
+        struct AVLTree lazy_region_tree;
 };
 
 // Returns NULL if allocation fails.
@@ -43,7 +63,29 @@ WARN_UNUSED_RESULT bool virtzone_alloc_region_at(
         struct VirtZone *zone, void *virtbase, size_t page_count
 );
 void virtzone_free_region(struct VirtZone *zone, void *base, size_t page_count);
+// Returns false on OOM.
+WARN_UNUSED_RESULT bool virtzone_add_lazy_region(
+        struct VirtZone *zone, void *base, size_t page_count, mmu_prot_t prot
+);
+// Returns NULL if `addr` doesn't belong to any lazy region.
+struct VirtZone_LazyRegion *
+virtzone_find_lazy_region(struct VirtZone *zone, void *addr);
+void virtzone_remove_lazy_region(
+        struct VirtZone *zone, struct VirtZone_LazyRegion *region
+);
+// Removes given range from the `region`, splitting it if the range is in the
+// middle.
+//
+// Returns false on OOM.
+WARN_UNUSED_RESULT bool virtzone_remove_lazy_range(
+        struct VirtZone *zone,
+        struct VirtZone_LazyRegion *region,
+        void *base,
+        size_t page_count
+);
 void virtzone_init(
         struct VirtZone *out, uintptr_t begin_addr, uintptr_t end_addr
 );
+// Returns false on OOM.
+WARN_UNUSED_RESULT bool virtzone_clone(struct VirtZone *out, struct VirtZone *src);
 void virtzone_deinit(struct VirtZone *zone);
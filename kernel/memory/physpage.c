@@ -18,7 +18,15 @@ struct PageGroup {
         struct PhysZone physzone;
 };
 
+// Pages that are referenced more than once(e.g. shared between parent and
+// child process after fork). Pages not found here have exactly one reference.
+struct SharedPage {
+        struct AVLTree_Node node_head; // Key is the physical address
+        size_t extra_ref_count;
+};
+
 static struct List s_group_list;
+static struct AVLTree s_shared_page_tree;
 static struct SpinLock s_lock;
 
 // TODO: Get rid of `what` parameter.
@@ -76,6 +84,54 @@ void physpage_free(struct PhysPage_Addr addr, size_t count) {
         spinlock_unlock(&s_lock, prev_interrupt_state);
 }
 
+bool physpage_ref(struct PhysPage_Addr addr) {
+        ASSERT(is_aligned(PAGE_SIZE, addr.value));
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        struct SharedPage *page =
+                avltree_search(&s_shared_page_tree, addr.value);
+        if (!page) {
+                page = kmalloc(sizeof(*page));
+                if (!page) {
+                        goto out;
+                }
+                kmemset(page, 0, sizeof(*page));
+                avltree_insert(
+                        &s_shared_page_tree, &page->node_head, addr.value
+                );
+        }
+        ++page->extra_ref_count;
+out:
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+        return page != NULL;
+}
+
+bool physpage_unref_if_shared(struct PhysPage_Addr addr) {
+        ASSERT(is_aligned(PAGE_SIZE, addr.value));
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        struct SharedPage *page =
+                avltree_search(&s_shared_page_tree, addr.value);
+        if (page) {
+                --page->extra_ref_count;
+                if (page->extra_ref_count == 0) {
+                        avltree_remove(&s_shared_page_tree, &page->node_head);
+                        kfree(page);
+                }
+        }
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+        return page != NULL;
+}
+
+bool physpage_is_shared(struct PhysPage_Addr addr) {
+        ASSERT(is_aligned(PAGE_SIZE, addr.value));
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        bool result = avltree_search(&s_shared_page_tree, addr.value) != NULL;
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+        return result;
+}
+
 void physpage_register(struct PhysPage_Descriptor const *descriptor) {
         ASSERT(is_aligned(PAGE_SIZE, descriptor->base));
         ASSERT(descriptor->base != 0);
@@ -14,6 +14,8 @@ static char const *LOG_TAG = "virtzone";
 
 struct FreeRegion {
         struct List_Node node_head;
+        // Node for VirtZone's address tree. Key is `begin_addr`.
+        struct AVLTree_Node addr_node;
         uintptr_t begin_addr;
         uintptr_t end_addr;
 };
@@ -23,93 +25,100 @@ struct FreeRegionsForSize {
         struct List free_region_list;
 };
 
-// Finds and returns first region that is larger than given `page_count`.
+static struct FreeRegion *region_of_addr_node(struct AVLTree_Node *node) {
+        if (!node) {
+                return NULL;
+        }
+        return (struct FreeRegion *)((uintptr_t)node -
+                                     offsetof(struct FreeRegion, addr_node));
+}
+
+static size_t page_count_of(struct FreeRegion const *region) {
+        ASSERT(is_aligned(PAGE_SIZE, region->end_addr - region->begin_addr));
+        return (region->end_addr - region->begin_addr) / PAGE_SIZE;
+}
+
+static void add_free_region(struct VirtZone *zone, struct FreeRegion *region) {
+        size_t page_count = page_count_of(region);
+        struct FreeRegionsForSize *regions =
+                avltree_search(&zone->free_page_list_for_size_tree, page_count);
+        if (!regions) {
+                regions = kmalloc(sizeof(*regions));
+                if (!regions) {
+                        panic("Not enough kmalloc memory to create new free "
+                              "region");
+                }
+                kmemset(regions, 0, sizeof(*regions));
+                avltree_insert(
+                        &zone->free_page_list_for_size_tree,
+                        &regions->node_head,
+                        page_count
+                );
+        }
+        list_insert_tail(&regions->free_region_list, &region->node_head);
+        kmemset(&region->addr_node, 0, sizeof(region->addr_node));
+        avltree_insert(
+                &zone->free_region_addr_tree,
+                &region->addr_node,
+                region->begin_addr
+        );
+}
+
+static void
+remove_free_region(struct VirtZone *zone, struct FreeRegion *region) {
+        struct FreeRegionsForSize *regions = avltree_search(
+                &zone->free_page_list_for_size_tree, page_count_of(region)
+        );
+        ASSERT(regions);
+        list_remove(&regions->free_region_list, &region->node_head);
+        if (!regions->free_region_list.head) {
+                avltree_remove(
+                        &zone->free_page_list_for_size_tree,
+                        &regions->node_head
+                );
+                kfree(regions);
+        }
+        avltree_remove(&zone->free_region_addr_tree, &region->addr_node);
+}
+
+// Finds and takes the smallest region that can hold given `page_count`.
 //
 // Returns NULL if free region cannot be found.
 static struct FreeRegion *
 find_and_take_free_region(struct VirtZone *zone, size_t page_count) {
         ASSERT(page_count != 0);
-        if (!zone->free_page_list_for_size_tree.root) {
+        struct FreeRegionsForSize *regions = avltree_search_ceil(
+                &zone->free_page_list_for_size_tree, page_count
+        );
+        if (!regions) {
                 return NULL;
         }
-        for (struct FreeRegionsForSize *current = avltree_min_node(
-                     (struct AVLTree_Node *)
-                             zone->free_page_list_for_size_tree.root
-             );
-             current;
-             current = avltree_successor_of(&current->node_head)) {
-                size_t current_page_count = current->node_head.key;
-                if (current_page_count < page_count) {
-                        continue;
-                }
-                struct FreeRegion *region =
-                        (struct FreeRegion *)current->free_region_list.head;
-                list_remove_head(&current->free_region_list);
-                if (region) {
-                        if (!current->free_region_list.head) {
-                                avltree_remove(
-                                        &zone->free_page_list_for_size_tree,
-                                        &current->node_head
-                                );
-                                kfree(current);
-                        }
-                        return region;
-                }
-        }
-        return NULL;
+        struct FreeRegion *region = regions->free_region_list.head;
+        ASSERT(region);
+        remove_free_region(zone, region);
+        return region;
 }
 
-// Finds any first region that includes given range.
+// Finds and takes the region that includes given range.
 //
 // Returns NULL if region cannot be found or it is not large enough.
 static struct FreeRegion *take_free_region_including(
         struct VirtZone *zone, uintptr_t addr, size_t page_count
 ) {
         ASSERT(page_count != 0);
-        ASSERT(zone->free_page_list_for_size_tree.root);
-        for (struct FreeRegionsForSize *current = avltree_min_node(
-                     (struct AVLTree_Node *)
-                             zone->free_page_list_for_size_tree.root
-             );
-             current;
-             current = avltree_successor_of(&current->node_head)) {
-                size_t current_page_count = current->node_head.key;
-                if (current_page_count < page_count) {
-                        continue;
-                }
-                struct FreeRegion *result_region;
-                for (result_region = (struct FreeRegion *)
-                                             current->free_region_list.head;
-                     result_region;
-                     result_region = result_region->node_head.next) {
-                        if (addr < result_region->begin_addr ||
-                            result_region->end_addr <= addr) {
-                                continue;
-                        }
-                        if (result_region->end_addr <
-                            addr + page_count * PAGE_SIZE) {
-                                // The region includes given address, but there
-                                // are not enough pages to map.
-                                return NULL;
-                        }
-                        break;
-                }
-                if (result_region) {
-                        list_remove(
-                                &current->free_region_list,
-                                &result_region->node_head
-                        );
-                        if (!current->free_region_list.head) {
-                                avltree_remove(
-                                        &zone->free_page_list_for_size_tree,
-                                        &current->node_head
-                                );
-                                kfree(current);
-                        }
-                        return result_region;
-                }
+        struct FreeRegion *region = region_of_addr_node(
+                avltree_search_floor(&zone->free_region_addr_tree, addr)
+        );
+        if (!region || region->end_addr <= addr) {
+                return NULL;
         }
-        return NULL;
+        if (region->end_addr < addr + page_count * PAGE_SIZE) {
+                // The region includes given address, but there are not enough
+                // pages to map.
+                return NULL;
+        }
+        remove_free_region(zone, region);
+        return region;
 }
 
 static struct FreeRegion *
@@ -124,47 +133,6 @@ make_free_region(uintptr_t begin_addr, uintptr_t end_addr) {
         return region;
 }
 
-struct AVLTree;
-void avltree_insert2(
-        struct AVLTree *tree, struct AVLTree_Node *node, avltree_key_t key
-);
-
-static void add_free_region(struct VirtZone *zone, struct FreeRegion *region) {
-        ASSERT(is_aligned(PAGE_SIZE, region->end_addr - region->begin_addr));
-        size_t page_count = (region->end_addr - region->begin_addr) / PAGE_SIZE;
-        struct FreeRegionsForSize *regions =
-                avltree_search(&zone->free_page_list_for_size_tree, page_count);
-        if (!regions) {
-                regions = kmalloc(sizeof(*regions));
-                if (!regions) {
-                        panic("Not enough kmalloc memory to create new free "
-                              "region");
-                }
-                kmemset(regions, 0, sizeof(*regions));
-                avltree_insert(
-                        &zone->free_page_list_for_size_tree,
-                        &regions->node_head,
-                        page_count
-                );
-        }
-        list_insert_tail(&regions->free_region_list, &region->node_head);
-}
-
-static void free_regions_tree(struct FreeRegionsForSize *regions_root) {
-        for (int i = 0; i < 2; ++i) {
-                struct FreeRegionsForSize *child =
-                        regions_root->node_head.children[i];
-                if (child) {
-                        free_regions_tree(child);
-                }
-        }
-        if (regions_root->free_region_list.head) {
-                list_remove_head(&regions_root->free_region_list);
-                kfree(regions_root->free_region_list.head);
-        }
-        kfree(regions_root);
-}
-
 void *virtzone_alloc_region(struct VirtZone *zone, size_t page_count) {
         ASSERT(page_count);
         // `region` contains region that includes region we are about to use and
@@ -242,7 +210,8 @@ fail:
                 kfree(right_region);
         }
         if (left_region) {
-                kfree(left_region);
+                // Put it back, or we'd lose the whole region.
+                add_free_region(zone, left_region);
         }
         return false;
 }
@@ -252,15 +221,116 @@ void virtzone_free_region(
 ) {
         ASSERT(base != 0);
         ASSERT(page_count != 0);
-        struct FreeRegion *region = make_free_region(
-                (uintptr_t)base, (uintptr_t)base + page_count * PAGE_SIZE
+        uintptr_t begin_addr = (uintptr_t)base;
+        uintptr_t end_addr = begin_addr + page_count * PAGE_SIZE;
+        // Merge with neighbors, so that the address space doesn't keep getting
+        // fragmented.
+        struct FreeRegion *left = region_of_addr_node(
+                avltree_search_floor(&zone->free_region_addr_tree, begin_addr)
         );
-        if (!region) {
-                panic("Not enough kmalloc memory for new free region");
+        if (left) {
+                ASSERT(left->end_addr <= begin_addr);
+                if (left->end_addr != begin_addr) {
+                        left = NULL;
+                }
+        }
+        struct FreeRegion *right = region_of_addr_node(
+                avltree_search(&zone->free_region_addr_tree, end_addr)
+        );
+        struct FreeRegion *region;
+        if (left) {
+                remove_free_region(zone, left);
+                region = left;
+                region->end_addr = end_addr;
+        } else {
+                region = make_free_region(begin_addr, end_addr);
+                if (!region) {
+                        panic("Not enough kmalloc memory for new free region");
+                }
+        }
+        if (right) {
+                remove_free_region(zone, right);
+                region->end_addr = right->end_addr;
+                kfree(right);
         }
         add_free_region(zone, region);
 }
 
+bool virtzone_add_lazy_region(
+        struct VirtZone *zone, void *base, size_t page_count, mmu_prot_t prot
+) {
+        ASSERT(base != 0);
+        ASSERT(is_aligned(PAGE_SIZE, (uintptr_t)base));
+        ASSERT(page_count != 0);
+        struct VirtZone_LazyRegion *region = kmalloc(sizeof(*region));
+        if (!region) {
+                LOGE(LOG_TAG, "Not enough kmalloc memory for LazyRegion");
+                return false;
+        }
+        kmemset(region, 0, sizeof(*region));
+        region->page_count = page_count;
+        region->prot = prot;
+        avltree_insert(
+                &zone->lazy_region_tree, &region->node_head, (uintptr_t)base
+        );
+        return true;
+}
+
+struct VirtZone_LazyRegion *
+virtzone_find_lazy_region(struct VirtZone *zone, void *addr) {
+        struct VirtZone_LazyRegion *region =
+                avltree_search_floor(&zone->lazy_region_tree, (uintptr_t)addr);
+        if (!region) {
+                return NULL;
+        }
+        uintptr_t end_addr =
+                region->node_head.key + region->page_count * PAGE_SIZE;
+        if (end_addr <= (uintptr_t)addr) {
+                return NULL;
+        }
+        return region;
+}
+
+void virtzone_remove_lazy_region(
+        struct VirtZone *zone, struct VirtZone_LazyRegion *region
+) {
+        avltree_remove(&zone->lazy_region_tree, &region->node_head);
+        kfree(region);
+}
+
+bool virtzone_remove_lazy_range(
+        struct VirtZone *zone,
+        struct VirtZone_LazyRegion *region,
+        void *base,
+        size_t page_count
+) {
+        uintptr_t begin_addr = (uintptr_t)base;
+        uintptr_t end_addr = begin_addr + page_count * PAGE_SIZE;
+        uintptr_t region_begin_addr = region->node_head.key;
+        uintptr_t region_end_addr =
+                region_begin_addr + region->page_count * PAGE_SIZE;
+        ASSERT(region_begin_addr <= begin_addr);
+        ASSERT(end_addr <= region_end_addr);
+        if (end_addr < region_end_addr) {
+                // Keep the part after the range as separate region.
+                if (!virtzone_add_lazy_region(
+                            zone,
+                            (void *)end_addr,
+                            (region_end_addr - end_addr) / PAGE_SIZE,
+                            region->prot
+                    )) {
+                        return false;
+                }
+        }
+        if (region_begin_addr < begin_addr) {
+                region->page_count =
+                        (begin_addr - region_begin_addr) / PAGE_SIZE;
+        } else {
+                virtzone_remove_lazy_region(zone, region);
+        }
+        return true;
+}
+
 void virtzone_init(
         struct VirtZone *out, uintptr_t begin_addr, uintptr_t end_addr
 ) {
@@ -272,7 +342,57 @@ void virtzone_init(
         add_free_region(out, region);
 }
 
+bool virtzone_clone(struct VirtZone *out, struct VirtZone *src) {
+        kmemset(out, 0, sizeof(*out));
+        if (src->free_region_addr_tree.root) {
+                for (struct FreeRegion *src_region = region_of_addr_node(
+                             avltree_min_node(src->free_region_addr_tree.root)
+                     );
+                     src_region;
+                     src_region = region_of_addr_node(
+                             avltree_successor_of(&src_region->addr_node)
+                     )) {
+                        struct FreeRegion *region = make_free_region(
+                                src_region->begin_addr, src_region->end_addr
+                        );
+                        if (!region) {
+                                goto fail;
+                        }
+                        add_free_region(out, region);
+                }
+        }
+        if (src->lazy_region_tree.root) {
+                for (struct VirtZone_LazyRegion *src_region = avltree_min_node(
+                             src->lazy_region_tree.root
+                     );
+                     src_region;
+                     src_region = avltree_successor_of(&src_region->node_head)) {
+                        if (!virtzone_add_lazy_region(
+                                    out,
+                                    (void *)src_region->node_head.key,
+                                    src_region->page_count,
+                                    src_region->prot
+                            )) {
+                                goto fail;
+                        }
+                }
+        }
+        return true;
+fail:
+        virtzone_deinit(out);
+        return false;
+}
+
 void virtzone_deinit(struct VirtZone *zone) {
-        free_regions_tree((struct FreeRegionsForSize *)
-                                  zone->free_page_list_for_size_tree.root);
+        while (zone->free_region_addr_tree.root) {
+                struct FreeRegion *region =
+                        region_of_addr_node(zone->free_region_addr_tree.root);
+                remove_free_region(zone, region);
+                kfree(region);
+        }
+        while (zone->lazy_region_tree.root) {
+                virtzone_remove_lazy_region(
+                        zone, zone->lazy_region_tree.root
+                );
+        }
 }
@@ -3,6 +3,11 @@
 // SPDX-License-Identifier: BSD-2-Clause
 #include "syscall.h"
 #include <errno.h>
+#include "kernel/api/bits/limits.h"
+#include "kernel/api/bits/mman.h"
+#include "kernel/api/bits/resource.h"
+#include "kernel/api/bits/sched.h"
+#include "kernel/api/bits/time.h"
 #include "kernel/arch/arch.h"
 #include "kernel/heap/heap.h"
 #include "kernel/kernel.h"
@@ -17,7 +22,10 @@ static bool is_accessible(void const *buf, size_t size, mmu_prot_t prot_flags) {
         uintptr_t end_addr = align_up(PAGE_SIZE, (uintptr_t)buf + size);
         for (uintptr_t addr = begin_addr; addr < end_addr; addr += PAGE_SIZE) {
                 bool is_accessible = mmu_is_accessible((void *)addr, prot_flags);
-                if (!is_accessible) {
+                if (!is_accessible &&
+                    !process_handle_page_fault((void *)addr, prot_flags)) {
+                        // Not accessible, and it's not a reserved page that
+                        // just hasn't been touched yet either.
                         return false;
                 }
         }
@@ -108,3 +116,248 @@ out:
         kfree(buf);
         return 0;
 }
+
+int64_t syscall_impl_fork(void) {
+        struct Process *process = process_fork(process_running());
+        if (!process) {
+                return -ENOMEM;
+        }
+        struct Thread *thread = thread_create_forked(process, thread_running());
+        if (!thread) {
+                process_destroy(process);
+                return -ENOMEM;
+        }
+        scheduler_add_thread_to_wait_queue(thread);
+        return process_get_id(process);
+}
+
+int64_t syscall_impl_mmap(void *u_addr, size_t u_length, int u_prot, int u_flags) {
+        // Address is only a hint, and we don't use it.
+        (void)u_addr;
+        if (u_length == 0) {
+                return -EINVAL;
+        }
+        if (!(u_flags & MAP_ANONYMOUS)) {
+                // There's no file mapping yet.
+                return -ENODEV;
+        }
+        int sharing_mode = u_flags & (MAP_SHARED | MAP_PRIVATE);
+        if ((sharing_mode != MAP_SHARED) && (sharing_mode != MAP_PRIVATE)) {
+                return -EINVAL;
+        }
+        if (u_flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE)) {
+                return -EINVAL;
+        }
+        if ((u_prot == PROT_NONE) || (u_prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))) {
+                return -EINVAL;
+        }
+        struct Process *process = process_running();
+        size_t page_count = to_block_count(PAGE_SIZE, u_length);
+        struct Proc_MapOptions options = {
+                .writable = u_prot & PROT_WRITE,
+                .executable = u_prot & PROT_EXEC,
+                .shared = sharing_mode == MAP_SHARED,
+        };
+        void *addr = process_reserve_pages(process, page_count, options);
+        if (!addr) {
+                return -ENOMEM;
+        }
+        // Shared pages have to exist before fork(), or each side would end up
+        // with its own pages.
+        if (options.shared || (u_flags & MAP_POPULATE)) {
+                if (!process_populate_pages(process, addr, page_count)) {
+                        int result = process_release_pages(process, addr, page_count);
+                        ASSERT(result == 0);
+                        return -ENOMEM;
+                }
+        }
+        return (int64_t)addr;
+}
+
+int64_t syscall_impl_munmap(void *u_addr, size_t u_length) {
+        if (!is_aligned(PAGE_SIZE, (uintptr_t)u_addr) || (u_length == 0)) {
+                return -EINVAL;
+        }
+        size_t page_count = to_block_count(PAGE_SIZE, u_length);
+        return process_release_pages(process_running(), u_addr, page_count);
+}
+
+int64_t syscall_impl_nice(int u_incr) {
+        // Anything beyond this range ends up clamped anyway, and this keeps
+        // the addition below from overflowing.
+        int range = THREAD_NICE_MAX - THREAD_NICE_MIN;
+        if (u_incr < -range) {
+                u_incr = -range;
+        } else if (range < u_incr) {
+                u_incr = range;
+        }
+        int nice = scheduler_set_nice(scheduler_get_nice() + u_incr);
+        // New nice value can be negative, so we return it in a form that
+        // can't be mistaken for an errno.
+        return NZERO - nice;
+}
+
+int64_t syscall_impl_clock_nanosleep(int u_clock_id, int u_flags, struct timespec const *u_request, struct timespec *u_remain) {
+        // Nothing can interrupt the sleep, so there's never remaining time to
+        // report.
+        (void)u_remain;
+        // There's no wall clock yet, so both clocks count from the boot.
+        if ((u_clock_id != CLOCK_REALTIME) && (u_clock_id != CLOCK_MONOTONIC)) {
+                return -EINVAL;
+        }
+        if (u_flags & ~TIMER_ABSTIME) {
+                return -EINVAL;
+        }
+        struct timespec *request;
+        int64_t result = copy_from_user((void **)&request, u_request, sizeof(*request), false);
+        if (result < 0) {
+                return result;
+        }
+        time_t secs = request->tv_sec;
+        long nsecs = request->tv_nsec;
+        kfree(request);
+        if ((secs < 0) || (nsecs < 0) || (1000000000L <= nsecs)) {
+                return -EINVAL;
+        }
+        uint64_t ns = UINT64_MAX;
+        if ((uint64_t)secs < (UINT64_MAX / 1000000000ULL)) {
+                ns = (uint64_t)secs * 1000000000ULL + (uint64_t)nsecs;
+        }
+        if (u_flags & TIMER_ABSTIME) {
+                timer_sleep_until(ns, true);
+        } else {
+                timer_sleep(ns);
+        }
+        return 0;
+}
+
+int64_t syscall_impl_clock_gettime(int u_clock_id, struct timespec *u_tp) {
+        // Userland normally reads the clock page instead, and only comes here
+        // when RDTSCP isn't available.
+        if ((u_clock_id != CLOCK_REALTIME) && (u_clock_id != CLOCK_MONOTONIC)) {
+                return -EINVAL;
+        }
+        uint64_t ns = clock_monotonic_ns();
+        struct timespec tp = {
+                .tv_sec = (time_t)(ns / 1000000000ULL),
+                .tv_nsec = (long)(ns % 1000000000ULL),
+        };
+        return copy_to_user(u_tp, &tp, sizeof(tp));
+}
+
+// Only the calling thread can be changed for now.
+static bool is_current_thread(int u_pid) {
+        return (u_pid == 0) || ((tid_t)u_pid == thread_get_id(thread_running()));
+}
+
+int64_t syscall_impl_sched_setaffinity(int u_pid, size_t u_cpusetsize, void const *u_mask) {
+        if (!is_current_thread(u_pid)) {
+                return -ESRCH;
+        }
+        if (u_cpusetsize == 0) {
+                return -EINVAL;
+        }
+        // Processors we can't have are ignored.
+        cpumask_t mask = {0};
+        size_t size = u_cpusetsize;
+        if (sizeof(mask) < size) {
+                size = sizeof(mask);
+        }
+        void *buf;
+        int64_t result = copy_from_user(&buf, u_mask, size, false);
+        if (result < 0) {
+                return result;
+        }
+        kmemcpy(&mask, buf, size);
+        kfree(buf);
+        return scheduler_set_affinity(&mask);
+}
+
+int64_t syscall_impl_sched_getaffinity(int u_pid, size_t u_cpusetsize, void *u_mask) {
+        if (!is_current_thread(u_pid)) {
+                return -ESRCH;
+        }
+        cpumask_t mask = scheduler_get_affinity();
+        if (u_cpusetsize < sizeof(mask)) {
+                return -EINVAL;
+        }
+        return copy_to_user(u_mask, &mask, sizeof(mask));
+}
+
+static void add_thread_accounting(struct Thread *thread, void *data) {
+        struct Thread_Accounting *total = data;
+        struct Thread_Accounting accounting;
+        thread_get_accounting(thread, &accounting);
+        total->user_cycles += accounting.user_cycles;
+        total->kernel_cycles += accounting.kernel_cycles;
+        total->wait_cycles += accounting.wait_cycles;
+        total->voluntary_switches += accounting.voluntary_switches;
+        total->involuntary_switches += accounting.involuntary_switches;
+}
+
+static struct timeval timeval_from_cycles(uint64_t cycles) {
+        uint64_t us = processor_ns_from_cycles(cycles) / 1000;
+        return (struct timeval){
+                .tv_sec = (time_t)(us / 1000000),
+                .tv_usec = (suseconds_t)(us % 1000000),
+        };
+}
+
+int64_t syscall_impl_getrusage(int u_who, struct rusage *u_usage) {
+        struct Thread_Accounting accounting = {0};
+        switch (u_who) {
+        case RUSAGE_SELF:
+                process_for_each_thread(
+                        process_running(), add_thread_accounting, &accounting
+                );
+                break;
+        case RUSAGE_THREAD:
+                thread_get_accounting(thread_running(), &accounting);
+                break;
+        default:
+                return -EINVAL;
+        }
+        struct rusage usage = {
+                .ru_utime = timeval_from_cycles(accounting.user_cycles),
+                .ru_stime = timeval_from_cycles(accounting.kernel_cycles),
+                .ru_nvcsw = (long)accounting.voluntary_switches,
+                .ru_nivcsw = (long)accounting.involuntary_switches,
+                .ru_wtime = timeval_from_cycles(accounting.wait_cycles),
+        };
+        return copy_to_user(u_usage, &usage, sizeof(usage));
+}
+
+int64_t syscall_impl_sched_setscheduler(int u_pid, int u_policy, struct sched_param const *u_param) {
+        if (!is_current_thread(u_pid)) {
+                return -ESRCH;
+        }
+        void *buf;
+        int64_t result = copy_from_user(&buf, u_param, sizeof(struct sched_param), false);
+        if (result < 0) {
+                return result;
+        }
+        struct sched_param param = *(struct sched_param *)buf;
+        kfree(buf);
+        return scheduler_set_policy(u_policy, param.sched_priority);
+}
+
+int64_t syscall_impl_sched_getscheduler(int u_pid) {
+        if (!is_current_thread(u_pid)) {
+                return -ESRCH;
+        }
+        return scheduler_get_policy();
+}
+
+int64_t syscall_impl_sched_getparam(int u_pid, struct sched_param *u_param) {
+        if (!is_current_thread(u_pid)) {
+                return -ESRCH;
+        }
+        struct sched_param param = {
+                .sched_priority = scheduler_get_rt_priority(),
+        };
+        return copy_to_user(u_param, &param, sizeof(param));
+}
+
+void syscall_impl_thread_exit(void) {
+        thread_exit();
+}
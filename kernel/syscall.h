@@ -2,10 +2,26 @@
 //
 // SPDX-License-Identifier: BSD-2-Clause
 #pragma once
+#include "kernel/api/bits/resource.h"
+#include "kernel/api/bits/sched.h"
+#include "kernel/api/bits/time.h"
 #include <stddef.h>
 #include <stdint.h>
 
 void syscall_impl_sched_yield(void);
 int64_t syscall_impl_write(int u_fd, void const *u_buf, size_t u_count);
 int64_t syscall_impl_read(int u_fd, void *u_buf, size_t u_count);
-int64_t syscall_impl_dprint(void const *u_buf, size_t u_count);
\ No newline at end of file
+int64_t syscall_impl_dprint(void const *u_buf, size_t u_count);
+int64_t syscall_impl_fork(void);
+int64_t syscall_impl_mmap(void *u_addr, size_t u_length, int u_prot, int u_flags);
+int64_t syscall_impl_munmap(void *u_addr, size_t u_length);
+int64_t syscall_impl_nice(int u_incr);
+int64_t syscall_impl_clock_nanosleep(int u_clock_id, int u_flags, struct timespec const *u_request, struct timespec *u_remain);
+int64_t syscall_impl_clock_gettime(int u_clock_id, struct timespec *u_tp);
+int64_t syscall_impl_sched_setaffinity(int u_pid, size_t u_cpusetsize, void const *u_mask);
+int64_t syscall_impl_sched_getaffinity(int u_pid, size_t u_cpusetsize, void *u_mask);
+int64_t syscall_impl_getrusage(int u_who, struct rusage *u_usage);
+int64_t syscall_impl_sched_setscheduler(int u_pid, int u_policy, struct sched_param const *u_param);
+int64_t syscall_impl_sched_getscheduler(int u_pid);
+int64_t syscall_impl_sched_getparam(int u_pid, struct sched_param *u_param);
+void syscall_impl_thread_exit(void);
\ No newline at end of file
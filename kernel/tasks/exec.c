@@ -2,6 +2,7 @@
 //
 // SPDX-License-Identifier: BSD-2-Clause
 #include <errno.h>
+#include "kernel/api/bits/clockpage.h"
 #include "kernel/arch/arch.h"
 #include "kernel/kernel.h"
 #include "kernel/tasks/tasks.h"
@@ -228,6 +229,21 @@ int64_t exec(char const *name, void const *data, size_t size) {
                 result = -ENOMEM;
                 goto fail;
         }
+        // Every process shares the same read-only clock page.
+        if (!process_map_pages_at(
+                    process,
+                    processor_clock_page_physaddr(),
+                    (void *)CLOCKPAGE_ADDR,
+                    1,
+                    (struct Proc_MapOptions){
+                            .writable = false,
+                            .executable = false,
+                            .kernel_owned = true,
+                    }
+            )) {
+                result = -ENOMEM;
+                goto fail;
+        }
         result = load_phdrs(
                 &file, process, ehdr.e_phoff, ehdr.e_phnum, ehdr.e_phentsize
         );
@@ -17,21 +17,45 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+static char const *LOG_TAG = "process";
+
+// Exited threads each process keeps for reuse, along with their stacks.
+#define THREAD_CACHE_SIZE 4
+
 struct ChildThread {
         struct AVLTree_Node node_head;
         struct Thread *thread;
 };
 
 struct Process {
+        struct AVLTree_Node node_head; // key: id
         struct SpinLock lock;
         mmu_addrspace_t addrspace;
         struct VirtZone virtzone;
         struct AVLTree child_threads;
+        struct Thread *cached_threads[THREAD_CACHE_SIZE];
+        size_t cached_thread_count;
         pid_t id;
         unsigned next_thread_id;
+        struct Proc_WorkingSet working_set;
+        // Below two are protected by s_process_tree_lock.
+        unsigned pin_count;
+        // process_destroy() was called while pinned, so the last
+        // process_unpin() frees it.
+        bool is_destroy_pending;
+        // Node in s_exited_processes.
+        struct List_Node exited_node;
         char name[PROC_NAME_MAX_LEN + 1];
 };
 
+// All processes, keyed by process ID.
+static struct AVLTree s_process_tree;
+static struct SpinLock s_process_tree_lock;
+
+// User processes whose threads have all exited, waiting for the reaper.
+static struct List s_exited_processes;
+static struct SpinLock s_exited_processes_lock;
+
 static mmu_prot_t make_mmu_prot_flags(struct Process *process, struct Proc_MapOptions options) {
         mmu_prot_t prot_flags = 0;
         if (options.executable) {
@@ -40,6 +64,12 @@ static mmu_prot_t make_mmu_prot_flags(struct Process *process, struct Proc_MapOp
         if (options.writable) {
                 prot_flags |= MMU_PROT_WRITE;
         }
+        if (options.shared) {
+                prot_flags |= MMU_PROT_SHARED;
+        }
+        if (options.kernel_owned) {
+                prot_flags |= MMU_PROT_KERNEL_OWNED;
+        }
         if (!process_is_kernel(process)) {
                 prot_flags |= MMU_PROT_USER;
         }
@@ -118,6 +148,68 @@ tid_t process_add_thread(struct Process *process, struct Thread *thread) {
         return tid;
 }
 
+void process_exit_thread(struct Process *process, struct Thread *thread) {
+        ASSERT(!interrupts_are_enabled());
+        struct ChildThread *cthread;
+        bool has_exited;
+        {
+                bool prev_interrupt_state;
+                spinlock_lock(&process->lock, &prev_interrupt_state);
+                cthread = avltree_search(
+                        &process->child_threads, thread_get_id(thread)
+                );
+                ASSERT(cthread);
+                avltree_remove(&process->child_threads, &cthread->node_head);
+                if (process->cached_thread_count < THREAD_CACHE_SIZE) {
+                        process->cached_threads[process->cached_thread_count] =
+                                thread;
+                        ++process->cached_thread_count;
+                } else {
+                        // Handed over while the process is locked, so that it
+                        // reaches the reaper before the process does.
+                        reaper_add_thread(thread);
+                }
+                has_exited = !process_is_kernel(process) &&
+                             !process->child_threads.root;
+                spinlock_unlock(&process->lock, prev_interrupt_state);
+        }
+        kfree(cthread);
+        if (has_exited) {
+                bool prev_interrupt_state;
+                spinlock_lock(&s_exited_processes_lock, &prev_interrupt_state);
+                list_insert_tail(&s_exited_processes, &process->exited_node);
+                spinlock_unlock(&s_exited_processes_lock, prev_interrupt_state);
+        }
+}
+
+struct Process *process_take_exited(void) {
+        bool prev_interrupt_state;
+        spinlock_lock(&s_exited_processes_lock, &prev_interrupt_state);
+        struct Process *process = NULL;
+        struct List_Node *node = s_exited_processes.head;
+        if (node) {
+                list_remove_head(&s_exited_processes);
+                process = (struct Process *)((uintptr_t)node -
+                                             offsetof(struct Process,
+                                                      exited_node));
+        }
+        spinlock_unlock(&s_exited_processes_lock, prev_interrupt_state);
+        return process;
+}
+
+struct Thread *process_take_cached_thread(struct Process *process) {
+        bool prev_interrupt_state;
+        spinlock_lock(&process->lock, &prev_interrupt_state);
+        struct Thread *thread = NULL;
+        // Most recently exited one is most likely to still be in the cache.
+        if (process->cached_thread_count != 0) {
+                --process->cached_thread_count;
+                thread = process->cached_threads[process->cached_thread_count];
+        }
+        spinlock_unlock(&process->lock, prev_interrupt_state);
+        return thread;
+}
+
 void *process_map_unaligned(struct Process *process, uintptr_t physaddr, size_t size, struct Proc_MapOptions options) {
         uintptr_t aligned_base = physaddr - (physaddr % PAGE_SIZE);
         uintptr_t offset = physaddr - aligned_base;
@@ -259,6 +351,184 @@ void process_free_pages(struct Process *process, void *ptr, size_t page_count) {
         physpage_free((struct PhysPage_Addr){physpage}, page_count);
 }
 
+void *process_reserve_pages(struct Process *process, size_t page_count, struct Proc_MapOptions options) {
+        bool prev_interrupt_state;
+        mmu_prot_t prot_flags = make_mmu_prot_flags(process, options);
+        spinlock_lock(&process->lock, &prev_interrupt_state);
+        void *virtbase = virtzone_alloc_region(&process->virtzone, page_count);
+        if (!virtbase) {
+                goto out;
+        }
+        if (!virtzone_add_lazy_region(
+                    &process->virtzone, virtbase, page_count, prot_flags
+            )) {
+                virtzone_free_region(&process->virtzone, virtbase, page_count);
+                virtbase = NULL;
+                goto out;
+        }
+out:
+        spinlock_unlock(&process->lock, prev_interrupt_state);
+        return virtbase;
+}
+
+// Allocates and maps zero-filled page at `virtaddr`, if it's not present yet.
+//
+// Returns false on OOM.
+WARN_UNUSED_RESULT static bool populate_lazy_page(struct Process *process, struct VirtZone_LazyRegion const *region, void *virtaddr) {
+        ASSERT(is_aligned(PAGE_SIZE, (uintptr_t)virtaddr));
+        uintptr_t physaddr;
+        if (mmu_lookup(process->addrspace, virtaddr, &physaddr)) {
+                // Someone else populated the page first.
+                return true;
+        }
+        struct PhysPage_Addr page = physpage_alloc(1);
+        if (!page.value) {
+                return false;
+        }
+        mmu_zero_page(page.value);
+        if (!mmu_map(process->addrspace, page.value, virtaddr, region->prot)) {
+                physpage_free(page, 1);
+                return false;
+        }
+        return true;
+}
+
+bool process_populate_pages(struct Process *process, void *virtbase, size_t page_count) {
+        ASSERT(is_aligned(PAGE_SIZE, (uintptr_t)virtbase));
+        bool prev_interrupt_state;
+        bool result = true;
+        spinlock_lock(&process->lock, &prev_interrupt_state);
+        uint8_t *next_virtaddr = virtbase;
+        for (size_t i = 0; i < page_count; ++i, next_virtaddr += PAGE_SIZE) {
+                struct VirtZone_LazyRegion *region = virtzone_find_lazy_region(
+                        &process->virtzone, next_virtaddr
+                );
+                ASSERT(region);
+                if (!populate_lazy_page(process, region, next_virtaddr)) {
+                        result = false;
+                        break;
+                }
+        }
+        spinlock_unlock(&process->lock, prev_interrupt_state);
+        return result;
+}
+
+int process_release_pages(struct Process *process, void *virtbase, size_t page_count) {
+        ASSERT(is_aligned(PAGE_SIZE, (uintptr_t)virtbase));
+        ASSERT(page_count != 0);
+        int result = 0;
+        bool prev_interrupt_state;
+        spinlock_lock(&process->lock, &prev_interrupt_state);
+        struct VirtZone_LazyRegion *region =
+                virtzone_find_lazy_region(&process->virtzone, virtbase);
+        if (!region) {
+                result = -EINVAL;
+                goto out;
+        }
+        size_t pages_after_base =
+                region->page_count -
+                ((uintptr_t)virtbase - region->node_head.key) / PAGE_SIZE;
+        if (pages_after_base < page_count) {
+                result = -EINVAL;
+                goto out;
+        }
+        if (!virtzone_remove_lazy_range(
+                    &process->virtzone, region, virtbase, page_count
+            )) {
+                result = -ENOMEM;
+                goto out;
+        }
+        uint8_t *next_virtaddr = virtbase;
+        for (size_t i = 0; i < page_count; ++i, next_virtaddr += PAGE_SIZE) {
+                uintptr_t physaddr;
+                if (!mmu_lookup(process->addrspace, next_virtaddr, &physaddr)) {
+                        // The page was never touched.
+                        continue;
+                }
+                mmu_unmap(process->addrspace, next_virtaddr);
+                struct PhysPage_Addr page = {physaddr};
+                if (!physpage_unref_if_shared(page)) {
+                        physpage_free(page, 1);
+                }
+        }
+        virtzone_free_region(&process->virtzone, virtbase, page_count);
+out:
+        spinlock_unlock(&process->lock, prev_interrupt_state);
+        return result;
+}
+
+// Gives the process its own writable copy of copy-on-write page.
+//
+// Returns false on OOM.
+WARN_UNUSED_RESULT static bool resolve_cow_page(struct Process *process, void *virtaddr, uintptr_t physaddr) {
+        struct PhysPage_Addr old_page = {physaddr};
+        if (physpage_is_shared(old_page)) {
+                struct PhysPage_Addr new_page = physpage_alloc(1);
+                if (!new_page.value) {
+                        return false;
+                }
+                mmu_copy_page(new_page.value, old_page.value);
+                if (physpage_unref_if_shared(old_page)) {
+                        mmu_resolve_cow(
+                                process->addrspace, virtaddr, new_page.value
+                        );
+                        return true;
+                }
+                // Everyone else dropped the page while we were copying, so we
+                // can just keep the original.
+                physpage_free(new_page, 1);
+        }
+        mmu_resolve_cow(process->addrspace, virtaddr, old_page.value);
+        return true;
+}
+
+bool process_handle_page_fault(void *virtaddr, mmu_prot_t access) {
+        uintptr_t addr = (uintptr_t)virtaddr;
+        struct Process *process;
+        if (USER_VM_VIRTBASE <= addr && addr < USER_VM_VIRTEND) {
+                process = process_running();
+                if (!process || process_is_kernel(process)) {
+                        return false;
+                }
+        } else if (KERNEL_VM_VIRTBASE <= addr && addr < KERNEL_VM_VIRTEND) {
+                process = process_kernel();
+        } else {
+                return false;
+        }
+        void *page_virtaddr = (void *)align_down(PAGE_SIZE, addr);
+        bool result = false;
+        bool prev_interrupt_state;
+        spinlock_lock(&process->lock, &prev_interrupt_state);
+        uintptr_t physaddr;
+        if (mmu_lookup(process->addrspace, page_virtaddr, &physaddr)) {
+                if ((access & MMU_PROT_WRITE) &&
+                    mmu_is_cow(process->addrspace, page_virtaddr)) {
+                        result = resolve_cow_page(
+                                process, page_virtaddr, physaddr
+                        );
+                } else {
+                        // Someone else may have resolved the fault first.
+                        result = mmu_is_accessible(virtaddr, access);
+                }
+                goto out;
+        }
+        struct VirtZone_LazyRegion *region =
+                virtzone_find_lazy_region(&process->virtzone, page_virtaddr);
+        if (!region) {
+                goto out;
+        }
+        if ((region->prot & access) != access) {
+                goto out;
+        }
+        result = populate_lazy_page(process, region, page_virtaddr);
+        if (!result) {
+                LOGE(LOG_TAG, "Not enough memory to populate page at %p", virtaddr);
+        }
+out:
+        spinlock_unlock(&process->lock, prev_interrupt_state);
+        return result;
+}
+
 void process_activate_user_addrspace(struct Process *process) {
         ASSERT(!process_is_kernel(process));
         mmu_activate_user_vm_addrspace(process->addrspace);
@@ -267,12 +537,171 @@ void process_activate_user_addrspace(struct Process *process) {
 struct Process *process_spawn_user(char const *name) {
         mmu_addrspace_t mmu_addrspace = mmu_addrspace_create();
         if (mmu_addrspace == MMU_ADDRSPACE_INVALID) {
-                mmu_addrspace_delete(mmu_addrspace);
                 return NULL;
         }
         return do_spawn(name, mmu_addrspace, false);
 }
 
+struct Process *process_fork(struct Process *parent) {
+        ASSERT(!process_is_kernel(parent));
+        mmu_addrspace_t mmu_addrspace = mmu_addrspace_create();
+        if (mmu_addrspace == MMU_ADDRSPACE_INVALID) {
+                return NULL;
+        }
+        struct Process *process = do_spawn(parent->name, mmu_addrspace, false);
+        if (!process) {
+                mmu_addrspace_delete(mmu_addrspace);
+                return NULL;
+        }
+        bool prev_interrupt_state;
+        spinlock_lock(&parent->lock, &prev_interrupt_state);
+        virtzone_deinit(&process->virtzone);
+        if (!virtzone_clone(&process->virtzone, &parent->virtzone)) {
+                goto fail;
+        }
+        // Nothing is copied here. Both sides get the same pages, and writable
+        // ones get copied on the first write.
+        if (!mmu_addrspace_share_cow(process->addrspace, parent->addrspace)) {
+                goto fail;
+        }
+        spinlock_unlock(&parent->lock, prev_interrupt_state);
+        return process;
+fail:
+        spinlock_unlock(&parent->lock, prev_interrupt_state);
+        process_destroy(process);
+        return NULL;
+}
+
+void process_for_each(
+        void (*callback)(struct Process *process, void *data), void *data
+) {
+        bool prev_interrupt_state;
+        spinlock_lock(&s_process_tree_lock, &prev_interrupt_state);
+        if (s_process_tree.root) {
+                for (struct Process *process =
+                             avltree_min_node(s_process_tree.root);
+                     process;
+                     process = avltree_successor_of(&process->node_head)) {
+                        callback(process, data);
+                }
+        }
+        spinlock_unlock(&s_process_tree_lock, prev_interrupt_state);
+}
+
+struct Process *process_pin_next(pid_t id) {
+        bool prev_interrupt_state;
+        spinlock_lock(&s_process_tree_lock, &prev_interrupt_state);
+        struct Process *process = avltree_search_ceil(&s_process_tree, id);
+        if (process) {
+                ++process->pin_count;
+        }
+        spinlock_unlock(&s_process_tree_lock, prev_interrupt_state);
+        return process;
+}
+
+static void free_process(struct Process *process);
+
+void process_unpin(struct Process *process) {
+        bool should_free;
+        {
+                bool prev_interrupt_state;
+                spinlock_lock(&s_process_tree_lock, &prev_interrupt_state);
+                ASSERT(process->pin_count != 0);
+                --process->pin_count;
+                should_free = process->pin_count == 0 &&
+                              process->is_destroy_pending;
+                spinlock_unlock(&s_process_tree_lock, prev_interrupt_state);
+        }
+        if (should_free) {
+                free_process(process);
+        }
+}
+
+void process_for_each_thread(
+        struct Process *process,
+        void (*callback)(struct Thread *thread, void *data),
+        void *data
+) {
+        bool prev_interrupt_state;
+        spinlock_lock(&process->lock, &prev_interrupt_state);
+        if (process->child_threads.root) {
+                for (struct ChildThread *cthread =
+                             avltree_min_node(process->child_threads.root);
+                     cthread;
+                     cthread = avltree_successor_of(&cthread->node_head)) {
+                        callback(cthread->thread, data);
+                }
+        }
+        spinlock_unlock(&process->lock, prev_interrupt_state);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Working set estimation
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned const WORKINGSET_WINDOW_SCAN_COUNTS[] = {1, 5, 30};
+
+_Static_assert(
+        sizeof(WORKINGSET_WINDOW_SCAN_COUNTS) ==
+                sizeof(unsigned) * PROC_WORKINGSET_WINDOW_COUNT,
+        "Window count mismatch"
+);
+
+static void count_working_set_page(unsigned age, bool is_dirty, void *data) {
+        struct Proc_WorkingSet *out = data;
+        ++out->resident_page_count;
+        if (is_dirty) {
+                ++out->dirty_page_count;
+        }
+        // Age is number of scans that didn't see any access, so the page was
+        // accessed during the last (age + 1) scans.
+        for (unsigned i = 0; i < PROC_WORKINGSET_WINDOW_COUNT; ++i) {
+                if (age < out->window_scan_counts[i]) {
+                        ++out->hot_page_counts[i];
+                }
+        }
+}
+
+void process_scan_working_set(struct Process *process) {
+        ASSERT(!process_is_kernel(process));
+        struct Proc_WorkingSet working_set;
+        kmemset(&working_set, 0, sizeof(working_set));
+        for (unsigned i = 0; i < PROC_WORKINGSET_WINDOW_COUNT; ++i) {
+                working_set.window_scan_counts[i] =
+                        WORKINGSET_WINDOW_SCAN_COUNTS[i];
+        }
+        size_t cursor = 0;
+        bool has_more;
+        do {
+                bool prev_interrupt_state;
+                spinlock_lock(&process->lock, &prev_interrupt_state);
+                has_more = mmu_age_pages(
+                        process->addrspace,
+                        &cursor,
+                        count_working_set_page,
+                        &working_set
+                );
+                spinlock_unlock(&process->lock, prev_interrupt_state);
+                // Page faults and others waiting for the locks get their turn
+                // between page tables.
+                scheduler_yield();
+        } while (has_more);
+        bool prev_interrupt_state;
+        spinlock_lock(&process->lock, &prev_interrupt_state);
+        working_set.scan_count = process->working_set.scan_count + 1;
+        process->working_set = working_set;
+        spinlock_unlock(&process->lock, prev_interrupt_state);
+}
+
+void process_get_working_set(
+        struct Process *process, struct Proc_WorkingSet *out
+) {
+        bool prev_interrupt_state;
+        spinlock_lock(&process->lock, &prev_interrupt_state);
+        *out = process->working_set;
+        spinlock_unlock(&process->lock, prev_interrupt_state);
+}
+
 WARN_UNUSED_RESULT ssize_t process_fd_write(struct Process *process, int fd, void const *buf, size_t count) {
         if (SSIZE_MAX < count) {
                 return -EINVAL;
@@ -357,9 +786,39 @@ WARN_UNUSED_RESULT static struct Process *do_spawn(char const *name, mmu_addrspa
                 ++s_next_pid;
                 spinlock_unlock(&process->lock, prev_interrupt_state);
         }
+        {
+                bool prev_interrupt_state;
+                spinlock_lock(&s_process_tree_lock, &prev_interrupt_state);
+                avltree_insert(&s_process_tree, process, process->id);
+                spinlock_unlock(&s_process_tree_lock, prev_interrupt_state);
+        }
         return process;
 }
 
+void process_destroy(struct Process *process) {
+        ASSERT(!process_is_kernel(process));
+        ASSERT(!process->child_threads.root);
+        ASSERT(process->cached_thread_count == 0);
+        bool is_pinned;
+        {
+                bool prev_interrupt_state;
+                spinlock_lock(&s_process_tree_lock, &prev_interrupt_state);
+                avltree_remove(&s_process_tree, &process->node_head);
+                is_pinned = process->pin_count != 0;
+                process->is_destroy_pending = is_pinned;
+                spinlock_unlock(&s_process_tree_lock, prev_interrupt_state);
+        }
+        if (!is_pinned) {
+                free_process(process);
+        }
+}
+
+static void free_process(struct Process *process) {
+        virtzone_deinit(&process->virtzone);
+        mmu_addrspace_delete(process->addrspace);
+        kfree(process);
+}
+
 struct Process *process_kernel(void) { return s_kernel_process; }
 
 void process_spawn_kernel(mmu_addrspace_t mmu_addrspace) {
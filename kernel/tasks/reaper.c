@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "tasks.h"
+#include "kernel/arch/arch.h"
+#include "kernel/kernel.h"
+#include "kernel/lock/spinlock.h"
+#include "kernel/utility/utility.h"
+#include <stdbool.h>
+
+static char const *LOG_TAG = "reaper";
+
+// Exited threads are only handed here when their process's cache is full, and
+// exited processes only cost memory until then, so there's no hurry.
+#define REAP_INTERVAL_TICKS 200
+
+// Threads waiting to be destroyed. Exited threads are out of the scheduler, so
+// their scheduler node is free to be used for this.
+static struct List s_exited_threads;
+static struct SpinLock s_exited_threads_lock;
+
+void reaper_add_thread(struct Thread *thread) {
+        bool prev_interrupt_state;
+        spinlock_lock(&s_exited_threads_lock, &prev_interrupt_state);
+        *(struct List_Node *)thread = (struct List_Node){0};
+        list_insert_tail(&s_exited_threads, (struct List_Node *)thread);
+        spinlock_unlock(&s_exited_threads_lock, prev_interrupt_state);
+}
+
+// Returns NULL if there's nothing to destroy.
+static struct Thread *take_exited_thread(void) {
+        bool prev_interrupt_state;
+        spinlock_lock(&s_exited_threads_lock, &prev_interrupt_state);
+        struct Thread *thread = s_exited_threads.head;
+        if (thread) {
+                list_remove_head(&s_exited_threads);
+        }
+        spinlock_unlock(&s_exited_threads_lock, prev_interrupt_state);
+        return thread;
+}
+
+static void destroy_exited_threads(void) {
+        while (1) {
+                struct Thread *thread = take_exited_thread();
+                if (!thread) {
+                        break;
+                }
+                thread_destroy(thread);
+        }
+}
+
+static void destroy_process(struct Process *process) {
+        while (1) {
+                struct Thread *thread = process_take_cached_thread(process);
+                if (!thread) {
+                        break;
+                }
+                thread_destroy(thread);
+        }
+        process_destroy(process);
+}
+
+static void run_reaper(void) {
+        interrupts_enable();
+        uint64_t next_reap_ns = clock_monotonic_ns();
+        while (1) {
+                next_reap_ns += REAP_INTERVAL_TICKS * TICKTIME_NS_PER_TICK;
+                timer_sleep_until(next_reap_ns, false);
+                while (1) {
+                        struct Process *process = process_take_exited();
+                        // Threads handed over before their process still
+                        // use it, so they go first.
+                        destroy_exited_threads();
+                        if (!process) {
+                                break;
+                        }
+                        destroy_process(process);
+                }
+        }
+}
+
+void reaper_start(void) {
+        struct Thread *thread =
+                thread_spawn(process_kernel(), "reaper", run_reaper);
+        if (!thread) {
+                // Exited threads will pile up in the list, which only costs
+                // memory.
+                LOGE(LOG_TAG, "Failed to start the reaper thread");
+        }
+}
@@ -0,0 +1,186 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "tasks.h"
+#include "kernel/arch/arch.h"
+#include "kernel/heap/heap.h"
+#include "kernel/kernel.h"
+#include "kernel/lock/spinlock.h"
+#include "kernel/utility/utility.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Histogram buckets are only written by the owning processor, so they are
+// updated without locking. The lock is for the worst list, which is only
+// touched when a new worst latency comes up, and for resetting.
+struct PerProcessor {
+        struct SpinLock lock;
+        // Shortest latency in the worst list. Only latencies above this are
+        // worth locking for.
+        uint64_t worst_threshold_ns;
+        struct SchedLatency_Stats stats;
+};
+
+static struct PerProcessor *s_per_processor[CPUMASK_MAX_PROCESSORS];
+
+static unsigned bucket_of(uint64_t ns) {
+        unsigned bucket = 63 - __builtin_clzll(ns | 1);
+        if (SCHEDLATENCY_BUCKET_COUNT <= bucket) {
+                bucket = SCHEDLATENCY_BUCKET_COUNT - 1;
+        }
+        return bucket;
+}
+
+static void increment(uint64_t *counter) {
+        __atomic_store_n(
+                counter,
+                __atomic_load_n(counter, __ATOMIC_RELAXED) + 1,
+                __ATOMIC_RELAXED
+        );
+}
+
+// Caller must hold the lock.
+static void update_worst_list(
+        struct PerProcessor *per_processor,
+        struct Thread *thread,
+        struct Thread *preempting_thread,
+        uint64_t latency_ns,
+        bool is_wakeup
+) {
+        struct SchedLatency_Record *worst = per_processor->stats.worst;
+        size_t index = SCHEDLATENCY_WORST_COUNT;
+        while ((0 < index) && (worst[index - 1].latency_ns < latency_ns)) {
+                --index;
+        }
+        if (index == SCHEDLATENCY_WORST_COUNT) {
+                return;
+        }
+        for (size_t i = SCHEDLATENCY_WORST_COUNT - 1; index < i; --i) {
+                worst[i] = worst[i - 1];
+        }
+        struct SchedLatency_Record *record = &worst[index];
+        record->latency_ns = latency_ns;
+        record->at_ns = clock_monotonic_ns();
+        record->tid = thread_get_id(thread);
+        record->preempting_tid = thread_get_id(preempting_thread);
+        record->is_wakeup = is_wakeup;
+        str_copy(record->name, sizeof(record->name), thread_get_name(thread));
+        str_copy(
+                record->preempting_name,
+                sizeof(record->preempting_name),
+                thread_get_name(preempting_thread)
+        );
+        __atomic_store_n(
+                &per_processor->worst_threshold_ns,
+                worst[SCHEDLATENCY_WORST_COUNT - 1].latency_ns,
+                __ATOMIC_RELAXED
+        );
+}
+
+void schedlatency_record(
+        struct Thread *thread,
+        struct Thread *preempting_thread,
+        uint64_t latency_cycles,
+        bool is_wakeup
+) {
+        ASSERT(!interrupts_are_enabled());
+        struct PerProcessor *per_processor =
+                s_per_processor[processor_current()->cpu_num];
+        if (!per_processor) {
+                return;
+        }
+        uint64_t latency_ns = processor_ns_from_cycles(latency_cycles);
+        unsigned bucket = bucket_of(latency_ns);
+        if (is_wakeup) {
+                increment(&per_processor->stats.wakeup_counts[bucket]);
+        } else {
+                increment(&per_processor->stats.preempted_counts[bucket]);
+        }
+        if (latency_ns <= __atomic_load_n(
+                                  &per_processor->worst_threshold_ns,
+                                  __ATOMIC_RELAXED
+                          )) {
+                return;
+        }
+        bool prev_interrupt_state;
+        spinlock_lock(&per_processor->lock, &prev_interrupt_state);
+        update_worst_list(
+                per_processor, thread, preempting_thread, latency_ns, is_wakeup
+        );
+        spinlock_unlock(&per_processor->lock, prev_interrupt_state);
+}
+
+bool schedlatency_get(size_t processor_index, struct SchedLatency_Stats *out) {
+        ASSERT(processor_index < CPUMASK_MAX_PROCESSORS);
+        struct PerProcessor *per_processor = __atomic_load_n(
+                &s_per_processor[processor_index], __ATOMIC_ACQUIRE
+        );
+        if (!per_processor) {
+                return false;
+        }
+        bool prev_interrupt_state;
+        spinlock_lock(&per_processor->lock, &prev_interrupt_state);
+        for (size_t i = 0; i < SCHEDLATENCY_BUCKET_COUNT; ++i) {
+                out->wakeup_counts[i] = __atomic_load_n(
+                        &per_processor->stats.wakeup_counts[i],
+                        __ATOMIC_RELAXED
+                );
+                out->preempted_counts[i] = __atomic_load_n(
+                        &per_processor->stats.preempted_counts[i],
+                        __ATOMIC_RELAXED
+                );
+        }
+        kmemcpy(out->worst,
+                per_processor->stats.worst,
+                sizeof(per_processor->stats.worst));
+        spinlock_unlock(&per_processor->lock, prev_interrupt_state);
+        return true;
+}
+
+void schedlatency_reset(void) {
+        size_t count = processor_count();
+        for (size_t i = 0; i < count; ++i) {
+                struct PerProcessor *per_processor =
+                        __atomic_load_n(&s_per_processor[i], __ATOMIC_ACQUIRE);
+                if (!per_processor) {
+                        continue;
+                }
+                bool prev_interrupt_state;
+                spinlock_lock(&per_processor->lock, &prev_interrupt_state);
+                // The owner may be counting meanwhile, and then a count or two
+                // from before the reset survives it.
+                for (size_t j = 0; j < SCHEDLATENCY_BUCKET_COUNT; ++j) {
+                        __atomic_store_n(
+                                &per_processor->stats.wakeup_counts[j],
+                                0,
+                                __ATOMIC_RELAXED
+                        );
+                        __atomic_store_n(
+                                &per_processor->stats.preempted_counts[j],
+                                0,
+                                __ATOMIC_RELAXED
+                        );
+                }
+                kmemset(per_processor->stats.worst,
+                        0,
+                        sizeof(per_processor->stats.worst));
+                __atomic_store_n(
+                        &per_processor->worst_threshold_ns, 0, __ATOMIC_RELAXED
+                );
+                spinlock_unlock(&per_processor->lock, prev_interrupt_state);
+        }
+}
+
+void schedlatency_init_for_current_processor(void) {
+        struct PerProcessor *per_processor = kmalloc(sizeof(*per_processor));
+        if (!per_processor) {
+                panic("Not enough kmalloc memory for latency statistics");
+        }
+        kmemset(per_processor, 0, sizeof(*per_processor));
+        ENTER_NO_INTERRUPT_SECTION();
+        size_t index = processor_current()->cpu_num;
+        ASSERT(!s_per_processor[index]);
+        __atomic_store_n(&s_per_processor[index], per_processor, __ATOMIC_RELEASE);
+        LEAVE_NO_INTERRUPT_SECTION();
+}
@@ -2,6 +2,7 @@
 //
 // SPDX-License-Identifier: BSD-2-Clause
 #include "tasks.h"
+#include <errno.h>
 #include "kernel/arch/arch.h"
 #include "kernel/heap/heap.h"
 #include "kernel/kernel.h"
@@ -11,202 +12,1293 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-struct ThreadEntry {
-        struct List_Node node_head;
-        struct Thread *thread;
+#define RT_BITMAP_WORD_COUNT \
+        ((THREAD_RT_PRIORITY_MAX + BITMAP_BITS_PER_WORD) / BITMAP_BITS_PER_WORD)
+
+// Each processor has its own queue. Threads go into the queue of the
+// processor they were added or went to sleep on, unless that one is busy while
+// another is idle, or their affinity doesn't allow it. Processor is notified
+// with reschedule IPI when others put threads into its queue. Processors may
+// also steal threads from each other, and a periodic balancer moves threads
+// from the most loaded queue to the least loaded one.
+//
+// Fair threads are ordered by their virtual runtime, which grows by the time
+// they've run, scaled down by their weight. The thread that is most behind
+// runs next, so over time every thread gets CPU time in proportion to its
+// weight.
+//
+// Real-time threads always run before fair threads. They are kept in a list
+// per priority, and the highest priority with any thread is found from a
+// bitmap. Unless they use up the real-time budget of the period, in which case
+// fair threads get to run for the rest of it.
+//
+// NOTE: The queue lock of the current processor stays locked while switching
+//       context, and the thread we switched to unlocks it. (See
+//       `scheduler_about_to_enter_new_thread()`)
+struct Scheduler_RunQueue {
+        struct SpinLock lock;
+        // Runnable fair threads, keyed by virtual runtime.
+        struct AVLTree tree;
+        // Runnable real-time threads of each priority, in the order they run.
+        // Bit N of `rt_bitmap` is set if rt_lists[N] isn't empty.
+        struct List rt_lists[THREAD_RT_PRIORITY_MAX + 1];
+        bitmap_word_t rt_bitmap[RT_BITMAP_WORD_COUNT];
+        // Ticks of the current real-time period, and ticks real-time threads
+        // ran during it.
+        tick_t rt_period_ticks, rt_used_ticks;
+        // Real-time threads used up their budget, and only run when there's
+        // nothing else until the period ends.
+        bool is_rt_throttled;
+        // Thread that runs when there's nothing else to do. It's never put
+        // into the tree.
+        struct Thread *idle_thread;
+        // Virtual runtime of the queue. It only increases, and new or woken
+        // up threads are placed relative to it.
+        uint64_t min_vruntime;
+        // Number of threads in `tree` and `rt_lists`. Read by other processors
+        // without locking to pick victim for stealing.
+        size_t runnable_count;
+        // Ticks the current thread has run since it was picked.
+        tick_t current_ticks;
+        // Ticks that couldn't be charged because the queue was locked by
+        // someone else at the time. They're added to the next tick. Only the
+        // owning processor touches it, with interrupts disabled.
+        tick_t pending_ticks;
+        // Thread that switched out only to move to another processor, because
+        // its affinity no longer allows this one. Whoever runs next here sends
+        // it away, once its context is saved.
+        struct Thread *leaving_thread;
+        // Thread that switched out for good. Whoever runs next here hands it
+        // over to thread_on_exited(), once its context is saved.
+        struct Thread *exited_thread;
+        // Index of the processor owning this queue.
+        size_t processor_index;
+        // The idle thread is running. Read by other processors without locking
+        // to pick where to put runnable threads.
+        bool is_idle;
+        // Average number of runnable threads including the running one, in
+        // LOAD_AVG_ONE units. (See update_load_avg()) Read by other processors
+        // without locking.
+        uint64_t load_avg;
 };
 
-static tick_t const MAX_THREAD_TIME = 5;
+#define TICK_NS TICKTIME_NS_PER_TICK
 
-static void enqueue_thread(struct List *queue, struct Thread *thread) {
-        struct ThreadEntry *queued_thread = kmalloc(sizeof(*queued_thread));
-        if (!queued_thread) {
-                panic("Not enough kmalloc memory to enqueue a thread");
-        }
-        queued_thread->thread = thread;
-        list_insert_head(queue, &queued_thread->node_head);
+// Weight of nice 0. Each nice step is roughly 10% of CPU time.
+#define NICE_0_WEIGHT 1024
+
+static unsigned const NICE_TO_WEIGHT[THREAD_NICE_MAX - THREAD_NICE_MIN + 1] = {
+        /* -20 */ 88761, 71755, 56483, 46273, 36291,
+        /* -15 */ 29154, 23254, 18705, 14949, 11916,
+        /* -10 */ 9548,  7620,  6100,  4904,  3906,
+        /*  -5 */ 3121,  2501,  1991,  1586,  1277,
+        /*   0 */ 1024,  820,   655,   526,   423,
+        /*   5 */ 335,   272,   215,   172,   137,
+        /*  10 */ 110,   87,    70,    56,    45,
+        /*  15 */ 36,    29,    23,    18,    15,
+};
+
+// Current thread keeps running until it's this far ahead of the next one.
+// This keeps threads from switching back and forth on every tick.
+static uint64_t const PREEMPT_GRANULARITY_NS = 3 * TICK_NS;
+// Minimum ticks a thread runs before it gets preempted.
+static tick_t const MIN_RUN_TICKS = 1;
+// Threads waking up from sleep get placed this much before the queue's
+// virtual runtime, so interactive threads run soon after they wake up.
+static uint64_t const SLEEPER_CREDIT_NS = 3 * TICK_NS;
+
+// When there's nothing else to run, we don't need timer interrupts every tick.
+// Idle processors only wake up for other interrupts, pending timers, or the
+// long timeout.
+#define NOHZ_IDLE_TICKS 1000
+// With only one thread there's no one to preempt it for, but we still need to
+// charge its runtime, and notice threads woken up by other processors.
+#define NOHZ_SINGLE_THREAD_TICKS 10
+
+// Unless we have nothing to run, steal from others only if they have more than
+// this many threads than us.
+static size_t const STEAL_IMBALANCE_THRESHOLD = 1;
+
+// Round-robin real-time threads run this long before others of the same
+// priority get their turn.
+#define RR_TIMESLICE_TICKS 100
+// Real-time threads may use RT_RUNTIME_TICKS out of every RT_PERIOD_TICKS,
+// so runaway ones can't starve everyone else.
+#define RT_PERIOD_TICKS  1000
+#define RT_RUNTIME_TICKS 950
+
+// Load average decays by 1/LOAD_AVG_PERIOD_TICKS every tick, and ticks older
+// than LOAD_AVG_MAX_TICKS hardly make difference.
+#define LOAD_AVG_ONE          1024
+#define LOAD_AVG_PERIOD_TICKS 32
+#define LOAD_AVG_MAX_TICKS    (4 * LOAD_AVG_PERIOD_TICKS)
+
+// Balancer runs on whichever processor's tick comes first after this.
+static uint64_t const BALANCE_INTERVAL_NS = 50 * TICK_NS;
+// Moving a thread to a queue with one less thread only swaps their loads, so
+// difference must be bigger than that.
+static uint64_t const BALANCE_IMBALANCE_THRESHOLD = LOAD_AVG_ONE * 3 / 2;
+// Threads that ran this recently likely still have their data in the cache,
+// and the balancer leaves them alone.
+static uint64_t const CACHE_HOT_NS = TICK_NS / 2;
+
+// clock_monotonic_ns() when the balancer should run again.
+static uint64_t s_next_balance_ns;
+
+static struct Scheduler_RunQueue *current_run_queue(void) {
+        struct Scheduler_RunQueue *queue =
+                processor_run_queue(processor_current());
+        ASSERT(queue);
+        return queue;
+}
+
+static size_t runnable_count_of(struct Scheduler_RunQueue const *queue) {
+        return __atomic_load_n(&queue->runnable_count, __ATOMIC_RELAXED);
 }
 
-static struct Thread *
-remove_thread_from_queue(struct List *queue, struct ThreadEntry *entry) {
-        list_remove(queue, &entry->node_head);
-        struct Thread *result = entry->thread;
-        ASSERT(result);
-        kfree(entry);
-        return result;
+static bool is_idle(struct Scheduler_RunQueue const *queue) {
+        return __atomic_load_n(&queue->is_idle, __ATOMIC_RELAXED) &&
+               (runnable_count_of(queue) == 0);
 }
 
-// Returns NULL if thread couldn't be found
-WARN_UNUSED_RESULT static struct ThreadEntry *
-find_thread_in_queue(struct List *queue, struct Thread *thread) {
-        for (struct ThreadEntry *entry = (struct ThreadEntry *)queue->head;
-             entry;
-             entry = entry->node_head.next) {
-                if (entry->thread == thread) {
-                        return entry;
+static bool is_rt(struct Thread_SchedState const *state) {
+        return state->policy != SCHED_OTHER;
+}
+
+// Returns `NULL` if there are no real-time threads in the queue.
+static struct Thread *highest_rt_thread(struct Scheduler_RunQueue *queue) {
+        for (size_t i = RT_BITMAP_WORD_COUNT; 0 < i; --i) {
+                bitmap_word_t word = queue->rt_bitmap[i - 1];
+                if (word) {
+                        size_t priority = (i - 1) * BITMAP_BITS_PER_WORD +
+                                          (BITMAP_BITS_PER_WORD - 1) -
+                                          __builtin_clzll(word);
+                        return queue->rt_lists[priority].head;
                 }
         }
         return NULL;
 }
 
-// Returns `NULL` if there's no thread to dequeue.
-WARN_UNUSED_RESULT static struct Thread *dequeue_thread(struct List *queue) {
-        struct ThreadEntry *queued_thread = (struct ThreadEntry *)queue->tail;
-        if (!queued_thread) {
+static uint64_t load_of(struct Scheduler_RunQueue const *queue) {
+        // Idle processors don't get ticks to decay their average.
+        if (is_idle(queue)) {
+                return 0;
+        }
+        return __atomic_load_n(&queue->load_avg, __ATOMIC_RELAXED);
+}
+
+static unsigned weight_of(struct Thread_SchedState const *state) {
+        return NICE_TO_WEIGHT[state->nice - THREAD_NICE_MIN];
+}
+
+static uint64_t max_u64(uint64_t a, uint64_t b) { return (a < b) ? b : a; }
+
+static bool
+is_allowed_on(struct Thread *thread, struct Scheduler_RunQueue const *queue) {
+        return cpumask_has(
+                &thread_get_sched_state(thread)->affinity,
+                queue->processor_index
+        );
+}
+
+// Returns true if the queue's processor and its SMT siblings are all idle.
+static bool is_core_idle(struct Scheduler_RunQueue const *queue) {
+        cpumask_t const *siblings =
+                topology_sibling_mask(queue->processor_index);
+        size_t count = processor_count();
+        for (size_t i = cpumask_next(siblings, 0); i < count;
+             i = cpumask_next(siblings, i + 1)) {
+                struct Scheduler_RunQueue *sibling =
+                        processor_run_queue(processor_at(i));
+                if (sibling && !is_idle(sibling)) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+// Scores how good an idle queue is for a thread last ran on `preferred`.
+// Threads should spread across physical cores before they share one, so a
+// whole idle core scores highest, and then sharing the last level cache with
+// `preferred`.
+//
+// Returns 0 if the queue isn't idle.
+static unsigned idle_score_of(
+        struct Scheduler_RunQueue const *queue,
+        struct Scheduler_RunQueue const *preferred
+) {
+        if (!is_idle(queue)) {
+                return 0;
+        }
+        unsigned score = 1;
+        if (is_core_idle(queue)) {
+                score += 2;
+        }
+        if (cpumask_has(
+                    topology_llc_mask(preferred->processor_index),
+                    queue->processor_index
+            )) {
+                score += 1;
+        }
+        return score;
+}
+
+#define BEST_IDLE_SCORE 4
+
+// Picks the queue to put a thread that became runnable into. `preferred` is
+// where its cache is likely to be warm, and it's used unless it's busy or
+// shares its core with a busy one, while some other allowed processor does
+// better. (See idle_score_of())
+//
+// Returns `NULL` if none of allowed processors has started scheduling yet.
+static struct Scheduler_RunQueue *
+select_queue(struct Thread *thread, struct Scheduler_RunQueue *preferred) {
+        struct Scheduler_RunQueue *fallback = NULL, *best = NULL;
+        unsigned best_score = 0;
+        if (is_allowed_on(thread, preferred)) {
+                best_score = idle_score_of(preferred, preferred);
+                if (best_score == BEST_IDLE_SCORE) {
+                        return preferred;
+                }
+                if (best_score != 0) {
+                        best = preferred;
+                }
+                fallback = preferred;
+        }
+        size_t count = processor_count();
+        for (size_t i = 0; i < count; ++i) {
+                struct Scheduler_RunQueue *queue =
+                        processor_run_queue(processor_at(i));
+                if (!queue || !is_allowed_on(thread, queue)) {
+                        continue;
+                }
+                unsigned score = idle_score_of(queue, preferred);
+                if (best_score < score) {
+                        if (score == BEST_IDLE_SCORE) {
+                                return queue;
+                        }
+                        best = queue;
+                        best_score = score;
+                }
+                if (!fallback) {
+                        fallback = queue;
+                }
+        }
+        return best ? best : fallback;
+}
+
+// Returns `NULL` if the queue is empty.
+static struct Thread *leftmost_thread(struct Scheduler_RunQueue *queue) {
+        if (!queue->tree.root) {
                 return NULL;
         }
-        return remove_thread_from_queue(queue, queued_thread);
+        return avltree_min_node(queue->tree.root);
 }
 
-struct List s_schedule_wait_queue;
-struct List s_sleeping_threads;
-// TODO: Move this to processor-local structure
-tick_t s_remaining_thread_time;
-static struct SpinLock s_lock;
+static void update_min_vruntime(struct Scheduler_RunQueue *queue) {
+        struct Thread *leftmost = leftmost_thread(queue);
+        if (leftmost) {
+                queue->min_vruntime = max_u64(
+                        queue->min_vruntime,
+                        thread_get_sched_state(leftmost)->vruntime
+                );
+        }
+}
 
-static void add_thread_to_wait_queue(struct Thread *thread) {
-        ASSERT(thread);
-        enqueue_thread(&s_schedule_wait_queue, thread);
+// Real-time threads go behind others of the same priority, unless `at_head`
+// is set.
+static void enqueue_thread_at(
+        struct Scheduler_RunQueue *queue, struct Thread *thread, bool at_head
+) {
+        struct Thread_SchedState *state = thread_get_sched_state(thread);
+        ASSERT(!state->is_queued);
+        ASSERT(thread != queue->idle_thread);
+        if (is_rt(state)) {
+                if ((state->policy == SCHED_RR) && (state->rr_ticks_left == 0)) {
+                        state->rr_ticks_left = RR_TIMESLICE_TICKS;
+                }
+                struct List *list = &queue->rt_lists[state->rt_priority];
+                *(struct List_Node *)thread = (struct List_Node){0};
+                if (at_head) {
+                        list_insert_head(list, (struct List_Node *)thread);
+                } else {
+                        list_insert_tail(list, (struct List_Node *)thread);
+                }
+                bitmap_set(queue->rt_bitmap, state->rt_priority);
+        } else {
+                *(struct AVLTree_Node *)thread = (struct AVLTree_Node){0};
+                avltree_insert(&queue->tree, thread, state->vruntime);
+        }
+        state->run_queue = queue;
+        state->is_queued = true;
+        thread_account_enqueued(thread);
+        __atomic_store_n(
+                &queue->runnable_count,
+                queue->runnable_count + 1,
+                __ATOMIC_RELAXED
+        );
+}
+
+static void enqueue_thread(
+        struct Scheduler_RunQueue *queue, struct Thread *thread
+) {
+        enqueue_thread_at(queue, thread, false);
+}
+
+static void dequeue_thread(
+        struct Scheduler_RunQueue *queue, struct Thread *thread
+) {
+        struct Thread_SchedState *state = thread_get_sched_state(thread);
+        ASSERT(state->is_queued && (state->run_queue == queue));
+        if (is_rt(state)) {
+                struct List *list = &queue->rt_lists[state->rt_priority];
+                list_remove(list, (struct List_Node *)thread);
+                if (!list->head) {
+                        bitmap_clear(queue->rt_bitmap, state->rt_priority);
+                }
+        } else {
+                avltree_remove(&queue->tree, (struct AVLTree_Node *)thread);
+        }
+        state->run_queue = NULL;
+        state->is_queued = false;
+        __atomic_store_n(
+                &queue->runnable_count,
+                queue->runnable_count - 1,
+                __ATOMIC_RELAXED
+        );
+}
+
+// Puts thread that has been away(new, woken up, or moved from other
+// processor) into the queue.
+static void
+place_and_enqueue_thread(struct Scheduler_RunQueue *queue, struct Thread *thread) {
+        struct Thread_SchedState *state = thread_get_sched_state(thread);
+        if (state->is_new) {
+                state->vruntime = queue->min_vruntime;
+                state->is_new = false;
+        } else if (is_rt(state)) {
+                // Virtual runtime doesn't matter to real-time threads.
+        } else if (SLEEPER_CREDIT_NS < queue->min_vruntime) {
+                // Don't let it catch up all the time it was away, or it would
+                // take over the processor for a long time.
+                state->vruntime = max_u64(
+                        state->vruntime,
+                        queue->min_vruntime - SLEEPER_CREDIT_NS
+                );
+        }
+        enqueue_thread(queue, thread);
 }
 
-static void wakeup_thread(struct Thread *thread) {
-        struct ThreadEntry *entry =
-                find_thread_in_queue(&s_sleeping_threads, thread);
-        if (!entry) {
-                panic("Attempted to wake up non-existing or non-sleeping "
-                      "thread %u",
-                      thread);
+// Returns false if the thread isn't sleeping on given queue.
+//
+// If the thread should run on other processor, it's only taken off the queue,
+// and `*move_to_out` is set to where it should go. Caller must then pass it to
+// enqueue_and_kick(), after unlocking `queue`.
+WARN_UNUSED_RESULT static bool wakeup_thread(
+        struct Scheduler_RunQueue *queue,
+        struct Thread *thread,
+        struct Scheduler_RunQueue **move_to_out
+) {
+        struct Thread_SchedState *state = thread_get_sched_state(thread);
+        if (!state->is_sleeping || (state->run_queue != queue)) {
+                return false;
         }
-        remove_thread_from_queue(&s_sleeping_threads, entry);
+        state->is_sleeping = false;
+        state->run_queue = NULL;
         thread_set_sleep_scheduled(thread, false);
-        add_thread_to_wait_queue(thread);
+        struct Scheduler_RunQueue *target = select_queue(thread, queue);
+        if (!target) {
+                panic("None of thread %p's processors is running", thread);
+        }
+        if (target != queue) {
+                // Its virtual runtime means nothing on other queue, so it
+                // gets placed there like any other thread waking up.
+                state->vruntime = 0;
+                *move_to_out = target;
+                return true;
+        }
+        place_and_enqueue_thread(queue, thread);
+        return true;
 }
 
-void scheduler_sleep_until_mutex_unlock(struct Mutex *mutex) {
-        struct Thread *thread = thread_running();
-        thread_set_sleep_scheduled(thread, true);
-        thread_set_waiting_mutex(thread, mutex);
-        scheduler_yield();
-}
-
-static void wakeup_mutex_lock_successful_threads(void) {
-        struct ThreadEntry *next_entry = NULL;
-        for (struct ThreadEntry *entry =
-                     (struct ThreadEntry *)s_sleeping_threads.head;
-             entry;
-             entry = next_entry) {
-                // We must remember what the next thread was, because if we do
-                // end up waking up a thread, the current entry will be deleted.
-                next_entry = entry->node_head.next;
-                struct Mutex *mutex = thread_get_waiting_mutex(entry->thread);
-                if (!mutex) {
+static void put_thread_to_sleep(
+        struct Scheduler_RunQueue *queue, struct Thread *thread
+) {
+        struct Thread_SchedState *state = thread_get_sched_state(thread);
+        ASSERT(!state->is_queued && !state->is_sleeping);
+        state->run_queue = queue;
+        state->is_sleeping = true;
+}
+
+// Slows down timer interrupts of current processor when there's no one to
+// switch to. Caller must hold `queue`'s lock, and `queue` must be the current
+// processor's.
+static void update_tick_interval(struct Scheduler_RunQueue *queue) {
+        struct Processor_LocalState *processor = processor_current();
+        unsigned interval = 1;
+        if (queue->runnable_count == 0) {
+                if (processor_running_thread(processor) != queue->idle_thread) {
+                        interval = NOHZ_SINGLE_THREAD_TICKS;
+                } else {
+                        interval = NOHZ_IDLE_TICKS;
+                }
+        }
+        timer_set_tick_interval(interval);
+}
+
+// Removes a queued thread from `from`, so that it can run on `to`'s processor.
+// Caller must hold both queues' lock.
+static void take_queued_thread(
+        struct Scheduler_RunQueue *from,
+        struct Scheduler_RunQueue *to,
+        struct Thread *thread
+) {
+        dequeue_thread(from, thread);
+        // Virtual runtime only makes sense relative to its queue, so we keep
+        // its distance from the queue's minimum.
+        struct Thread_SchedState *state = thread_get_sched_state(thread);
+        uint64_t lag = 0;
+        if (from->min_vruntime < state->vruntime) {
+                lag = state->vruntime - from->min_vruntime;
+        }
+        state->vruntime = to->min_vruntime + lag;
+}
+
+// Returns the queue with most threads among ones inside `mask`(or outside of
+// it, if `is_inside` is false), if it has more than `min_count`.
+//
+// Returns `NULL` if there's no such queue.
+static struct Scheduler_RunQueue *find_busiest_queue(
+        struct Scheduler_RunQueue const *queue,
+        cpumask_t const *mask,
+        bool is_inside,
+        size_t min_count
+) {
+        struct Scheduler_RunQueue *busiest = NULL;
+        size_t busiest_count = min_count;
+        size_t count = processor_count();
+        for (size_t i = 0; i < count; ++i) {
+                if (cpumask_has(mask, i) != is_inside) {
                         continue;
                 }
-                if (!mutex_try_lock_with_owner(mutex, entry->thread)) {
+                struct Scheduler_RunQueue *other =
+                        processor_run_queue(processor_at(i));
+                if (!other || (other == queue)) {
                         continue;
                 }
-                thread_set_waiting_mutex(entry->thread, NULL);
-                wakeup_thread(entry->thread);
+                size_t other_count = runnable_count_of(other);
+                if (busiest_count < other_count) {
+                        busiest = other;
+                        busiest_count = other_count;
+                }
+        }
+        return busiest;
+}
+
+// Takes a thread from the busiest processor, if `queue` is empty or the other
+// one has noticeably more threads. Caller must hold `queue`'s lock.
+//
+// Returns `NULL` if there's nothing worth stealing.
+WARN_UNUSED_RESULT static struct Thread *
+steal_thread(struct Scheduler_RunQueue *queue) {
+        size_t min_count = 0;
+        if (queue->runnable_count != 0) {
+                min_count = queue->runnable_count + STEAL_IMBALANCE_THRESHOLD;
+        }
+        // Threads from processors sharing our last level cache may still have
+        // their data there, so others are only looked at if there's nothing
+        // worth stealing nearby.
+        cpumask_t const *llc = topology_llc_mask(queue->processor_index);
+        struct Scheduler_RunQueue *busiest =
+                find_busiest_queue(queue, llc, true, min_count);
+        if (!busiest) {
+                busiest = find_busiest_queue(queue, llc, false, min_count);
+        }
+        if (!busiest) {
+                return NULL;
+        }
+        // We are already holding our own lock, so we must not wait here.
+        // Otherwise two processors stealing from each other would deadlock.
+        bool prev_interrupt_state;
+        if (!spinlock_try_lock(&busiest->lock, &prev_interrupt_state)) {
+                return NULL;
+        }
+        // Threads in other processor's queue always have their context saved,
+        // because the owner keeps its queue locked until context switch is
+        // done.
+        struct Thread *thread = leftmost_thread(busiest);
+        while (thread && !is_allowed_on(thread, queue)) {
+                thread = avltree_successor_of((struct AVLTree_Node *)thread);
+        }
+        if (thread) {
+                take_queued_thread(busiest, queue, thread);
+        }
+        spinlock_unlock(&busiest->lock, prev_interrupt_state);
+        return thread;
+}
+
+// Picks and removes next thread to run from the queue. If there's nothing
+// to run, returns the idle thread unless `can_idle` is false.
+//
+// Returns `NULL` if there's no next thread to run.
+WARN_UNUSED_RESULT static struct Thread *
+next_thread_to_run(struct Scheduler_RunQueue *queue, bool can_idle) {
+        struct Thread *rt_thread = highest_rt_thread(queue);
+        if (rt_thread && !queue->is_rt_throttled) {
+                dequeue_thread(queue, rt_thread);
+                return rt_thread;
+        }
+        struct Thread *thread = steal_thread(queue);
+        if (thread) {
+                return thread;
         }
+        thread = leftmost_thread(queue);
+        if (thread) {
+                dequeue_thread(queue, thread);
+                update_min_vruntime(queue);
+                return thread;
+        }
+        // Throttled real-time threads still run when there's nothing else.
+        if (rt_thread) {
+                dequeue_thread(queue, rt_thread);
+                return rt_thread;
+        }
+        if (can_idle) {
+                return queue->idle_thread;
+        }
+        return NULL;
 }
 
-// Returns `NULL` if there's no next thread to run
-WARN_UNUSED_RESULT static struct Thread *next_thread_to_run(void) {
-        return dequeue_thread(&s_schedule_wait_queue);
+// Switches to `to_thread`. Caller must have put `from_thread` where it
+// belongs, and must unlock current processor's queue after this returns.
+static void
+switch_to(struct Scheduler_RunQueue *queue, struct Thread *from_thread, struct Thread *to_thread) {
+        queue->current_ticks = 0;
+        thread_get_sched_state(from_thread)->last_ran_ns = clock_monotonic_ns();
+        __atomic_store_n(
+                &queue->is_idle,
+                to_thread == queue->idle_thread,
+                __ATOMIC_RELAXED
+        );
+        thread_context_switch(from_thread, to_thread);
+}
+
+// Makes the processor owning `queue` look at its queue again.
+static void kick(struct Scheduler_RunQueue *queue) {
+        processor_send_reschedule_ipi(processor_at(queue->processor_index));
+}
+
+// Returns true if `thread` queued on the current processor's `queue` should
+// run right away, instead of waiting for the next tick. Caller must hold
+// `queue`'s lock.
+static bool
+should_preempt_current(struct Scheduler_RunQueue *queue, struct Thread *thread) {
+        struct Thread_SchedState *state = thread_get_sched_state(thread);
+        if (!is_rt(state) || queue->is_rt_throttled) {
+                return false;
+        }
+        struct Thread *current = processor_running_thread(processor_current());
+        struct Thread_SchedState *current_state =
+                thread_get_sched_state(current);
+        return (current == queue->idle_thread) || !is_rt(current_state) ||
+               (current_state->rt_priority < state->rt_priority);
+}
+
+// Puts a thread that became runnable into `queue`, and lets its processor
+// know. Interrupts must be disabled.
+static void
+enqueue_and_kick(struct Scheduler_RunQueue *queue, struct Thread *thread) {
+        bool prev_interrupt_state;
+        spinlock_lock(&queue->lock, &prev_interrupt_state);
+        place_and_enqueue_thread(queue, thread);
+        bool is_local = queue == current_run_queue();
+        bool need_kick = !is_local;
+        if (is_local) {
+                update_tick_interval(queue);
+                // We may be deep inside something holding locks, so we let
+                // the IPI handler switch once interrupts are enabled again.
+                need_kick = should_preempt_current(queue, thread);
+        }
+        spinlock_unlock(&queue->lock, prev_interrupt_state);
+        if (need_kick) {
+                kick(queue);
+        }
+}
+
+// Threads the previous thread on this processor left behind.
+struct Leftovers {
+        struct Thread *leaving_thread, *exited_thread;
+};
+
+// Takes the threads that are leaving this processor, if any. Caller must hold
+// `queue`'s lock, and pass them to handle_leftovers() after unlocking.
+WARN_UNUSED_RESULT static struct Leftovers
+take_leftovers(struct Scheduler_RunQueue *queue) {
+        struct Leftovers leftovers = {
+                .leaving_thread = queue->leaving_thread,
+                .exited_thread = queue->exited_thread,
+        };
+        queue->leaving_thread = NULL;
+        queue->exited_thread = NULL;
+        return leftovers;
+}
+
+static void handle_leftovers(struct Leftovers const *leftovers) {
+        if (leftovers->leaving_thread) {
+                scheduler_wakeup_thread(leftovers->leaving_thread);
+        }
+        if (leftovers->exited_thread) {
+                thread_on_exited(leftovers->exited_thread);
+        }
 }
 
 void scheduler_add_thread_to_wait_queue(struct Thread *thread) {
         ASSERT(thread);
+        ENTER_NO_INTERRUPT_SECTION();
+        struct Scheduler_RunQueue *queue =
+                select_queue(thread, current_run_queue());
+        if (!queue) {
+                panic("None of thread %p's processors is running", thread);
+        }
+        enqueue_and_kick(queue, thread);
+        LEAVE_NO_INTERRUPT_SECTION();
+}
+
+// Wakes up `thread` if it's sleeping on `queue`. Interrupts must be disabled.
+//
+// Returns false if the thread isn't sleeping on given queue.
+WARN_UNUSED_RESULT static bool
+wakeup_and_kick(struct Scheduler_RunQueue *queue, struct Thread *thread) {
         bool prev_interrupt_state;
-        spinlock_lock(&s_lock, &prev_interrupt_state);
-        add_thread_to_wait_queue(thread);
-        spinlock_unlock(&s_lock, prev_interrupt_state);
+        spinlock_lock(&queue->lock, &prev_interrupt_state);
+        struct Scheduler_RunQueue *move_to = NULL;
+        bool woken_up = wakeup_thread(queue, thread, &move_to);
+        bool is_local = queue == current_run_queue();
+        bool need_kick = woken_up && !is_local;
+        if (woken_up && !move_to && is_local) {
+                update_tick_interval(queue);
+                need_kick = should_preempt_current(queue, thread);
+        }
+        spinlock_unlock(&queue->lock, prev_interrupt_state);
+        if (move_to) {
+                enqueue_and_kick(move_to, thread);
+        } else if (need_kick) {
+                kick(queue);
+        }
+        return woken_up;
 }
 
 void scheduler_wakeup_thread(struct Thread *thread) {
-        bool prev_interrupt_state;
-        spinlock_lock(&s_lock, &prev_interrupt_state);
-        wakeup_thread(thread);
-        spinlock_unlock(&s_lock, prev_interrupt_state);
+        ENTER_NO_INTERRUPT_SECTION();
+        // We don't know which processor the thread went to sleep on.
+        size_t count = processor_count();
+        for (size_t i = 0; i < count; ++i) {
+                struct Scheduler_RunQueue *queue =
+                        processor_run_queue(processor_at(i));
+                if (!queue) {
+                        continue;
+                }
+                if (wakeup_and_kick(queue, thread)) {
+                        LEAVE_NO_INTERRUPT_SECTION();
+                        return;
+                }
+        }
+        panic("Attempted to wake up non-existing or non-sleeping thread %p",
+              thread);
+}
+
+// Returns true if the running real-time thread should keep running, rather
+// than give the processor to the next thread. Caller must hold `queue`'s lock.
+static bool should_keep_rt_thread(
+        struct Scheduler_RunQueue *queue, struct Thread_SchedState const *state
+) {
+        if (queue->is_rt_throttled) {
+                return queue->runnable_count == 0;
+        }
+        // Threads of the same priority take turns, but lower ones and fair
+        // threads have to wait.
+        struct Thread *next = highest_rt_thread(queue);
+        return !next ||
+               (thread_get_sched_state(next)->rt_priority < state->rt_priority);
 }
 
 void scheduler_yield(void) {
+        ENTER_NO_INTERRUPT_SECTION();
+        struct Scheduler_RunQueue *queue = current_run_queue();
         bool prev_interrupt_state;
-        if (!spinlock_try_lock(&s_lock, &prev_interrupt_state)) {
-                return;
-        }
-        wakeup_mutex_lock_successful_threads();
+        spinlock_lock(&queue->lock, &prev_interrupt_state);
         struct Processor_LocalState *processor = processor_current();
-        struct Thread *to_thread = next_thread_to_run();
-        if (to_thread) {
-                struct Thread *from_thread =
-                        processor_running_thread(processor);
-                ASSERT(from_thread);
-                ASSERT(from_thread != to_thread);
-                bool is_sleep_scheduled =
-                        thread_is_sleep_scheduled(from_thread);
+        struct Thread *from_thread = processor_running_thread(processor);
+        ASSERT(from_thread);
+        bool is_sleep_scheduled = thread_is_sleep_scheduled(from_thread);
+        struct Thread_SchedState *from_state =
+                thread_get_sched_state(from_thread);
+        // Idle thread only runs when there's nothing else, so there's no
+        // point switching to it unless we are going to sleep.
+        struct Thread *to_thread = NULL;
+        if (is_sleep_scheduled || !is_rt(from_state) ||
+            !should_keep_rt_thread(queue, from_state)) {
+                to_thread = next_thread_to_run(queue, is_sleep_scheduled);
+        }
+        struct Leftovers leftovers = {0};
+        if (to_thread && (to_thread != from_thread)) {
                 if (is_sleep_scheduled) {
                         thread_set_sleep_scheduled(from_thread, false);
-                        enqueue_thread(&s_sleeping_threads, from_thread);
-                } else {
-                        add_thread_to_wait_queue(from_thread);
+                        put_thread_to_sleep(queue, from_thread);
+                        if (!is_allowed_on(from_thread, queue)) {
+                                ASSERT(!queue->leaving_thread);
+                                queue->leaving_thread = from_thread;
+                        }
+                } else if (from_thread != queue->idle_thread) {
+                        // Real-time thread preempted by a higher priority one
+                        // runs first among its peers once it gets back.
+                        struct Thread_SchedState *to_state =
+                                thread_get_sched_state(to_thread);
+                        bool is_preempted = is_rt(from_state) &&
+                                            is_rt(to_state) &&
+                                            (from_state->rt_priority <
+                                             to_state->rt_priority);
+                        enqueue_thread_at(queue, from_thread, is_preempted);
+                }
+                switch_to(queue, from_thread, to_thread);
+                // We may have been moved to another processor while we were
+                // away, and it's that processor's queue that is locked now.
+                queue = current_run_queue();
+                leftovers = take_leftovers(queue);
+        }
+        update_tick_interval(queue);
+        spinlock_unlock(&queue->lock, prev_interrupt_state);
+        handle_leftovers(&leftovers);
+        LEAVE_NO_INTERRUPT_SECTION();
+}
+
+void scheduler_sleep_until_mutex_unlock(struct Mutex *mutex) {
+        struct Thread *thread = thread_running();
+        ENTER_NO_INTERRUPT_SECTION();
+        while (1) {
+                struct Scheduler_RunQueue *queue = current_run_queue();
+                bool prev_interrupt_state;
+                spinlock_lock(&queue->lock, &prev_interrupt_state);
+                struct Thread *to_thread = next_thread_to_run(queue, true);
+                if (!to_thread || (to_thread == thread)) {
+                        // There's nothing else to run here(Not even the idle
+                        // thread), so we can't sleep. Try again after next
+                        // interrupt.
+                        spinlock_unlock(&queue->lock, prev_interrupt_state);
+                        if (mutex_try_lock_with_owner(mutex, thread)) {
+                                break;
+                        }
+                        interrupts_enable();
+                        interrupts_wait();
+                        interrupts_disable();
+                        continue;
+                }
+                struct Mutex_Waiter waiter = {
+                        .thread = thread,
+                        .run_queue = queue,
+                };
+                if (!mutex_add_waiter(mutex, &waiter)) {
+                        // Mutex got unlocked in the meantime, and it's ours.
+                        // `to_thread` never got to run, so it goes back to
+                        // where it was.
+                        if (to_thread != queue->idle_thread) {
+                                enqueue_thread_at(queue, to_thread, true);
+                        }
+                        update_tick_interval(queue);
+                        spinlock_unlock(&queue->lock, prev_interrupt_state);
+                        break;
+                }
+                // mutex_unlock() may see the waiter before we are done
+                // switching, but it can't wake us up until we unlock the
+                // queue. (See scheduler_wakeup_mutex_waiter())
+                put_thread_to_sleep(queue, thread);
+                switch_to(queue, thread, to_thread);
+                // We own the mutex now.
+                queue = current_run_queue();
+                struct Leftovers leftovers = take_leftovers(queue);
+                update_tick_interval(queue);
+                spinlock_unlock(&queue->lock, prev_interrupt_state);
+                handle_leftovers(&leftovers);
+                break;
+        }
+        LEAVE_NO_INTERRUPT_SECTION();
+}
+
+void scheduler_wakeup_mutex_waiter(struct Mutex_Waiter const *waiter) {
+        ENTER_NO_INTERRUPT_SECTION();
+        // Queue stays locked until the thread is fully switched out, so
+        // waking it up waits for that.
+        bool woken_up = wakeup_and_kick(waiter->run_queue, waiter->thread);
+        ASSERT(woken_up);
+        LEAVE_NO_INTERRUPT_SECTION();
+}
+
+void scheduler_exit_current_thread(void) {
+        interrupts_disable();
+        struct Thread *thread = thread_running();
+        while (1) {
+                struct Scheduler_RunQueue *queue = current_run_queue();
+                bool prev_interrupt_state;
+                spinlock_lock(&queue->lock, &prev_interrupt_state);
+                struct Thread *to_thread = next_thread_to_run(queue, true);
+                if (to_thread) {
+                        // We are never coming back, and the next thread
+                        // takes care of what's left of us.
+                        ASSERT(!queue->exited_thread);
+                        queue->exited_thread = thread;
+                        switch_to(queue, thread, to_thread);
+                        UNREACHABLE();
+                }
+                // Idle thread isn't there yet. Try again after next interrupt.
+                spinlock_unlock(&queue->lock, prev_interrupt_state);
+                interrupts_enable();
+                interrupts_wait();
+                interrupts_disable();
+        }
+}
+
+int scheduler_set_nice(int nice) {
+        if (nice < THREAD_NICE_MIN) {
+                nice = THREAD_NICE_MIN;
+        } else if (THREAD_NICE_MAX < nice) {
+                nice = THREAD_NICE_MAX;
+        }
+        ENTER_NO_INTERRUPT_SECTION();
+        // Running thread isn't in any queue, and only this processor charges
+        // its runtime.
+        thread_get_sched_state(thread_running())->nice = nice;
+        LEAVE_NO_INTERRUPT_SECTION();
+        return nice;
+}
+
+int scheduler_get_nice(void) {
+        ENTER_NO_INTERRUPT_SECTION();
+        int nice = thread_get_sched_state(thread_running())->nice;
+        LEAVE_NO_INTERRUPT_SECTION();
+        return nice;
+}
+
+int scheduler_set_affinity(cpumask_t const *mask) {
+        bool has_running_processor = false;
+        size_t count = processor_count();
+        for (size_t i = 0; i < count; ++i) {
+                if (cpumask_has(mask, i) &&
+                    processor_run_queue(processor_at(i))) {
+                        has_running_processor = true;
+                        break;
+                }
+        }
+        if (!has_running_processor) {
+                return -EINVAL;
+        }
+        ENTER_NO_INTERRUPT_SECTION();
+        struct Thread *thread = thread_running();
+        // Running thread isn't in any queue, so no one else looks at it.
+        thread_get_sched_state(thread)->affinity = *mask;
+        if (!is_allowed_on(thread, current_run_queue())) {
+                // We go to sleep here, and whoever runs next on this processor
+                // wakes us up on one of the allowed processors.
+                thread_set_sleep_scheduled(thread, true);
+                scheduler_yield();
+        }
+        LEAVE_NO_INTERRUPT_SECTION();
+        return 0;
+}
+
+cpumask_t scheduler_get_affinity(void) {
+        ENTER_NO_INTERRUPT_SECTION();
+        cpumask_t mask = thread_get_sched_state(thread_running())->affinity;
+        LEAVE_NO_INTERRUPT_SECTION();
+        return mask;
+}
+
+// Counts ticks of the real-time period, and throttles real-time threads once
+// they've used up their budget for it.
+static void charge_rt_period(
+        struct Scheduler_RunQueue *queue, bool is_rt_running, tick_t elapsed_ticks
+) {
+        queue->rt_period_ticks += elapsed_ticks;
+        if (is_rt_running) {
+                queue->rt_used_ticks += elapsed_ticks;
+        }
+        if (RT_PERIOD_TICKS <= queue->rt_period_ticks) {
+                queue->rt_period_ticks = 0;
+                queue->rt_used_ticks = 0;
+                queue->is_rt_throttled = false;
+        } else if (RT_RUNTIME_TICKS <= queue->rt_used_ticks) {
+                queue->is_rt_throttled = true;
+        }
+}
+
+// Returns true if current real-time thread should give the processor to
+// others.
+static bool charge_current_rt_thread(
+        struct Scheduler_RunQueue *queue,
+        struct Thread_SchedState *state,
+        tick_t elapsed_ticks
+) {
+        if (queue->is_rt_throttled) {
+                return queue->tree.root != NULL;
+        }
+        struct Thread *next = highest_rt_thread(queue);
+        int next_priority = 0;
+        if (next) {
+                next_priority = thread_get_sched_state(next)->rt_priority;
+        }
+        if (state->rt_priority < next_priority) {
+                return true;
+        }
+        if ((state->policy != SCHED_RR) || (elapsed_ticks == 0)) {
+                return false;
+        }
+        if (elapsed_ticks < state->rr_ticks_left) {
+                state->rr_ticks_left -= elapsed_ticks;
+                return false;
+        }
+        if (next_priority == state->rt_priority) {
+                // Time slice is over, and it's the next one's turn. It gets a
+                // new slice when it goes back to the queue.
+                state->rr_ticks_left = 0;
+                return true;
+        }
+        state->rr_ticks_left = RR_TIMESLICE_TICKS;
+        return false;
+}
+
+// Returns true if current thread should give the processor to others.
+static bool charge_current_thread(
+        struct Scheduler_RunQueue *queue,
+        struct Thread *thread,
+        tick_t elapsed_ticks
+) {
+        queue->current_ticks += elapsed_ticks;
+        if (thread == queue->idle_thread) {
+                charge_rt_period(queue, false, elapsed_ticks);
+                return queue->runnable_count != 0;
+        }
+        struct Thread_SchedState *state = thread_get_sched_state(thread);
+        charge_rt_period(queue, is_rt(state), elapsed_ticks);
+        if (is_rt(state)) {
+                return charge_current_rt_thread(queue, state, elapsed_ticks);
+        }
+        state->vruntime +=
+                elapsed_ticks * TICK_NS * NICE_0_WEIGHT / weight_of(state);
+        bool is_rt_waiting =
+                highest_rt_thread(queue) && !queue->is_rt_throttled;
+        struct Thread *leftmost = leftmost_thread(queue);
+        if (!leftmost) {
+                queue->min_vruntime =
+                        max_u64(queue->min_vruntime, state->vruntime);
+                return is_rt_waiting;
+        }
+        update_min_vruntime(queue);
+        if (is_rt_waiting) {
+                return true;
+        }
+        if (queue->current_ticks < MIN_RUN_TICKS) {
+                return false;
+        }
+        uint64_t leftmost_vruntime =
+                thread_get_sched_state(leftmost)->vruntime;
+        return (leftmost_vruntime + PREEMPT_GRANULARITY_NS) < state->vruntime;
+}
+
+// Caller must hold `queue`'s lock.
+static void update_load_avg(
+        struct Scheduler_RunQueue *queue,
+        struct Thread *running_thread,
+        tick_t elapsed_ticks
+) {
+        uint64_t load = queue->runnable_count;
+        if (running_thread != queue->idle_thread) {
+                ++load;
+        }
+        load *= LOAD_AVG_ONE;
+        uint64_t avg = queue->load_avg;
+        if (LOAD_AVG_MAX_TICKS < elapsed_ticks) {
+                elapsed_ticks = LOAD_AVG_MAX_TICKS;
+        }
+        for (tick_t i = 0; i < elapsed_ticks; ++i) {
+                avg = avg - avg / LOAD_AVG_PERIOD_TICKS +
+                      load / LOAD_AVG_PERIOD_TICKS;
+        }
+        __atomic_store_n(&queue->load_avg, avg, __ATOMIC_RELAXED);
+}
+
+static bool is_cache_hot(struct Thread *thread, uint64_t now_ns) {
+        uint64_t last_ran_ns = thread_get_sched_state(thread)->last_ran_ns;
+        return (last_ran_ns != 0) && (now_ns < last_ran_ns + CACHE_HOT_NS);
+}
+
+// Moves a thread that isn't cache hot from `from` to `to`.
+//
+// Returns false if there was no such thread.
+static bool migrate_thread(
+        struct Scheduler_RunQueue *from,
+        struct Scheduler_RunQueue *to,
+        uint64_t now_ns
+) {
+        // Locks are always taken in processor order, so two balancers can't
+        // deadlock. (Stealers only try-lock others, and wakers take one lock
+        // at a time)
+        struct Scheduler_RunQueue *first = from, *second = to;
+        if (to->processor_index < from->processor_index) {
+                first = to;
+                second = from;
+        }
+        bool first_prev_interrupt_state, second_prev_interrupt_state;
+        spinlock_lock(&first->lock, &first_prev_interrupt_state);
+        spinlock_lock(&second->lock, &second_prev_interrupt_state);
+        // Leftmost ones have waited longest, so they are least likely to be
+        // hot.
+        struct Thread *thread = leftmost_thread(from);
+        while (thread && (!is_allowed_on(thread, to) ||
+                          is_cache_hot(thread, now_ns))) {
+                thread = avltree_successor_of((struct AVLTree_Node *)thread);
+        }
+        if (thread) {
+                take_queued_thread(from, to, thread);
+                enqueue_thread(to, thread);
+        }
+        spinlock_unlock(&second->lock, second_prev_interrupt_state);
+        spinlock_unlock(&first->lock, first_prev_interrupt_state);
+        return thread != NULL;
+}
+
+// Moves a thread from the most loaded queue to the least loaded one, if it's
+// time to balance and they differ enough. Interrupts must be disabled.
+static void balance_if_due(void) {
+        uint64_t now_ns = clock_monotonic_ns();
+        uint64_t next_ns = __atomic_load_n(&s_next_balance_ns, __ATOMIC_RELAXED);
+        if (now_ns < next_ns) {
+                return;
+        }
+        // Only one processor gets to balance each interval.
+        if (!__atomic_compare_exchange_n(
+                    &s_next_balance_ns,
+                    &next_ns,
+                    now_ns + BALANCE_INTERVAL_NS,
+                    false,
+                    __ATOMIC_RELAXED,
+                    __ATOMIC_RELAXED
+            )) {
+                return;
+        }
+        struct Scheduler_RunQueue *busiest = NULL, *idlest = NULL;
+        uint64_t busiest_load = 0, idlest_load = 0;
+        size_t count = processor_count();
+        for (size_t i = 0; i < count; ++i) {
+                struct Scheduler_RunQueue *queue =
+                        processor_run_queue(processor_at(i));
+                if (!queue) {
+                        continue;
+                }
+                uint64_t load = load_of(queue);
+                if (!busiest || (busiest_load < load)) {
+                        busiest = queue;
+                        busiest_load = load;
                 }
-                thread_context_switch(from_thread, to_thread);
+                if (!idlest || (load < idlest_load)) {
+                        idlest = queue;
+                        idlest_load = load;
+                }
+        }
+        if (!busiest || (busiest_load < idlest_load + BALANCE_IMBALANCE_THRESHOLD)) {
+                return;
+        }
+        if (!migrate_thread(busiest, idlest, now_ns)) {
+                return;
+        }
+        // If it's ours, charge_current_thread() will notice it soon.
+        if (idlest != current_run_queue()) {
+                kick(idlest);
         }
-        spinlock_unlock(&s_lock, prev_interrupt_state);
 }
 
-void scheduler_on_timer_tick(void) {
+void scheduler_on_timer_tick(tick_t elapsed_ticks) {
         ASSERT(!interrupts_are_enabled());
-        bool need_switch = false;
+        struct Scheduler_RunQueue *queue =
+                processor_run_queue(processor_current());
+        if (!queue) {
+                return;
+        }
+        balance_if_due();
+        bool need_switch;
         {
                 bool prev_interrupt_state;
-                if (!spinlock_try_lock(&s_lock, &prev_interrupt_state)) {
+                if (!spinlock_try_lock(&queue->lock, &prev_interrupt_state)) {
+                        // Someone is stealing from us. We'll charge these
+                        // ticks on next tick.
+                        queue->pending_ticks += elapsed_ticks;
                         return;
                 }
-                if (--s_remaining_thread_time <= 0) {
-                        s_remaining_thread_time = MAX_THREAD_TIME;
-                        need_switch = true;
+                elapsed_ticks += queue->pending_ticks;
+                queue->pending_ticks = 0;
+                struct Thread *thread =
+                        processor_running_thread(processor_current());
+                update_load_avg(queue, thread, elapsed_ticks);
+                need_switch =
+                        charge_current_thread(queue, thread, elapsed_ticks);
+                if (!need_switch) {
+                        update_tick_interval(queue);
+                }
+                spinlock_unlock(&queue->lock, prev_interrupt_state);
+        }
+        if (need_switch) {
+                scheduler_yield();
+        }
+}
+
+// Switches away from the current thread if something in the queue should
+// preempt it. Interrupts must be disabled.
+static void preempt_if_needed(void) {
+        ASSERT(!interrupts_are_enabled());
+        struct Scheduler_RunQueue *queue =
+                processor_run_queue(processor_current());
+        if (!queue) {
+                return;
+        }
+        bool need_switch;
+        {
+                bool prev_interrupt_state;
+                spinlock_lock(&queue->lock, &prev_interrupt_state);
+                // Nothing to charge, but it tells if new thread should
+                // preempt the current one.
+                need_switch = charge_current_thread(
+                        queue, processor_running_thread(processor_current()), 0
+                );
+                if (!need_switch) {
+                        update_tick_interval(queue);
                 }
-                spinlock_unlock(&s_lock, prev_interrupt_state);
+                spinlock_unlock(&queue->lock, prev_interrupt_state);
         }
         if (need_switch) {
                 scheduler_yield();
         }
 }
 
+void scheduler_on_reschedule_ipi(void) { preempt_if_needed(); }
+
+int scheduler_set_policy(int policy, int rt_priority) {
+        switch (policy) {
+        case SCHED_OTHER:
+                if (rt_priority != 0) {
+                        return -EINVAL;
+                }
+                break;
+        case SCHED_FIFO:
+        case SCHED_RR:
+                if ((rt_priority < THREAD_RT_PRIORITY_MIN) ||
+                    (THREAD_RT_PRIORITY_MAX < rt_priority)) {
+                        return -EINVAL;
+                }
+                if (!process_is_kernel(process_running())) {
+                        return -EPERM;
+                }
+                break;
+        default:
+                return -EINVAL;
+        }
+        ENTER_NO_INTERRUPT_SECTION();
+        struct Scheduler_RunQueue *queue = current_run_queue();
+        bool prev_interrupt_state;
+        spinlock_lock(&queue->lock, &prev_interrupt_state);
+        // Running thread isn't in any queue, so it can change its place
+        // freely.
+        struct Thread_SchedState *state =
+                thread_get_sched_state(thread_running());
+        if (is_rt(state) && (policy == SCHED_OTHER)) {
+                // Its virtual runtime went stale while it was real-time.
+                state->vruntime = queue->min_vruntime;
+        }
+        state->policy = policy;
+        state->rt_priority = rt_priority;
+        state->rr_ticks_left = RR_TIMESLICE_TICKS;
+        spinlock_unlock(&queue->lock, prev_interrupt_state);
+        // Someone waiting may outrank us now.
+        preempt_if_needed();
+        LEAVE_NO_INTERRUPT_SECTION();
+        return 0;
+}
+
+int scheduler_get_policy(void) {
+        ENTER_NO_INTERRUPT_SECTION();
+        int policy = thread_get_sched_state(thread_running())->policy;
+        LEAVE_NO_INTERRUPT_SECTION();
+        return policy;
+}
+
+int scheduler_get_rt_priority(void) {
+        ENTER_NO_INTERRUPT_SECTION();
+        int priority = thread_get_sched_state(thread_running())->rt_priority;
+        LEAVE_NO_INTERRUPT_SECTION();
+        return priority;
+}
+
 void scheduler_about_to_enter_new_thread(void) {
-        spinlock_unlock_without_restoring_interrupt(&s_lock);
+        struct Scheduler_RunQueue *queue = current_run_queue();
+        struct Leftovers leftovers = take_leftovers(queue);
+        update_tick_interval(queue);
+        spinlock_unlock_without_restoring_interrupt(&queue->lock);
+        handle_leftovers(&leftovers);
 }
 
-void scheduler_init_for_bsp(void (*thread_entry)()) {
-        s_remaining_thread_time = MAX_THREAD_TIME;
+static struct Scheduler_RunQueue *create_run_queue(void) {
+        struct Scheduler_RunQueue *queue = kmalloc(sizeof(*queue));
+        if (!queue) {
+                panic("Not enough kmalloc memory to create run queue");
+        }
+        kmemset(queue, 0, sizeof(*queue));
+        return queue;
+}
 
+// Creates run queue for the current processor, and enters its boot thread.
+NORETURN static void init_for_current_processor(
+        char const *boot_thread_name, void (*thread_entry)()
+) {
+        timer_init_for_current_processor();
+        schedlatency_init_for_current_processor();
+        topology_add_current_processor();
+        struct Scheduler_RunQueue *queue = create_run_queue();
+        queue->processor_index = processor_current()->cpu_num;
         struct Thread *kernel_boot_thread =
-                thread_create(process_kernel(), "boot/idle(bsp)", thread_entry);
+                thread_create(process_kernel(), boot_thread_name, thread_entry);
         if (!kernel_boot_thread) {
                 panic("Failed to spawn kernel boot thread");
         }
+        // It becomes the idle thread later, which must stay on this processor.
+        struct Thread_SchedState *state =
+                thread_get_sched_state(kernel_boot_thread);
+        state->affinity = cpumask_of(queue->processor_index);
+        state->is_new = false;
         // Scheduler gets unlocked when entering a new thread, so it needs to be
         // locked first.
         bool prev_interrupt_state;
-        spinlock_lock(&s_lock, &prev_interrupt_state);
+        spinlock_lock(&queue->lock, &prev_interrupt_state);
+        processor_set_run_queue(processor_current(), queue);
         thread_enter_initial_kernel_thread(kernel_boot_thread);
 }
 
+void scheduler_init_for_bsp(void (*thread_entry)()) {
+        init_for_current_processor("boot/idle(bsp)", thread_entry);
+}
+
 void scheduler_init_for_ap(void (*thread_entry)()) {
-        struct Thread *kernel_boot_thread =
-                thread_create(process_kernel(), "boot/idle(ap)", thread_entry);
-        if (!kernel_boot_thread) {
-                panic("Failed to spawn kernel boot thread");
-        }
-        // Scheduler gets unlocked when entering a new thread, so it needs to be locked first.
-        bool prev_interrupt_state;
-        spinlock_lock(&s_lock, &prev_interrupt_state);
-        thread_enter_initial_kernel_thread(kernel_boot_thread);
+        init_for_current_processor("boot/idle(ap)", thread_entry);
 }
 
 void scheduler_run_idle_loop() {
+        ENTER_NO_INTERRUPT_SECTION();
+        struct Thread *thread = thread_running();
+        struct Scheduler_RunQueue *queue = current_run_queue();
+        ASSERT(is_allowed_on(thread, queue));
+        bool prev_interrupt_state;
+        spinlock_lock(&queue->lock, &prev_interrupt_state);
+        ASSERT(!queue->idle_thread);
+        queue->idle_thread = thread;
+        __atomic_store_n(&queue->is_idle, true, __ATOMIC_RELAXED);
+        spinlock_unlock(&queue->lock, prev_interrupt_state);
+        LEAVE_NO_INTERRUPT_SECTION();
         while (1) {
                 interrupts_wait();
                 scheduler_yield();
@@ -3,7 +3,9 @@
 //
 // SPDX-License-Identifier: BSD-2-Clause
 #pragma once
+#include "kernel/api/bits/sched.h"
 #include "kernel/arch/arch.h"
+#include "kernel/kernel.h"
 #include "kernel/lock/mutex.h"
 #include "kernel/utility/utility.h"
 #include <stdbool.h>
@@ -27,21 +29,142 @@
 
 typedef avltree_key_t tid_t;
 
+#define THREAD_NICE_MIN (-20)
+#define THREAD_NICE_MAX 19
+
+// Priorities of SCHED_FIFO and SCHED_RR threads.
+#define THREAD_RT_PRIORITY_MIN 1
+#define THREAD_RT_PRIORITY_MAX 99
+
+// Set of processors, where bit N stands for processor_at(N). Processor numbers
+// fit in 8 bits, so this can hold all of them.
+#define CPUMASK_MAX_PROCESSORS 256
+
+typedef struct {
+        bitmap_word_t bits[CPUMASK_MAX_PROCESSORS / BITMAP_BITS_PER_WORD];
+} cpumask_t;
+
+static inline cpumask_t cpumask_all(void) {
+        cpumask_t mask;
+        kmemset(&mask, 0xff, sizeof(mask));
+        return mask;
+}
+
+static inline cpumask_t cpumask_of(size_t processor_index) {
+        cpumask_t mask = {0};
+        bitmap_set(mask.bits, processor_index);
+        return mask;
+}
+
+static inline bool
+cpumask_has(cpumask_t const *mask, size_t processor_index) {
+        return bitmap_is_set(mask->bits, processor_index);
+}
+
+// Returns CPUMASK_MAX_PROCESSORS if there's no processor in `mask` at or after
+// `processor_index`.
+static inline size_t
+cpumask_next(cpumask_t const *mask, size_t processor_index) {
+        while (processor_index < CPUMASK_MAX_PROCESSORS) {
+                size_t word_index = processor_index / BITMAP_BITS_PER_WORD;
+                bitmap_word_t word = mask->bits[word_index] >>
+                                     (processor_index % BITMAP_BITS_PER_WORD);
+                if (word) {
+                        return processor_index + __builtin_ctzll(word);
+                }
+                processor_index = (word_index + 1) * BITMAP_BITS_PER_WORD;
+        }
+        return CPUMASK_MAX_PROCESSORS;
+}
+
+// Scheduler's bookkeeping for each thread. Only the scheduler touches this,
+// while holding the lock of the run queue the thread belongs to.
+struct Thread_SchedState {
+        // Run queue the thread is queued or sleeping on. NULL while running.
+        struct Scheduler_RunQueue *run_queue;
+        // Virtual runtime in nanoseconds. It grows slower for threads with
+        // higher weight.
+        uint64_t vruntime;
+        int nice;
+        // SCHED_OTHER, SCHED_FIFO or SCHED_RR. rt_priority is only used by
+        // the latter two.
+        int policy;
+        int rt_priority;
+        // Ticks left in the current SCHED_RR time slice. 0 means a new slice
+        // is given on the next enqueue.
+        tick_t rr_ticks_left;
+        // Processors the thread may run on.
+        cpumask_t affinity;
+        // clock_monotonic_ns() when it was last switched out. 0 if it hasn't
+        // run yet.
+        uint64_t last_ran_ns;
+        bool is_queued, is_sleeping;
+        // Hasn't run yet.
+        bool is_new;
+};
+
+// Where a thread's time went, in processor_cycles() units.
+struct Thread_Accounting {
+        uint64_t user_cycles, kernel_cycles;
+        // Time spent in a run queue, waiting for a processor.
+        uint64_t wait_cycles;
+        // Context switches away from the thread because it went to sleep, and
+        // because something else had to run.
+        uint64_t voluntary_switches, involuntary_switches;
+        // processor_at() index of the processor it ran on last.
+        size_t last_processor;
+};
+
+// struct Thread begins with struct AVLTree_Node (or struct List_Node for
+// real-time threads), so the scheduler can put threads into its run queue
+// without allocating anything.
 struct Thread;
 
 struct Thread *thread_running(void);
 char const *thread_get_name(struct Thread const *thread);
 tid_t thread_get_id(struct Thread const *thread);
+struct Thread_SchedState *thread_get_sched_state(struct Thread *thread);
 void thread_set_sleep_scheduled(struct Thread *thread, bool scheduled);
 bool thread_is_sleep_scheduled(struct Thread const *thread);
-void thread_set_waiting_mutex(struct Thread *thread, struct Mutex *mutex);
-struct Mutex *thread_get_waiting_mutex(struct Thread const *thread);
 struct Process *thread_get_parent_proc(struct Thread const *thread);
 NORETURN void thread_enter_initial_kernel_thread(struct Thread *thread);
 void thread_context_switch(struct Thread *from_thread, struct Thread *to_thread);
 // Similar to thread_spawn, but doesn't add thread to the scheduler.
-struct Thread *thread_create(struct Process *parent_process, char const *name, void (*entry_point)());
+//
+// Returns NULL on OOM.
+WARN_UNUSED_RESULT struct Thread *thread_create(struct Process *parent_process, char const *name, void (*entry_point)());
 struct Thread *thread_spawn(struct Process *parent_proc, char const *name, void (*entry_point)());
+// Sets processors a thread created with thread_create may run on. It must not
+// have been added to the scheduler yet. Running threads use
+// scheduler_set_affinity() instead.
+void thread_set_affinity(struct Thread *thread, cpumask_t const *mask);
+// Creates a copy of `parent_thread` inside `process`, which resumes from the
+// system call `parent_thread` is currently in. Must be called by
+// `parent_thread` itself, and the thread is not added to the scheduler.
+//
+// Returns NULL on OOM.
+WARN_UNUSED_RESULT struct Thread *thread_create_forked(struct Process *process, struct Thread const *parent_thread);
+// Exits the running thread. Kernel threads also exit by returning from their
+// entry point.
+NORETURN void thread_exit(void);
+// Called by the scheduler once context of an exited thread is saved. (See
+// process_exit_thread())
+// Interrupts must be disabled.
+void thread_on_exited(struct Thread *thread);
+// Throws away a thread created with thread_create() that was never added to
+// the scheduler, as if it had exited.
+void thread_discard(struct Thread *thread);
+// Releases stacks and other resources of an exited thread. If the stack can't
+// be released, it's leaked with a warning.
+void thread_destroy(struct Thread *thread);
+// Returns accounting of the thread, including time of the ongoing run or wait.
+void thread_get_accounting(struct Thread *thread, struct Thread_Accounting *out);
+// Called by the scheduler when the thread goes into a run queue.
+void thread_account_enqueued(struct Thread *thread);
+// NOTE: Only used by arch code, when the current thread enters the kernel from
+// userland, and when it returns there.
+USED void thread_account_kernel_entry(void);
+USED void thread_account_kernel_exit(void);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Processes
@@ -54,6 +177,26 @@ struct Thread *thread_spawn(struct Process *parent_proc, char const *name, void
 struct Proc_MapOptions {
         bool writable;
         bool executable;
+        // Pages are shared with child processes, instead of being copied.
+        bool shared;
+        // Pages belong to the kernel, not the process. They're also shared
+        // with child processes, and are never freed by the process.
+        bool kernel_owned;
+};
+
+// Working set windows are 1, 5 and 30 scans long.
+#define PROC_WORKINGSET_WINDOW_COUNT 3
+
+struct Proc_WorkingSet {
+        // Number of times the process was scanned so far.
+        unsigned scan_count;
+        size_t resident_page_count;
+        // Pages written since the previous scan.
+        size_t dirty_page_count;
+        // hot_page_counts[i] is the number of pages accessed during the last
+        // window_scan_counts[i] scans.
+        size_t hot_page_counts[PROC_WORKINGSET_WINDOW_COUNT];
+        unsigned window_scan_counts[PROC_WORKINGSET_WINDOW_COUNT];
 };
 
 struct Process;
@@ -65,10 +208,48 @@ pid_t process_get_id(struct Process const *process);
 bool process_is_kernel(struct Process const *process);
 // Returns THREAD_ID_INVALID on OOM.
 tid_t process_add_thread(struct Process *process, struct Thread *thread);
+// Removes an exited thread from the process. The thread is kept so a new thread
+// can reuse it, or handed to the reaper if the cache is full. Once the last
+// thread of a user process exits, the process is also left for the reaper.
+// Interrupts must be disabled.
+void process_exit_thread(struct Process *process, struct Thread *thread);
+// Returns a user process whose threads have all exited, or NULL if there's
+// none. Threads it handed to the reaper before that are already queued there.
+struct Process *process_take_exited(void);
+// Returns NULL if there's no cached thread.
+struct Thread *process_take_cached_thread(struct Process *process);
 void process_activate_user_addrspace(struct Process *process);
 void process_spawn_kernel(mmu_addrspace_t mmu_addrspace);
 // Returns NULL on OOM.
 WARN_UNUSED_RESULT struct Process *process_spawn_user(char const *name);
+// Creates a new process that shares the parent's address space as
+// copy-on-write. No threads are added to the new process.
+//
+// Returns NULL on OOM.
+WARN_UNUSED_RESULT struct Process *process_fork(struct Process *parent);
+// Frees a user process along with its address space and pages. The process
+// must not have any thread left, including cached ones.
+void process_destroy(struct Process *process);
+// Calls `callback` for every process in process ID order. Processes can't be
+// spawned until it returns.
+void process_for_each(void (*callback)(struct Process *process, void *data), void *data);
+// Returns process with the smallest ID that is greater than or equal to `id`,
+// pinned so that it isn't freed until process_unpin(). Pinned process may
+// still be destroyed, but it's no longer found by this.
+//
+// Returns NULL if there's no such process.
+struct Process *process_pin_next(pid_t id);
+void process_unpin(struct Process *process);
+// Calls `callback` for every thread of the process in thread ID order. Threads
+// can't be added to the process until it returns.
+void process_for_each_thread(struct Process *process, void (*callback)(struct Thread *thread, void *data), void *data);
+// Harvests accessed and dirty bits of the process's pages, and updates its
+// working set. Pages that haven't been accessed get older by one scan.
+//
+// It yields between page tables, so only call it from a thread that can sleep.
+void process_scan_working_set(struct Process *process);
+// Returns working set measured by the last process_scan_working_set().
+void process_get_working_set(struct Process *process, struct Proc_WorkingSet *out);
 
 // Returns negative errno on error;
 WARN_UNUSED_RESULT ssize_t process_fd_write(struct Process *process, int fd, void const *buf, size_t count);
@@ -94,6 +275,26 @@ void process_set_map_options(struct Process *process,void *virtbase,size_t page_
 // Returns NULL on failure.
 WARN_UNUSED_RESULT void *process_alloc_pages(struct Process *process, uintptr_t *paddr_out, size_t page_count, struct Proc_MapOptions options);
 void process_free_pages(struct Process *process, void *ptr, size_t page_count);
+// Reserves virtual pages without backing them. Each page gets zero-filled
+// physical page when it is accessed for the first time.
+//
+// Returns NULL on failure.
+WARN_UNUSED_RESULT void *process_reserve_pages(struct Process *process, size_t page_count, struct Proc_MapOptions options);
+// Backs given range of reserved pages ahead of time.
+//
+// Returns false on OOM.
+WARN_UNUSED_RESULT bool process_populate_pages(struct Process *process, void *virtbase, size_t page_count);
+// Frees pages reserved with process_reserve_pages(). The range may be part of
+// the reservation.
+//
+// Returns -EINVAL if the range is not inside a single reservation, and -ENOMEM
+// on OOM.
+WARN_UNUSED_RESULT int process_release_pages(struct Process *process, void *virtbase, size_t page_count);
+// Called when `virtaddr` was accessed but isn't mapped. `access` is the type
+// of access that was attempted.
+//
+// Returns true if the page is now mapped and the access can be retried.
+WARN_UNUSED_RESULT bool process_handle_page_fault(void *virtaddr, mmu_prot_t access);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Scheduling
@@ -109,8 +310,166 @@ NORETURN void scheduler_run_idle_loop();
 
 // WARNING: Below functions lock the scheduler!
 void scheduler_yield(void);
-void scheduler_on_timer_tick(void);
-void scheduler_sleep_until_mutex_unlock(struct Mutex *mutex_id);
+void scheduler_on_timer_tick(tick_t elapsed_ticks);
+// Called when a thread was put into our queue, by other processor or by us
+// while it wasn't safe to switch.
+void scheduler_on_reschedule_ipi(void);
+// Sleeps until mutex_unlock() hands the mutex over to the current thread.
+void scheduler_sleep_until_mutex_unlock(struct Mutex *mutex);
+// Switches away from the current thread for good. (See thread_exit())
+NORETURN void scheduler_exit_current_thread(void);
+// Wakes up thread that was handed a mutex. `waiter` must not be used after
+// this.
+void scheduler_wakeup_mutex_waiter(struct Mutex_Waiter const *waiter);
+// Sets nice value of the current thread, clamped to THREAD_NICE_MIN ~
+// THREAD_NICE_MAX. Lower value means bigger share of CPU time.
+//
+// Returns the new nice value.
+int scheduler_set_nice(int nice);
+int scheduler_get_nice(void);
+// Restricts current thread to processors in `mask`, moving it to one of them
+// if needed.
+//
+// Returns -EINVAL if none of them is running.
+WARN_UNUSED_RESULT int scheduler_set_affinity(cpumask_t const *mask);
+cpumask_t scheduler_get_affinity(void);
+// Sets scheduling policy of the current thread. SCHED_FIFO and SCHED_RR
+// threads always run before SCHED_OTHER ones, and `rt_priority` must be
+// THREAD_RT_PRIORITY_MIN ~ THREAD_RT_PRIORITY_MAX for them. It must be 0 for
+// SCHED_OTHER.
+//
+// Real-time threads can starve everyone else of their priority and below, so
+// only kernel threads may become one. There's no notion of privileged user
+// processes yet.
+//
+// Returns -EINVAL if the policy or priority is invalid, and -EPERM if a user
+// thread asks for a real-time policy.
+WARN_UNUSED_RESULT int scheduler_set_policy(int policy, int rt_priority);
+int scheduler_get_policy(void);
+int scheduler_get_rt_priority(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// CPU topology
+////////////////////////////////////////////////////////////////////////////////
+
+// Adds the current processor to masks of processors it shares a core, a
+// package or the last level cache with. Processors that don't know their
+// topology only share with themselves.
+void topology_add_current_processor(void);
+// Below return masks including the processor itself. They are read without
+// locking, so a processor that's just starting may be missing.
+//
+// Processors sharing the core(SMT siblings).
+cpumask_t const *topology_sibling_mask(size_t processor_index);
+// Processors in the same package.
+cpumask_t const *topology_package_mask(size_t processor_index);
+// Processors sharing the last level cache.
+cpumask_t const *topology_llc_mask(size_t processor_index);
+
+////////////////////////////////////////////////////////////////////////////////
+// Scheduling latency
+////////////////////////////////////////////////////////////////////////////////
+
+// Time between a thread entering a run queue and getting the processor is
+// recorded by each processor, split by whether the thread was woken up or
+// preempted.
+#define SCHEDLATENCY_BUCKET_COUNT 40
+#define SCHEDLATENCY_WORST_COUNT  8
+
+struct SchedLatency_Record {
+        uint64_t latency_ns;
+        // clock_monotonic_ns() when the thread got the processor.
+        uint64_t at_ns;
+        // Preempting thread is the one that was running right before it.
+        tid_t tid, preempting_tid;
+        char name[THREAD_NAME_MAX_LEN + 1];
+        char preempting_name[THREAD_NAME_MAX_LEN + 1];
+        bool is_wakeup;
+};
+
+struct SchedLatency_Stats {
+        // Bucket N counts latencies of [2^N, 2^(N+1)) nanoseconds. The first
+        // one also counts 0, and the last one everything above.
+        uint64_t wakeup_counts[SCHEDLATENCY_BUCKET_COUNT];
+        uint64_t preempted_counts[SCHEDLATENCY_BUCKET_COUNT];
+        // Longest first. Unused ones have zero latency.
+        struct SchedLatency_Record worst[SCHEDLATENCY_WORST_COUNT];
+};
+
+// Called on context switch to `thread`, which has been waiting
+// `latency_cycles` since it was woken up or preempted. Interrupts must be
+// disabled.
+void schedlatency_record(struct Thread *thread, struct Thread *preempting_thread, uint64_t latency_cycles, bool is_wakeup);
+// Returns false if the processor hasn't started scheduling yet.
+WARN_UNUSED_RESULT bool schedlatency_get(size_t processor_index, struct SchedLatency_Stats *out);
+void schedlatency_reset(void);
+void schedlatency_init_for_current_processor(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// Timers
+////////////////////////////////////////////////////////////////////////////////
+
+// Each processor has its own timers, and they expire on the processor they
+// were started on.
+struct Timer_Base;
+
+struct Timer {
+        // Timer is either in the high-resolution tree or in the timer wheel.
+        union {
+                struct AVLTree_Node tree_node;
+                struct List_Node wheel_node;
+        } node_head;
+        void (*callback)(struct Timer *timer, void *data);
+        void *data;
+        // NULL if the timer isn't pending.
+        struct Timer_Base *base;
+        uint64_t deadline_ns;
+        tick_t deadline_tick;
+        uint8_t wheel_level, wheel_slot;
+        bool is_precise;
+};
+
+void timer_init(struct Timer *timer, void (*callback)(struct Timer *timer, void *data), void *data);
+// Starts the timer on current processor. Precise timer expires as soon as
+// possible after `deadline_ns`, while others expire on the next tick after it,
+// which is cheaper to keep track of.
+//
+// The callback runs from current processor's timer interrupt, and the timer
+// must not be touched after the callback is called. Timer must not be pending.
+void timer_start(struct Timer *timer, uint64_t deadline_ns, bool is_precise);
+// Returns false if the timer wasn't pending(including when it just expired and
+// the callback is about to run).
+bool timer_cancel(struct Timer *timer);
+// Sleeps at least `ns` nanoseconds.
+void timer_sleep(uint64_t ns);
+// Sleeps until clock_monotonic_ns() reaches `deadline_ns`. See timer_start()
+// for `is_precise`.
+void timer_sleep_until(uint64_t deadline_ns, bool is_precise);
+// Sets how many ticks may pass between timer interrupts of current processor
+// when there are no timers expiring earlier. Caller must have interrupts
+// disabled.
+void timer_set_tick_interval(unsigned ticks);
+// Runs expired timers of current processor, and arms its timer again.
+// Called on every timer interrupt.
+void timer_on_interrupt(void);
+void timer_init_for_current_processor(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// Working set scanner
+////////////////////////////////////////////////////////////////////////////////
+
+// Spawns kernel thread that periodically scans working set of user processes.
+void workingset_scanner_start(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// Reaper
+////////////////////////////////////////////////////////////////////////////////
+
+// Spawns kernel thread that periodically destroys exited threads, and user
+// processes whose threads have all exited.
+void reaper_start(void);
+// Hands an exited thread to the reaper. Interrupts may be disabled.
+void reaper_add_thread(struct Thread *thread);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Exec
@@ -12,12 +12,37 @@
 #include <stddef.h>
 #include <stdint.h>
 
+static char const *LOG_TAG = "thread";
+
+// What a thread has been doing since the last accounting.
+enum AccountingState {
+        // Sleeping, or hasn't been added to the scheduler yet.
+        ACCOUNTING_STATE_AWAY,
+        ACCOUNTING_STATE_WAITING,
+        ACCOUNTING_STATE_KERNEL,
+        ACCOUNTING_STATE_USER,
+};
+
 struct Thread {
+        // Used by the scheduler. Real-time threads are queued in lists, and
+        // others in a tree.
+        union {
+                struct AVLTree_Node tree_node;
+                struct List_Node list_node;
+        } node_head;
+        struct Thread_SchedState sched_state;
         struct Processor_Thread processor_thread;
-        uintptr_t stack_physbase;
+        struct Thread_Accounting accounting;
+        // processor_cycles() value when the current accounting state began.
+        uint64_t accounting_since;
+        enum AccountingState accounting_state;
+        // processor_cycles() value when the thread went into a run queue, and
+        // whether it was sleeping before that.
+        uint64_t enqueued_at;
+        bool is_waking_up;
+        void *stack_base;
         void (*entry_point)();
         struct Process *parent_proc;
-        struct Mutex *waiting_mutex;
         tid_t id;
         char name[THREAD_NAME_MAX_LEN + 1];
         bool sleep_scheduled, is_entering_for_first_time;
@@ -33,45 +58,183 @@ struct Thread *thread_running(void) {
 #define MAX_THREAD_TIME         5
 #define THREAD_STACK_SIZE       (1024UL * 1024UL * 4UL)
 #define THREAD_STACK_PAGE_COUNT (THREAD_STACK_SIZE / PAGE_SIZE)
+// Stacks of user processes are only backed when touched, except the top of the
+// stack which covers the usual call depth. Kernel process threads may run while
+// holding locks the page fault handler needs, so their stacks are fully backed
+// in advance.
+#define THREAD_STACK_PREFAULT_PAGE_COUNT 16
 
-struct Thread *thread_create(
-        struct Process *parent_process, char const *name, void (*entry_point)()
-) {
-        ASSERT(parent_process);
-        struct PhysPage_Addr stack_physpage =
-                physpage_alloc(THREAD_STACK_PAGE_COUNT);
-        if (!stack_physpage.value) {
-                TODO_HANDLE_ERROR();
+// Gives the thread stack back to the process. If that fails, the stack is
+// leaked, as there's nothing better to do with it.
+static void release_stack(struct Process *process, void *stack_base) {
+        int err = process_release_pages(
+                process, stack_base, THREAD_STACK_PAGE_COUNT
+        );
+        if (err < 0) {
+                LOGW(LOG_TAG, "Leaking thread stack %p (%u)", stack_base, -err);
+        }
+}
+
+// Takes a thread that exited from the process's cache, and prepares it for
+// reuse. Its stacks are kept, so this doesn't allocate anything.
+//
+// Returns NULL if the cache is empty.
+static struct Thread *reuse_cached_thread(struct Process *process) {
+        struct Thread *thread = process_take_cached_thread(process);
+        if (!thread) {
+                return NULL;
         }
+        void *stack_top = (uint8_t *)thread->stack_base + THREAD_STACK_SIZE;
+        processor_thread_reset(&thread->processor_thread, stack_top);
+        return thread;
+}
+
+// Allocates a new thread along with its stacks.
+//
+// Returns NULL on OOM.
+static struct Thread *alloc_thread(struct Process *process) {
         struct Thread *thread = kmalloc(sizeof(*thread));
         if (!thread) {
-                TODO_HANDLE_ERROR();
+                goto fail;
         }
-        str_copy(thread->name, sizeof(thread->name), name);
-        thread->sleep_scheduled = false;
-        thread->is_entering_for_first_time = true;
-        thread->entry_point = entry_point;
-        thread->stack_physbase = stack_physpage.value;
-        thread->parent_proc = parent_process;
-        thread->waiting_mutex = NULL;
-        void *stack_base_virtaddr = process_map_pages(
-                parent_process,
-                stack_physpage.value,
+        thread->stack_base = NULL;
+        void *stack_base_virtaddr = process_reserve_pages(
+                process,
                 THREAD_STACK_PAGE_COUNT,
                 (struct Proc_MapOptions){.executable = false, .writable = true}
         );
         if (!stack_base_virtaddr) {
-                TODO_HANDLE_ERROR();
+                goto fail;
         }
+        thread->stack_base = stack_base_virtaddr;
         void *stack_top = (uint8_t *)stack_base_virtaddr + THREAD_STACK_SIZE;
         ASSERT((void *)stack_base_virtaddr != stack_top);
+        size_t populate_page_count = process_is_kernel(process)
+                                             ? THREAD_STACK_PAGE_COUNT
+                                             : THREAD_STACK_PREFAULT_PAGE_COUNT;
+        if (!process_populate_pages(
+                    process,
+                    (uint8_t *)stack_top - populate_page_count * PAGE_SIZE,
+                    populate_page_count
+            )) {
+                goto fail;
+        }
         if (!processor_thread_init(&thread->processor_thread, stack_top)) {
-                TODO_HANDLE_ERROR();
+                goto fail;
+        }
+        return thread;
+fail:
+        if (thread && thread->stack_base) {
+                release_stack(process, thread->stack_base);
         }
+        kfree(thread);
+        return NULL;
+}
+
+struct Thread *thread_create(
+        struct Process *parent_process, char const *name, void (*entry_point)()
+) {
+        ASSERT(parent_process);
+        struct Thread *thread = reuse_cached_thread(parent_process);
+        if (!thread) {
+                thread = alloc_thread(parent_process);
+                if (!thread) {
+                        return NULL;
+                }
+        }
+        str_copy(thread->name, sizeof(thread->name), name);
+        kmemset(&thread->node_head, 0, sizeof(thread->node_head));
+        thread->sched_state = (struct Thread_SchedState){
+                .affinity = cpumask_all(),
+                .is_new = true,
+        };
+        thread->accounting = (struct Thread_Accounting){0};
+        thread->accounting_since = 0;
+        thread->accounting_state = ACCOUNTING_STATE_AWAY;
+        thread->enqueued_at = 0;
+        thread->is_waking_up = false;
+        thread->sleep_scheduled = false;
+        thread->is_entering_for_first_time = true;
+        thread->entry_point = entry_point;
+        thread->parent_proc = parent_process;
         thread->id = process_add_thread(parent_process, thread);
+        if (thread->id == THREAD_ID_INVALID) {
+                thread_destroy(thread);
+                return NULL;
+        }
         return thread;
 }
 
+struct Thread *thread_create_forked(
+        struct Process *process, struct Thread const *parent_thread
+) {
+        ASSERT(!process_is_kernel(process));
+        struct Thread *thread = kmalloc(sizeof(*thread));
+        if (!thread) {
+                return NULL;
+        }
+        str_copy(thread->name, sizeof(thread->name), parent_thread->name);
+        kmemset(&thread->node_head, 0, sizeof(thread->node_head));
+        thread->sched_state = (struct Thread_SchedState){
+                .is_new = true,
+                .nice = parent_thread->sched_state.nice,
+                .policy = parent_thread->sched_state.policy,
+                .rt_priority = parent_thread->sched_state.rt_priority,
+                .affinity = parent_thread->sched_state.affinity,
+        };
+        thread->accounting = (struct Thread_Accounting){0};
+        thread->accounting_since = 0;
+        thread->accounting_state = ACCOUNTING_STATE_AWAY;
+        thread->enqueued_at = 0;
+        thread->is_waking_up = false;
+        thread->sleep_scheduled = false;
+        thread->is_entering_for_first_time = true;
+        thread->entry_point = parent_thread->entry_point;
+        thread->parent_proc = process;
+        // Stack lives at the same address in the new address space.
+        thread->stack_base = parent_thread->stack_base;
+        if (!processor_thread_init_forked(
+                    &thread->processor_thread, &parent_thread->processor_thread
+            )) {
+                kfree(thread);
+                return NULL;
+        }
+        thread->id = process_add_thread(process, thread);
+        if (thread->id == THREAD_ID_INVALID) {
+                processor_thread_deinit(
+                        &thread->processor_thread, process_kernel()
+                );
+                kfree(thread);
+                return NULL;
+        }
+        return thread;
+}
+
+void thread_exit(void) {
+        // Thread stays in its process until its context is saved, as the
+        // process may go away once its last thread is removed.
+        scheduler_exit_current_thread();
+}
+
+void thread_on_exited(struct Thread *thread) {
+        ASSERT(!interrupts_are_enabled());
+        process_exit_thread(thread->parent_proc, thread);
+}
+
+void thread_discard(struct Thread *thread) {
+        ASSERT(thread->sched_state.is_new && !thread->sched_state.is_queued);
+        ENTER_NO_INTERRUPT_SECTION();
+        thread_on_exited(thread);
+        LEAVE_NO_INTERRUPT_SECTION();
+}
+
+void thread_destroy(struct Thread *thread) {
+        // Processor stacks are always allocated from the kernel process.
+        processor_thread_deinit(&thread->processor_thread, process_kernel());
+        release_stack(thread->parent_proc, thread->stack_base);
+        kfree(thread);
+}
+
 struct Thread *thread_spawn(
         struct Process *parent_process, char const *name, void (*entry_point)()
 ) {
@@ -84,12 +247,22 @@ struct Thread *thread_spawn(
         return thread;
 }
 
+void thread_set_affinity(struct Thread *thread, cpumask_t const *mask) {
+        struct Thread_SchedState *state = &thread->sched_state;
+        ASSERT(state->is_new && !state->is_queued);
+        state->affinity = *mask;
+}
+
 char const *thread_get_name(struct Thread const *thread) {
         return thread->name;
 }
 
 tid_t thread_get_id(struct Thread const *thread) { return thread->id; }
 
+struct Thread_SchedState *thread_get_sched_state(struct Thread *thread) {
+        return &thread->sched_state;
+}
+
 void thread_set_sleep_scheduled(struct Thread *thread, bool scheduled) {
         thread->sleep_scheduled = scheduled;
 }
@@ -98,21 +271,94 @@ bool thread_is_sleep_scheduled(struct Thread const *thread) {
         return thread->sleep_scheduled;
 }
 
-void thread_set_waiting_mutex(struct Thread *thread, struct Mutex *mutex) {
-        thread->waiting_mutex = mutex;
+struct Process *thread_get_parent_proc(struct Thread const *thread) {
+        return thread->parent_proc;
+}
+
+static void add_elapsed(
+        struct Thread_Accounting *accounting,
+        enum AccountingState state,
+        uint64_t since,
+        uint64_t now
+) {
+        // Counters of different processors may be a few cycles apart.
+        if (now < since) {
+                return;
+        }
+        uint64_t elapsed = now - since;
+        switch (state) {
+        case ACCOUNTING_STATE_AWAY:
+                break;
+        case ACCOUNTING_STATE_WAITING:
+                accounting->wait_cycles += elapsed;
+                break;
+        case ACCOUNTING_STATE_KERNEL:
+                accounting->kernel_cycles += elapsed;
+                break;
+        case ACCOUNTING_STATE_USER:
+                accounting->user_cycles += elapsed;
+                break;
+        }
+}
+
+// Charges time since the last accounting, and moves on to `new_state`.
+// Interrupts must be disabled.
+static void account(struct Thread *thread, enum AccountingState new_state) {
+        uint64_t now = processor_cycles();
+        add_elapsed(
+                &thread->accounting,
+                thread->accounting_state,
+                thread->accounting_since,
+                now
+        );
+        thread->accounting_since = now;
+        thread->accounting_state = new_state;
 }
 
-struct Mutex *thread_get_waiting_mutex(struct Thread const *thread) {
-        return thread->waiting_mutex;
+void thread_get_accounting(
+        struct Thread *thread, struct Thread_Accounting *out
+) {
+        // Thread may be running on other processor, so this is only a
+        // snapshot that may be slightly off.
+        ENTER_NO_INTERRUPT_SECTION();
+        *out = thread->accounting;
+        add_elapsed(
+                out,
+                thread->accounting_state,
+                thread->accounting_since,
+                processor_cycles()
+        );
+        LEAVE_NO_INTERRUPT_SECTION();
 }
 
-struct Process *thread_get_parent_proc(struct Thread const *thread) {
-        return thread->parent_proc;
+void thread_account_enqueued(struct Thread *thread) {
+        ASSERT(!interrupts_are_enabled());
+        enum AccountingState prev_state = thread->accounting_state;
+        account(thread, ACCOUNTING_STATE_WAITING);
+        // It may be moved between queues, but it's still the same wait.
+        if (prev_state != ACCOUNTING_STATE_WAITING) {
+                thread->enqueued_at = thread->accounting_since;
+                thread->is_waking_up = prev_state == ACCOUNTING_STATE_AWAY;
+        }
+}
+
+void thread_account_kernel_entry(void) {
+        ENTER_NO_INTERRUPT_SECTION();
+        account(thread_running(), ACCOUNTING_STATE_KERNEL);
+        LEAVE_NO_INTERRUPT_SECTION();
+}
+
+void thread_account_kernel_exit(void) {
+        ENTER_NO_INTERRUPT_SECTION();
+        account(thread_running(), ACCOUNTING_STATE_USER);
+        LEAVE_NO_INTERRUPT_SECTION();
 }
 
 void thread_enter_initial_kernel_thread(struct Thread *thread) {
         ASSERT(!interrupts_are_enabled());
         processor_set_running_thread(processor_current(), thread);
+        account(thread, ACCOUNTING_STATE_KERNEL);
+        thread->accounting.last_processor = processor_current()->cpu_num;
         ASSERT(thread->is_entering_for_first_time);
         thread->is_entering_for_first_time = false;
         processor_thread_enter_initial_kernel_thread(
@@ -129,6 +375,33 @@ void thread_context_switch(
                 struct Processor_LocalState *cpu = processor_current();
                 bool is_user_thread =
                         !process_is_kernel(to_thread->parent_proc);
+                // Threads that are still in a run queue were preempted, and
+                // others are going to sleep.
+                if (from_thread->accounting_state == ACCOUNTING_STATE_WAITING) {
+                        ++from_thread->accounting.involuntary_switches;
+                } else {
+                        account(from_thread, ACCOUNTING_STATE_AWAY);
+                        ++from_thread->accounting.voluntary_switches;
+                }
+                if (to_thread->accounting_state == ACCOUNTING_STATE_WAITING) {
+                        uint64_t now = processor_cycles();
+                        uint64_t latency = 0;
+                        if (to_thread->enqueued_at < now) {
+                                latency = now - to_thread->enqueued_at;
+                        }
+                        schedlatency_record(
+                                to_thread,
+                                from_thread,
+                                latency,
+                                to_thread->is_waking_up
+                        );
+                }
+                // New user threads go straight to userland.
+                account(to_thread,
+                        (is_user_thread && to_thread->is_entering_for_first_time)
+                                ? ACCOUNTING_STATE_USER
+                                : ACCOUNTING_STATE_KERNEL);
+                to_thread->accounting.last_processor = cpu->cpu_num;
                 if (is_user_thread) {
                         process_activate_user_addrspace(to_thread->parent_proc);
                 } else {
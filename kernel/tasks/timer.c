@@ -0,0 +1,387 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "tasks.h"
+#include "kernel/arch/arch.h"
+#include "kernel/heap/heap.h"
+#include "kernel/kernel.h"
+#include "kernel/lock/spinlock.h"
+#include "kernel/utility/utility.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Precise timers are kept in a tree ordered by their deadline, and the
+// processor's timer is armed for the earliest one.
+//
+// Other timers go into a hierarchical timer wheel, which only has tick
+// resolution but is cheaper to insert into and remove from. Level 0 has a
+// slot for each of the next WHEEL_SLOT_COUNT ticks, and each slot of the
+// level above covers WHEEL_SLOT_COUNT slots of the level below. When we reach
+// a slot of upper level, its timers are moved(cascaded) down to lower levels.
+
+#define WHEEL_LEVEL_COUNT 4
+#define WHEEL_SLOT_BITS   6
+#define WHEEL_SLOT_COUNT  (1U << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK   (WHEEL_SLOT_COUNT - 1)
+// Timers further than this are put at the end of the wheel, and put back
+// into the wheel when they reach level 0.
+#define WHEEL_MAX_DELTA \
+        (((tick_t)1 << (WHEEL_SLOT_BITS * WHEEL_LEVEL_COUNT)) - 1)
+
+#define TICK_NONE UINT64_MAX
+
+struct Timer_Base {
+        struct SpinLock lock;
+        // Precise timers, keyed by deadline.
+        struct AVLTree tree;
+        struct List wheel[WHEEL_LEVEL_COUNT][WHEEL_SLOT_COUNT];
+        // Bit N is set if wheel[level][N] isn't empty.
+        uint64_t wheel_pending[WHEEL_LEVEL_COUNT];
+        size_t wheel_timer_count;
+        // Next tick the wheel hasn't processed yet.
+        tick_t wheel_tick;
+        // Longest interval between timer interrupts. Scheduler sets this.
+        unsigned tick_interval;
+        // When the processor's timer is going to fire next.
+        uint64_t next_event_ns;
+};
+
+static unsigned slot_shift(unsigned level) { return level * WHEEL_SLOT_BITS; }
+
+static void wheel_insert(struct Timer_Base *base, struct Timer *timer) {
+        tick_t expires = timer->deadline_tick;
+        if (expires < base->wheel_tick) {
+                expires = base->wheel_tick;
+        }
+        if (WHEEL_MAX_DELTA < (expires - base->wheel_tick)) {
+                expires = base->wheel_tick + WHEEL_MAX_DELTA;
+        }
+        tick_t delta = expires - base->wheel_tick;
+        unsigned level = 0;
+        while (((tick_t)WHEEL_SLOT_COUNT << slot_shift(level)) <= delta) {
+                ++level;
+        }
+        unsigned slot = (expires >> slot_shift(level)) & WHEEL_SLOT_MASK;
+        list_insert_tail(
+                &base->wheel[level][slot], &timer->node_head.wheel_node
+        );
+        base->wheel_pending[level] |= 1ULL << slot;
+        timer->wheel_level = level;
+        timer->wheel_slot = slot;
+}
+
+static void wheel_remove(struct Timer_Base *base, struct Timer *timer) {
+        struct List *list = &base->wheel[timer->wheel_level][timer->wheel_slot];
+        list_remove(list, &timer->node_head.wheel_node);
+        if (!list->head) {
+                base->wheel_pending[timer->wheel_level] &=
+                        ~(1ULL << timer->wheel_slot);
+        }
+}
+
+// Removes every timer in the slot, and returns them as a list.
+static struct List
+wheel_take_slot(struct Timer_Base *base, unsigned level, unsigned slot) {
+        struct List list = base->wheel[level][slot];
+        base->wheel[level][slot] = (struct List){0};
+        base->wheel_pending[level] &= ~(1ULL << slot);
+        return list;
+}
+
+static void
+cascade(struct Timer_Base *base, unsigned level, unsigned slot) {
+        struct List list = wheel_take_slot(base, level, slot);
+        struct List_Node *node = list.head;
+        while (node) {
+                struct List_Node *next = node->next;
+                wheel_insert(base, (struct Timer *)node);
+                node = next;
+        }
+}
+
+// Moves timers that expired up to `now_tick` into `expired`.
+static void advance_wheel(
+        struct Timer_Base *base, tick_t now_tick, struct List *expired
+) {
+        if (base->wheel_timer_count == 0) {
+                // Nothing to walk through.
+                if (base->wheel_tick <= now_tick) {
+                        base->wheel_tick = now_tick + 1;
+                }
+                return;
+        }
+        while (base->wheel_tick <= now_tick) {
+                tick_t tick = base->wheel_tick;
+                // Cascade from the top, because upper level may cascade into
+                // the slot of lower level we are about to cascade.
+                for (unsigned level = WHEEL_LEVEL_COUNT - 1; 0 < level;
+                     --level) {
+                        tick_t mask = ((tick_t)1 << slot_shift(level)) - 1;
+                        if (tick & mask) {
+                                continue;
+                        }
+                        cascade(base,
+                                level,
+                                (tick >> slot_shift(level)) & WHEEL_SLOT_MASK);
+                }
+                struct List list =
+                        wheel_take_slot(base, 0, tick & WHEEL_SLOT_MASK);
+                struct List_Node *node = list.head;
+                while (node) {
+                        struct List_Node *next = node->next;
+                        struct Timer *timer = (struct Timer *)node;
+                        if (timer->deadline_tick <= tick) {
+                                timer->base = NULL;
+                                --base->wheel_timer_count;
+                                list_insert_tail(expired, node);
+                        } else {
+                                // It was too far away to fit in the wheel.
+                                wheel_insert(base, timer);
+                        }
+                        node = next;
+                }
+                ++base->wheel_tick;
+        }
+}
+
+// Returns distance from `start` to the next pending slot, wrapping around.
+// `pending` must not be zero.
+static unsigned distance_to_pending_slot(uint64_t pending, unsigned start) {
+        uint64_t rotated = pending >> start;
+        if (start != 0) {
+                rotated |= pending << (WHEEL_SLOT_COUNT - start);
+        }
+        return __builtin_ctzll(rotated);
+}
+
+// Returns the earliest tick the wheel needs to be looked at, or TICK_NONE if
+// the wheel is empty. It's either when a timer expires, or when timers get
+// cascaded.
+static tick_t wheel_next_event_tick(struct Timer_Base const *base) {
+        if (base->wheel_timer_count == 0) {
+                return TICK_NONE;
+        }
+        tick_t result = TICK_NONE;
+        for (unsigned level = 0; level < WHEEL_LEVEL_COUNT; ++level) {
+                uint64_t pending = base->wheel_pending[level];
+                if (!pending) {
+                        continue;
+                }
+                unsigned shift = slot_shift(level);
+                tick_t level_tick = base->wheel_tick >> shift;
+                if ((level_tick << shift) != base->wheel_tick) {
+                        // Current slot of this level was already cascaded.
+                        ++level_tick;
+                }
+                level_tick += distance_to_pending_slot(
+                        pending, level_tick & WHEEL_SLOT_MASK
+                );
+                tick_t tick = level_tick << shift;
+                if (tick < result) {
+                        result = tick;
+                }
+        }
+        return result;
+}
+
+// Returns `NULL` if there are no precise timers.
+static struct Timer *earliest_precise_timer(struct Timer_Base *base) {
+        if (!base->tree.root) {
+                return NULL;
+        }
+        return avltree_min_node(base->tree.root);
+}
+
+// Arms the processor's timer for whatever comes first. Caller must hold
+// `base`'s lock, and `base` must be the current processor's.
+static void program_next_event(struct Timer_Base *base) {
+        uint64_t now = clock_monotonic_ns();
+        uint64_t next = now + base->tick_interval * TICKTIME_NS_PER_TICK;
+        struct Timer *timer = earliest_precise_timer(base);
+        if (timer && (timer->deadline_ns < next)) {
+                next = timer->deadline_ns;
+        }
+        tick_t wheel_tick = wheel_next_event_tick(base);
+        if ((wheel_tick != TICK_NONE) &&
+            ((wheel_tick * TICKTIME_NS_PER_TICK) < next)) {
+                next = wheel_tick * TICKTIME_NS_PER_TICK;
+        }
+        uint64_t delay = (now < next) ? (next - now) : 0;
+        if (processor_arm_timer(delay)) {
+                base->next_event_ns = now + delay;
+        }
+}
+
+static struct Timer_Base *current_timer_base(void) {
+        struct Timer_Base *base = processor_timer_base(processor_current());
+        ASSERT(base);
+        return base;
+}
+
+void timer_init(
+        struct Timer *timer,
+        void (*callback)(struct Timer *timer, void *data),
+        void *data
+) {
+        kmemset(timer, 0, sizeof(*timer));
+        timer->callback = callback;
+        timer->data = data;
+}
+
+void timer_start(struct Timer *timer, uint64_t deadline_ns, bool is_precise) {
+        ASSERT(!timer->base);
+        ENTER_NO_INTERRUPT_SECTION();
+        struct Timer_Base *base = current_timer_base();
+        bool prev_interrupt_state;
+        spinlock_lock(&base->lock, &prev_interrupt_state);
+        timer->deadline_ns = deadline_ns;
+        timer->is_precise = is_precise;
+        if (is_precise) {
+                timer->node_head.tree_node = (struct AVLTree_Node){0};
+                avltree_insert(&base->tree, timer, deadline_ns);
+        } else {
+                // Round up, so it never expires early.
+                timer->deadline_tick =
+                        (deadline_ns + TICKTIME_NS_PER_TICK - 1) /
+                        TICKTIME_NS_PER_TICK;
+                wheel_insert(base, timer);
+                ++base->wheel_timer_count;
+        }
+        __atomic_store_n(&timer->base, base, __ATOMIC_RELEASE);
+        if (deadline_ns < base->next_event_ns) {
+                program_next_event(base);
+        }
+        spinlock_unlock(&base->lock, prev_interrupt_state);
+        LEAVE_NO_INTERRUPT_SECTION();
+}
+
+bool timer_cancel(struct Timer *timer) {
+        struct Timer_Base *base =
+                __atomic_load_n(&timer->base, __ATOMIC_ACQUIRE);
+        if (!base) {
+                return false;
+        }
+        bool prev_interrupt_state;
+        spinlock_lock(&base->lock, &prev_interrupt_state);
+        bool was_pending = (timer->base == base);
+        if (was_pending) {
+                if (timer->is_precise) {
+                        avltree_remove(
+                                &base->tree, &timer->node_head.tree_node
+                        );
+                } else {
+                        wheel_remove(base, timer);
+                        --base->wheel_timer_count;
+                }
+                timer->base = NULL;
+                // Processor's timer may still fire for it, which is harmless.
+        }
+        spinlock_unlock(&base->lock, prev_interrupt_state);
+        return was_pending;
+}
+
+static void wakeup_sleeper(struct Timer *timer, void *data) {
+        (void)timer;
+        scheduler_wakeup_thread(data);
+}
+
+void timer_sleep_until(uint64_t deadline_ns, bool is_precise) {
+        if (deadline_ns <= clock_monotonic_ns()) {
+                return;
+        }
+        struct Thread *thread = thread_running();
+        struct Timer timer;
+        timer_init(&timer, wakeup_sleeper, thread);
+        ENTER_NO_INTERRUPT_SECTION();
+        // The timer expires on this processor, which doesn't take interrupts
+        // until we are fully switched out. So it can't wake us up before we
+        // are asleep.
+        timer_start(&timer, deadline_ns, is_precise);
+        thread_set_sleep_scheduled(thread, true);
+        scheduler_yield();
+        if (thread_is_sleep_scheduled(thread)) {
+                // There was nothing else to run(Not even the idle thread), so
+                // we couldn't sleep. Wait for interrupts instead.
+                thread_set_sleep_scheduled(thread, false);
+                (void)timer_cancel(&timer);
+                interrupts_enable();
+                while (clock_monotonic_ns() < deadline_ns) {
+                        interrupts_wait();
+                }
+                interrupts_disable();
+        }
+        LEAVE_NO_INTERRUPT_SECTION();
+}
+
+void timer_sleep(uint64_t ns) {
+        uint64_t now = clock_monotonic_ns();
+        uint64_t deadline = now + ns;
+        if (deadline < now) {
+                deadline = UINT64_MAX;
+        }
+        timer_sleep_until(deadline, true);
+}
+
+void timer_set_tick_interval(unsigned ticks) {
+        ASSERT(ticks != 0);
+        struct Timer_Base *base = current_timer_base();
+        bool prev_interrupt_state;
+        spinlock_lock(&base->lock, &prev_interrupt_state);
+        if (base->tick_interval != ticks) {
+                base->tick_interval = ticks;
+                program_next_event(base);
+        }
+        spinlock_unlock(&base->lock, prev_interrupt_state);
+}
+
+void timer_on_interrupt(void) {
+        ASSERT(!interrupts_are_enabled());
+        struct Timer_Base *base = processor_timer_base(processor_current());
+        if (!base) {
+                // Keep the timer going until we are ready. Failing is fine,
+                // since that means something else drives the ticks.
+                bool armed = processor_arm_timer(TICKTIME_NS_PER_TICK);
+                (void)armed;
+                return;
+        }
+        struct List expired = {0};
+        bool prev_interrupt_state;
+        spinlock_lock(&base->lock, &prev_interrupt_state);
+        uint64_t now = clock_monotonic_ns();
+        while (1) {
+                struct Timer *timer = earliest_precise_timer(base);
+                if (!timer || (now < timer->deadline_ns)) {
+                        break;
+                }
+                avltree_remove(&base->tree, &timer->node_head.tree_node);
+                timer->base = NULL;
+                list_insert_tail(&expired, &timer->node_head.wheel_node);
+        }
+        advance_wheel(base, ticktime_get_count(), &expired);
+        spinlock_unlock(&base->lock, prev_interrupt_state);
+
+        // Callbacks may start timers again, so they run without the lock.
+        while (expired.head) {
+                struct Timer *timer = expired.head;
+                list_remove_head(&expired);
+                timer->callback(timer, timer->data);
+        }
+
+        spinlock_lock(&base->lock, &prev_interrupt_state);
+        program_next_event(base);
+        spinlock_unlock(&base->lock, prev_interrupt_state);
+}
+
+void timer_init_for_current_processor(void) {
+        struct Timer_Base *base = kmalloc(sizeof(*base));
+        if (!base) {
+                panic("Not enough kmalloc memory to create timer base");
+        }
+        kmemset(base, 0, sizeof(*base));
+        base->wheel_tick = ticktime_get_count();
+        // Timer starts with 1ms interval.
+        base->tick_interval = 1;
+        base->next_event_ns = clock_monotonic_ns() + TICKTIME_NS_PER_TICK;
+        processor_set_timer_base(processor_current(), base);
+}
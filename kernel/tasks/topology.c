@@ -0,0 +1,79 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "tasks.h"
+#include "kernel/arch/arch.h"
+#include "kernel/kernel.h"
+#include "kernel/lock/spinlock.h"
+#include "kernel/utility/utility.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+struct Masks {
+        cpumask_t sibling, package, llc;
+};
+
+// Masks only ever gain processors, as processors start.
+static struct Masks s_masks[CPUMASK_MAX_PROCESSORS];
+static struct SpinLock s_lock;
+
+// Caller must hold the lock.
+static void link_processors(
+        size_t a,
+        struct Processor_Topology const *a_topology,
+        size_t b,
+        struct Processor_Topology const *b_topology
+) {
+        if (a_topology->core_id == b_topology->core_id) {
+                bitmap_set(s_masks[a].sibling.bits, b);
+                bitmap_set(s_masks[b].sibling.bits, a);
+        }
+        if (a_topology->package_id == b_topology->package_id) {
+                bitmap_set(s_masks[a].package.bits, b);
+                bitmap_set(s_masks[b].package.bits, a);
+        }
+        if (a_topology->llc_id == b_topology->llc_id) {
+                bitmap_set(s_masks[a].llc.bits, b);
+                bitmap_set(s_masks[b].llc.bits, a);
+        }
+}
+
+void topology_add_current_processor(void) {
+        bool prev_interrupt_state;
+        spinlock_lock(&s_lock, &prev_interrupt_state);
+        struct Processor_LocalState *processor = processor_current();
+        size_t index = processor->cpu_num;
+        ASSERT(index < CPUMASK_MAX_PROCESSORS);
+        struct Processor_Topology topology;
+        bool is_known = processor_get_topology(processor, &topology);
+        bitmap_set(s_masks[index].sibling.bits, index);
+        bitmap_set(s_masks[index].package.bits, index);
+        bitmap_set(s_masks[index].llc.bits, index);
+        size_t count = processor_count();
+        for (size_t i = 0; is_known && (i < count); ++i) {
+                struct Processor_Topology other_topology;
+                // Ones that don't know theirs yet link with us when they
+                // get here.
+                if ((i == index) ||
+                    !processor_get_topology(processor_at(i), &other_topology)) {
+                        continue;
+                }
+                link_processors(index, &topology, i, &other_topology);
+        }
+        spinlock_unlock(&s_lock, prev_interrupt_state);
+}
+
+cpumask_t const *topology_sibling_mask(size_t processor_index) {
+        ASSERT(processor_index < CPUMASK_MAX_PROCESSORS);
+        return &s_masks[processor_index].sibling;
+}
+
+cpumask_t const *topology_package_mask(size_t processor_index) {
+        ASSERT(processor_index < CPUMASK_MAX_PROCESSORS);
+        return &s_masks[processor_index].package;
+}
+
+cpumask_t const *topology_llc_mask(size_t processor_index) {
+        ASSERT(processor_index < CPUMASK_MAX_PROCESSORS);
+        return &s_masks[processor_index].llc;
+}
@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include "tasks.h"
+#include "kernel/arch/arch.h"
+#include "kernel/kernel.h"
+#include <stdbool.h>
+
+static char const *LOG_TAG = "workingset";
+
+// Each working set window is multiple of this.
+#define SCAN_INTERVAL_TICKS 1000
+
+// Processes are pinned one by one, so the process list isn't locked while
+// scanning.
+static void scan_processes(void) {
+        pid_t next_id = 0;
+        while (1) {
+                struct Process *process = process_pin_next(next_id);
+                if (!process) {
+                        break;
+                }
+                next_id = process_get_id(process) + 1;
+                if (!process_is_kernel(process)) {
+                        process_scan_working_set(process);
+                }
+                process_unpin(process);
+        }
+}
+
+static void run_scanner(void) {
+        interrupts_enable();
+        uint64_t next_scan_ns = clock_monotonic_ns();
+        while (1) {
+                next_scan_ns += SCAN_INTERVAL_TICKS * TICKTIME_NS_PER_TICK;
+                timer_sleep_until(next_scan_ns, false);
+                scan_processes();
+        }
+}
+
+void workingset_scanner_start(void) {
+        struct Thread *thread = thread_spawn(
+                process_kernel(), "working set scanner", run_scanner
+        );
+        if (!thread) {
+                // Working sets just won't be estimated, which nothing depends
+                // on.
+                LOGE(LOG_TAG, "Failed to start the working set scanner thread");
+        }
+}
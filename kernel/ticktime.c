@@ -5,13 +5,34 @@
 #include "kernel/arch/arch.h"
 #include "kernel/tasks/tasks.h"
 
+// Only used until the processor clock is ready.
 static tick_t gs_tick_count = 0;
 
-void ticktime_increment_tick() {
+static void advance(tick_t elapsed_ticks) {
+        // BSP keeps the time.
         if (processor_current()->flags & PROCESSOR_LOCALSTATE_FLAG_BSP) {
-                ++gs_tick_count;
+                gs_tick_count += elapsed_ticks;
         }
-        scheduler_on_timer_tick();
 }
 
-tick_t ticktime_get_count() { return gs_tick_count; }
+void ticktime_on_timer_interrupt(tick_t elapsed_ticks) {
+        advance(elapsed_ticks);
+        timer_on_interrupt();
+        scheduler_on_timer_tick(elapsed_ticks);
+}
+
+void ticktime_increment_tick() { ticktime_on_timer_interrupt(1); }
+
+tick_t ticktime_get_count() {
+        return clock_monotonic_ns() / TICKTIME_NS_PER_TICK;
+}
+
+uint64_t clock_monotonic_ns() {
+        uint64_t ns;
+        if (processor_clock_ns(&ns)) {
+                return ns;
+        }
+        // Processor clock counts from the reset, so it's always ahead of this.
+        return __atomic_load_n(&gs_tick_count, __ATOMIC_RELAXED) *
+               TICKTIME_NS_PER_TICK;
+}
@@ -222,6 +222,40 @@ void *avltree_search(struct AVLTree *tree, avltree_key_t key) {
         return NULL;
 }
 
+void *avltree_search_floor(struct AVLTree *tree, avltree_key_t key) {
+        struct AVLTree_Node *current = tree->root;
+        struct AVLTree_Node *result = NULL;
+        while (current) {
+                if (current->key == key) {
+                        return current;
+                }
+                if (current->key < key) {
+                        result = current;
+                        current = current->children[DIR_RIGHT];
+                } else {
+                        current = current->children[DIR_LEFT];
+                }
+        }
+        return result;
+}
+
+void *avltree_search_ceil(struct AVLTree *tree, avltree_key_t key) {
+        struct AVLTree_Node *current = tree->root;
+        struct AVLTree_Node *result = NULL;
+        while (current) {
+                if (current->key == key) {
+                        return current;
+                }
+                if (key < current->key) {
+                        result = current;
+                        current = current->children[DIR_LEFT];
+                } else {
+                        current = current->children[DIR_RIGHT];
+                }
+        }
+        return result;
+}
+
 void avltree_insert(struct AVLTree *tree, void *node, avltree_key_t key) {
 #ifdef YJK_ULTRA_PARANOID_MODE
         check_integrity(*tree);
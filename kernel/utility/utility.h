@@ -76,6 +76,12 @@ void *avltree_min_node(struct AVLTree_Node *node);
 void *avltree_successor_of(struct AVLTree_Node *node);
 void *avltree_predecessor_of(struct AVLTree_Node *node);
 void *avltree_search(struct AVLTree *tree, avltree_key_t key);
+// Returns the node with largest key that is less than or equal to `key`.
+// Returns NULL if there's no such node.
+void *avltree_search_floor(struct AVLTree *tree, avltree_key_t key);
+// Returns the node with smallest key that is greater than or equal to `key`.
+// Returns NULL if there's no such node.
+void *avltree_search_ceil(struct AVLTree *tree, avltree_key_t key);
 void avltree_insert(struct AVLTree *tree, void *node, avltree_key_t key);
 void avltree_remove(struct AVLTree *tree, struct AVLTree_Node *node);
 
@@ -29,6 +29,11 @@ use_gdbstub = False
 if os.getenv('YJK_USE_GDBSTUB') == '1':
         use_gdbstub = True
 
+# Only the serial console is used, e.g. for running benchmarks unattended.
+use_headless = False
+if os.getenv('YJK_HEADLESS') == '1':
+        use_headless = True
+
 cdrom_path="boot.iso"
 
 qemu_args = [
@@ -47,6 +52,9 @@ qemu_args = [
 if use_gdbstub:
         qemu_args.append("-s")
 
+if use_headless:
+        qemu_args[qemu_args.index("sdl")] = "none"
+
 if IS_WSL2:
         # As of QEMU 8.1.94, QEMU doesn't like loading CD-ROM images from WSL side:
         # ERROR:../../../block.c:1699:bdrv_open_driver: assertion failed: (is_power_of_2(bs->bl.request_alignment))
@@ -3,6 +3,7 @@
 // SPDX-License-Identifier: BSD-2-Clause
 #include <sched.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 #include <yjk/dprint.h>
 
@@ -10,6 +11,9 @@ int main() {
         (void)fprintf(dprnout, "Start executive\n");
         
         while (1) {
+                // Nothing to do yet, so don't burn the processor.
+                struct timespec duration = {.tv_sec = 1};
+                (void)nanosleep(&duration, NULL);
                 continue;
                 (void)fputs("# ", stderr);
                 char buf[160];
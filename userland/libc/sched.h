@@ -2,5 +2,23 @@
 //
 // SPDX-License-Identifier: BSD-2-Clause
 #pragma once
+#include "sys/types.h"
+#include <bits/sched.h>
 
-int sched_yield(void);
\ No newline at end of file
+#define CPU_ZERO(__set) \
+        __builtin_memset((__set), 0, sizeof(cpu_set_t))
+#define CPU_SET(__cpu, __set) \
+        ((__set)->bits[(__cpu) / 64] |= (1ULL << ((__cpu) % 64)))
+#define CPU_CLR(__cpu, __set) \
+        ((__set)->bits[(__cpu) / 64] &= ~(1ULL << ((__cpu) % 64)))
+#define CPU_ISSET(__cpu, __set) \
+        (((__set)->bits[(__cpu) / 64] >> ((__cpu) % 64)) & 1)
+
+int sched_yield(void);
+// Only the calling thread(`pid` 0) is supported for now.
+int sched_setaffinity(pid_t pid, size_t cpusetsize, cpu_set_t const *mask);
+int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask);
+// Only the calling thread(`pid` 0) is supported for now.
+int sched_setscheduler(pid_t pid, int policy, struct sched_param const *param);
+int sched_getscheduler(pid_t pid);
+int sched_getparam(pid_t pid, struct sched_param *param);
@@ -0,0 +1,13 @@
+#include "sched.h"
+#include <errno.h>
+#include <yjk/syscall.h>
+
+// https://man7.org/linux/man-pages/man2/sched_setaffinity.2.html (Not in POSIX)
+int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask) {
+        int64_t result = syscall3(SYSCALL_INDEX_SCHED_GETAFFINITY, pid, cpusetsize, (uint64_t)mask);
+        if (result < 0) {
+                errno = -result;
+                return -1;
+        }
+        return 0;
+}
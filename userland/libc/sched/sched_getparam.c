@@ -0,0 +1,13 @@
+#include "sched.h"
+#include <errno.h>
+#include <yjk/syscall.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/sched_getparam.html
+int sched_getparam(pid_t pid, struct sched_param *param) {
+        int64_t result = syscall2(SYSCALL_INDEX_SCHED_GETPARAM, pid, (uint64_t)param);
+        if (result < 0) {
+                errno = -result;
+                return -1;
+        }
+        return 0;
+}
@@ -0,0 +1,13 @@
+#include "sched.h"
+#include <errno.h>
+#include <yjk/syscall.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/sched_getscheduler.html
+int sched_getscheduler(pid_t pid) {
+        int64_t result = syscall1(SYSCALL_INDEX_SCHED_GETSCHEDULER, pid);
+        if (result < 0) {
+                errno = -result;
+                return -1;
+        }
+        return (int)result;
+}
@@ -0,0 +1,13 @@
+#include "sched.h"
+#include <errno.h>
+#include <yjk/syscall.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/sched_setscheduler.html
+int sched_setscheduler(pid_t pid, int policy, struct sched_param const *param) {
+        int64_t result = syscall3(SYSCALL_INDEX_SCHED_SETSCHEDULER, pid, policy, (uint64_t)param);
+        if (result < 0) {
+                errno = -result;
+                return -1;
+        }
+        return 0;
+}
@@ -74,6 +74,8 @@ static int print_hex(FILE *file, unsigned long i, bool uppercase) {
 
 int vfprintf(FILE *file, char const *fmt, va_list ap) {
     uint8_t flags = 0;
+    // Set by the 'l' length modifier.
+    bool is_long = false;
     int written_len = 0;
 
 percent_or_char:
@@ -82,6 +84,8 @@ percent_or_char:
     }
     if (fmt[0] == '%') {
         ++fmt;
+        flags = 0;
+        is_long = false;
         goto fmt_flag;
     }
     fputc(fmt[0], file);
@@ -97,11 +101,15 @@ fmt_flag:
             flags |= FMT_FLAG_ALTERNATE_FORM;
             break;
         default:
-            goto do_fmt;
+            goto fmt_length;
     }
     ++fmt;
     goto fmt_flag;
-do_fmt:
+fmt_length:
+    if (fmt[0] == 'l') {
+        is_long = true;
+        ++fmt;
+    }
     if (!fmt[0]) {
         goto end;
     }
@@ -125,7 +133,7 @@ do_fmt:
             break;
         }
         case 'd': {
-            int d = va_arg(ap, int);
+            long d = is_long ? va_arg(ap, long) : va_arg(ap, int);
             int len = print_signed_dec(file, d);
             if (len == EOF) {
                // TODO: Handle error
@@ -135,7 +143,8 @@ do_fmt:
             break;
         }
         case 'u': {
-            unsigned u = va_arg(ap, unsigned);
+            unsigned long u =
+                is_long ? va_arg(ap, unsigned long) : va_arg(ap, unsigned);
             int len = print_unsigned_dec(file, u);
             if (len == EOF) {
                // TODO: Handle error
@@ -154,7 +163,8 @@ do_fmt:
                 }
                 written_len += 2;
             }
-            unsigned u = va_arg(ap, unsigned);
+            unsigned long u =
+                is_long ? va_arg(ap, unsigned long) : va_arg(ap, unsigned);
             int len = print_hex(file, u, is_uppercase);
             if (len == EOF) {
                // TODO: Handle error
@@ -0,0 +1,21 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "sys/types.h"
+#include <bits/mman.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/basedefs/sys_mman.h.html
+
+#define MAP_FAILED ((void *)-1)
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off);
+int munmap(void *addr, size_t len);
+
+#if defined(__cplusplus)
+}
+#endif
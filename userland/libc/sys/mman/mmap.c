@@ -0,0 +1,15 @@
+#include "sys/mman.h"
+#include <yjk/syscall.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/mmap.html
+void *mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off) {
+        // Only anonymous mappings are supported, which ignore these.
+        (void)fildes;
+        (void)off;
+        int64_t result =
+                syscall4(SYSCALL_INDEX_MMAP, (uintptr_t)addr, len, prot, flags);
+        if (result < 0) {
+                return MAP_FAILED;
+        }
+        return (void *)result;
+}
@@ -0,0 +1,7 @@
+#include "sys/mman.h"
+#include <yjk/syscall.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/munmap.html
+int munmap(void *addr, size_t len) {
+        return syscall2(SYSCALL_INDEX_MUNMAP, (uintptr_t)addr, len);
+}
@@ -0,0 +1,18 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+#include "sys/types.h"
+#include <bits/resource.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/basedefs/sys_resource.h.html
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+int getrusage(int who, struct rusage *r_usage);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,13 @@
+#include "sys/resource.h"
+#include <errno.h>
+#include <yjk/syscall.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/getrusage.html
+int getrusage(int who, struct rusage *r_usage) {
+        int64_t result = syscall2(SYSCALL_INDEX_GETRUSAGE, who, (uint64_t)r_usage);
+        if (result < 0) {
+                errno = -result;
+                return -1;
+        }
+        return 0;
+}
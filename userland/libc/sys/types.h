@@ -13,6 +13,9 @@ extern "C" {
 typedef int pid_t;
 typedef size_t size_t;
 typedef long long ssize_t;
+typedef long long off_t;
+typedef long long time_t;
+typedef long suseconds_t;
 
 #if defined(__cplusplus)
 }
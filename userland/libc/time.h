@@ -2,6 +2,8 @@
 //
 // SPDX-License-Identifier: BSD-2-Clause
 #pragma once
+#include "sys/types.h"
+#include <bits/time.h>
 
 // https://pubs.opengroup.org/onlinepubs/9699919799/basedefs/time.h.html
 
@@ -9,6 +11,12 @@
 extern "C" {
 #endif
 
+typedef int clockid_t;
+
+int clock_gettime(clockid_t clock_id, struct timespec *tp);
+int clock_nanosleep(clockid_t clock_id, int flags, struct timespec const *rqtp, struct timespec *rmtp);
+int nanosleep(struct timespec const *rqtp, struct timespec *rmtp);
+
 #if defined(__cplusplus)
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "time.h"
+#include <bits/clockpage.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <yjk/syscall.h>
+
+static uint64_t rdtscp(uint32_t *aux_out) {
+        uint32_t lo, hi, aux;
+        __asm__ volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+        *aux_out = aux;
+        return ((uint64_t)hi << 32) | lo;
+}
+
+// Returns false if the clock page can't be used.
+static bool read_clock_page(uint64_t *ns_out) {
+        struct ClockPage const *page = (struct ClockPage const *)CLOCKPAGE_ADDR;
+        while (1) {
+                uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+                if (seq & 1) {
+                        continue;
+                }
+                if (!__atomic_load_n(&page->is_usable, __ATOMIC_RELAXED)) {
+                        return false;
+                }
+                uint32_t cpu_num;
+                uint64_t tsc = rdtscp(&cpu_num);
+                uint64_t offset = __atomic_load_n(
+                        &page->tsc_offsets[cpu_num % CLOCKPAGE_MAX_PROCESSORS],
+                        __ATOMIC_RELAXED
+                );
+                uint64_t mult = __atomic_load_n(&page->ns_mult, __ATOMIC_RELAXED);
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq) {
+                        continue;
+                }
+                *ns_out = ((unsigned __int128)(tsc - offset) * mult) >> 32;
+                return true;
+        }
+}
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/clock_gettime.html
+int clock_gettime(clockid_t clock_id, struct timespec *tp) {
+        // There's no wall clock yet, so both clocks count from the boot.
+        if ((clock_id != CLOCK_REALTIME) && (clock_id != CLOCK_MONOTONIC)) {
+                errno = EINVAL;
+                return -1;
+        }
+        uint64_t ns;
+        if (!read_clock_page(&ns)) {
+                int64_t result = syscall2(SYSCALL_INDEX_CLOCK_GETTIME, clock_id, (uint64_t)tp);
+                if (result < 0) {
+                        errno = -result;
+                        return -1;
+                }
+                return 0;
+        }
+        tp->tv_sec = (time_t)(ns / 1000000000ULL);
+        tp->tv_nsec = (long)(ns % 1000000000ULL);
+        return 0;
+}
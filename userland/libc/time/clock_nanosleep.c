@@ -0,0 +1,13 @@
+#include "time.h"
+#include <yjk/syscall.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/clock_nanosleep.html
+int clock_nanosleep(clockid_t clock_id, int flags, struct timespec const *rqtp, struct timespec *rmtp) {
+        // Unlike most functions, this returns the error number instead of
+        // setting errno.
+        int64_t result = syscall4(SYSCALL_INDEX_CLOCK_NANOSLEEP, clock_id, flags, (uint64_t)rqtp, (uint64_t)rmtp);
+        if (result < 0) {
+                return -result;
+        }
+        return 0;
+}
@@ -0,0 +1,12 @@
+#include "time.h"
+#include <errno.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/nanosleep.html
+int nanosleep(struct timespec const *rqtp, struct timespec *rmtp) {
+        int result = clock_nanosleep(CLOCK_REALTIME, 0, rqtp, rmtp);
+        if (result != 0) {
+                errno = result;
+                return -1;
+        }
+        return 0;
+}
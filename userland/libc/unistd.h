@@ -23,6 +23,7 @@ int execv(char const *path, char *const argv[]);
 int execve(char const *path, char *const argv[], char *const envp[]);
 int execvp(char const *file, char *const argv[]);
 pid_t getpid(void);
+int nice(int incr);
 ssize_t write(int fildes, void const *buf, size_t nbyte);
 ssize_t read(int fildes, void *buf, size_t nbyte);
 
@@ -0,0 +1,5 @@
+#include "unistd.h"
+#include <yjk/syscall.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/fork.html
+pid_t fork(void) { return syscall0(SYSCALL_INDEX_FORK); }
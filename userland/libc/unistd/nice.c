@@ -0,0 +1,15 @@
+#include "unistd.h"
+#include <errno.h>
+#include <limits.h>
+#include <yjk/syscall.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/functions/nice.html
+int nice(int incr) {
+        // Kernel returns NZERO - (new nice value) on success.
+        int64_t result = syscall1(SYSCALL_INDEX_NICE, incr);
+        if (result < 0) {
+                errno = -result;
+                return -1;
+        }
+        return NZERO - (int)result;
+}
@@ -0,0 +1,10 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include <yjk/syscall.h>
+#include <yjk/thread.h>
+
+_Noreturn void yjk_thread_exit(void) {
+        syscall0(SYSCALL_INDEX_THREAD_EXIT);
+        while (1) {}
+}
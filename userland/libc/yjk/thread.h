@@ -0,0 +1,7 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#pragma once
+
+// Exits the calling thread. Other threads of the process keep running.
+_Noreturn void yjk_thread_exit(void);
@@ -5,6 +5,7 @@
 #include "stdio.h"
 #include <yjk/magicfd.h>
 #include <yjk/dprint.h>
+#include <yjk/thread.h>
 
 extern int main(int argc, char **argv);
 
@@ -14,5 +15,5 @@ void _start() {
         __libc_fdopen_inner(dprnout, MAGICFD_DPRINT, "w");
         char *argv[] = {"<todo: argv>"};
         main(1, argv);
-        while (1) {}
+        yjk_thread_exit();
 }
@@ -0,0 +1,164 @@
+// SPDX-FileCopyrightText: (c) 2026 Inseo Oh <dhdlstjtr@gmail.com>
+//
+// SPDX-License-Identifier: BSD-2-Clause
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <yjk/dprint.h>
+#include <yjk/thread.h>
+
+// Measures scheduler overhead as seen from userland, and prints the results to
+// the debug console(which also goes to the serial port).
+
+#define ITERATIONS 1000
+// Child of the ping-pong benchmark yields a bit more than the parent, so that
+// the parent always has someone to switch to.
+#define CHILD_EXTRA_ITERATIONS 16
+// Processor both sides of the ping-pong run on.
+#define PINGPONG_CPU 0
+
+static uint64_t s_samples[ITERATIONS];
+
+static uint64_t read_tsc(void) { return __builtin_ia32_rdtsc(); }
+
+static uint64_t read_ns(void) {
+        struct timespec ts;
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+                return 0;
+        }
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// TSC frequency isn't known to userland, so it's measured against the
+// monotonic clock over the whole benchmark.
+struct Calibration {
+        uint64_t start_tsc, start_ns;
+        uint64_t cycles, ns;
+};
+
+static void calibration_start(struct Calibration *out) {
+        out->start_ns = read_ns();
+        out->start_tsc = read_tsc();
+}
+
+static void calibration_end(struct Calibration *calibration) {
+        calibration->cycles = read_tsc() - calibration->start_tsc;
+        calibration->ns = read_ns() - calibration->start_ns;
+}
+
+static uint64_t
+ns_from_cycles(struct Calibration const *calibration, uint64_t cycles) {
+        if (calibration->cycles == 0) {
+                return 0;
+        }
+        return cycles * calibration->ns / calibration->cycles;
+}
+
+static void sort_samples(uint64_t *samples, size_t count) {
+        // Shell sort with Ciura's gaps is plenty for this many samples.
+        static size_t const GAPS[] = {701, 301, 132, 57, 23, 10, 4, 1};
+        for (size_t g = 0; g < sizeof(GAPS) / sizeof(*GAPS); ++g) {
+                size_t gap = GAPS[g];
+                for (size_t i = gap; i < count; ++i) {
+                        uint64_t sample = samples[i];
+                        size_t j = i;
+                        for (; (gap <= j) && (sample < samples[j - gap]);
+                             j -= gap) {
+                                samples[j] = samples[j - gap];
+                        }
+                        samples[j] = sample;
+                }
+        }
+}
+
+// `permille` of 1000 is the maximum.
+static void show_percentile(
+        char const *label,
+        size_t permille,
+        struct Calibration const *calibration
+) {
+        size_t index = ITERATIONS * permille / 1000;
+        if (ITERATIONS <= index) {
+                index = ITERATIONS - 1;
+        }
+        uint64_t cycles = s_samples[index];
+        (void)fprintf(
+                dprnout,
+                " %s %lu(%luns)",
+                label,
+                (unsigned long)cycles,
+                (unsigned long)ns_from_cycles(calibration, cycles)
+        );
+}
+
+static void
+show_results(char const *name, struct Calibration const *calibration) {
+        sort_samples(s_samples, ITERATIONS);
+        (void)fprintf(
+                dprnout, "%s: %u samples, cycles(ns)\n", name, ITERATIONS
+        );
+        show_percentile("min", 0, calibration);
+        show_percentile("p50", 500, calibration);
+        show_percentile("p90", 900, calibration);
+        show_percentile("p99", 990, calibration);
+        show_percentile("p99.9", 999, calibration);
+        show_percentile("max", 1000, calibration);
+        (void)fprintf(dprnout, "\n");
+}
+
+// Each sample is a sched_yield() with nothing else to run, so it's just the
+// system call and the scheduler's bookkeeping.
+static void bench_syscall_yield(void) {
+        struct Calibration calibration;
+        calibration_start(&calibration);
+        for (size_t i = 0; i < ITERATIONS; ++i) {
+                uint64_t start = read_tsc();
+                sched_yield();
+                s_samples[i] = read_tsc() - start;
+        }
+        calibration_end(&calibration);
+        show_results("sched_yield round trip", &calibration);
+}
+
+// Parent and child on the same processor yield to each other, so each sample
+// of the parent is two system calls and two context switches.
+static void bench_yield_pingpong(void) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(PINGPONG_CPU, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+                (void)fprintf(dprnout, "Yield ping-pong: can't set affinity\n");
+                return;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+                (void)fprintf(dprnout, "Yield ping-pong: can't fork\n");
+                return;
+        }
+        if (pid == 0) {
+                for (size_t i = 0; i < ITERATIONS + CHILD_EXTRA_ITERATIONS;
+                     ++i) {
+                        sched_yield();
+                }
+                yjk_thread_exit();
+        }
+        struct Calibration calibration;
+        calibration_start(&calibration);
+        for (size_t i = 0; i < ITERATIONS; ++i) {
+                uint64_t start = read_tsc();
+                sched_yield();
+                s_samples[i] = read_tsc() - start;
+        }
+        calibration_end(&calibration);
+        show_results("Same-CPU yield ping-pong(round trip)", &calibration);
+}
+
+int main() {
+        (void)fprintf(dprnout, "Scheduler benchmarks\n");
+        bench_syscall_yield();
+        bench_yield_pingpong();
+        (void)fprintf(dprnout, "Scheduler benchmarks done\n");
+        return 0;
+}